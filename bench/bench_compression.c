@@ -0,0 +1,159 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * CPU cost of gzip-compressing fetch responses versus the bytes it saves.
+ *
+ * Builds a fetch response of the requested size with the same serializer the
+ * daemon streams with, then compresses it at every zlib level: once as a
+ * whole (buffered responses) and once in DBHANDLER_STREAM_BATCH_SIZE pieces
+ * with a sync flush after each (chunked responses). The last column is the
+ * time the smaller body saves on a link of the given speed, minus the CPU
+ * time spent compressing it. Numbers are only meaningful on the target
+ * hardware, so run this on the Pi itself.
+ *
+ * Usage: bench_compression [rows] [link speed in Mbit/s]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "compression.h"
+#include "datastructures.h"
+#include "dbhandler.h"
+
+#define BENCH_DEFAULT_ROWS              2016    /* A week at 5 minute intervals */
+#define BENCH_DEFAULT_LINK_MBITS        10.0    /* Slow Wi-Fi */
+#define BENCH_MIN_DURATION_NS           200000000LL
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int build_document(strbuf *doc, int rows) {
+	char unitstr[RPIWD_MAX_MEASUREMENTS] = { 'c', '%' };
+	char record_date[DATE_BUFFER_SIZE];
+	time_t when = 1500000000;
+	entry ent;
+
+	ent.location = "living room";
+	ent.device_name = "dht22";
+	ent.record_date = record_date;
+
+	if (strbuf_init(doc, STRBUF_DEFAULT_CAPACITY) == -1 ||
+		entrylist_json_stream_begin(doc, unitstr) == -1)
+		return -1;
+
+	/* Readings drift slowly, like real ones */
+	for (int i = 0; i < rows; i++, when += 300) {
+		strftime(record_date, sizeof(record_date), "%Y-%m-%d %H:%M:%S", gmtime(&when));
+		ent.id = i + 1;
+		ent.temperature = 21.5f + (float)((i * 7) % 40) / 10.0f;
+		ent.humidity = 40.0f + (float)((i * 3) % 20);
+
+		if (entry_json_stream_append(doc, &ent, i == 0) == -1)
+			return -1;
+	}
+
+	return entrylist_json_stream_end(doc, rows);
+}
+
+static size_t compress_whole(const strbuf *doc, int level) {
+	size_t length = 0;
+	char *out = gzip_compress(doc->data, doc->length, level, &length);
+
+	free(out);
+	return length;
+}
+
+static size_t compress_batches(const strbuf *doc, int level) {
+	rpiwd_gzip_stream *stream = gzip_stream_open(level);
+	size_t total = 0, length, offset, piece;
+	char *out;
+
+	for (offset = 0; stream && offset < doc->length; offset += piece) {
+		piece = doc->length - offset < DBHANDLER_STREAM_BATCH_SIZE ?
+			doc->length - offset : DBHANDLER_STREAM_BATCH_SIZE;
+
+		out = gzip_stream_write(stream, doc->data + offset, piece, false, &length);
+		free(out);
+		total += length;
+	}
+
+	if (stream) {
+		out = gzip_stream_write(stream, "", 0, true, &length);
+		free(out);
+		total += length;
+		gzip_stream_close(stream);
+	}
+
+	return total;
+}
+
+static void run(const char *name, size_t (*compress)(const strbuf *, int),
+		const strbuf *doc, int level, double link_mbits) {
+	long long start, elapsed;
+	size_t length = 0;
+	long count = 0;
+	double cpu_ms, saved_ms;
+
+	start = now_ns();
+	do {
+		length = compress(doc, level);
+		count++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_DURATION_NS);
+
+	cpu_ms = elapsed / 1e6 / count;
+	saved_ms = (double)(doc->length - length) * 8 / (link_mbits * 1e3);
+
+	printf("%-8s level %d: %8zu bytes (%5.1f%%)  %8.2f ms  %7.1f MB/s  net %+8.1f ms\n",
+			name, level, length, 100.0 * length / doc->length, cpu_ms,
+			doc->length / 1e3 / cpu_ms, saved_ms - cpu_ms);
+}
+
+int main(int argc, char **argv) {
+	int rows = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_ROWS;
+	double link_mbits = argc > 2 ? atof(argv[2]) : BENCH_DEFAULT_LINK_MBITS;
+	strbuf doc;
+
+	if (!compression_available()) {
+		fprintf(stderr, "built without zlib\n");
+		return EXIT_FAILURE;
+	}
+
+	if (rows <= 0 || link_mbits <= 0 || build_document(&doc, rows) == -1) {
+		fprintf(stderr, "usage: %s [rows] [link speed in Mbit/s]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d rows, %zu bytes of JSON, %.1f Mbit/s link\n", rows, doc.length, link_mbits);
+
+	for (int level = 1; level <= COMPRESSION_LEVEL_MAX; level++)
+		run("whole", compress_whole, &doc, level, link_mbits);
+
+	for (int level = 1; level <= COMPRESSION_LEVEL_MAX; level++)
+		run("batches", compress_batches, &doc, level, link_mbits);
+
+	strbuf_free(&doc);
+	return EXIT_SUCCESS;
+}
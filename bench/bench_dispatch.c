@@ -0,0 +1,147 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Command and parameter lookup cost.
+ *
+ * The daemon looks up every request's command, and every parameter of a
+ * fetch, by name. The perfect hashes built from the tables in listener.h are
+ * compared to walking those tables with strcmp(), which is what the daemon
+ * used to do. Lookups mix known names with unknown ones, as clients send both.
+ *
+ * The second part repeats this for synthetic tables of growing size: a
+ * walk gets slower with every name added, a perfect hash does not.
+ *
+ * Usage: bench_dispatch [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "perfecthash.h"
+#include "listener.h"
+
+#define BENCH_DEFAULT_ITERATIONS        2000000
+#define BENCH_NAME_LENGTH               16
+#define BENCH_MAX_NAMES                 PERFECT_HASH_MAX_KEYS
+
+#define BENCH_COMMAND_NAME(name, callback, bucket)  name,
+#define BENCH_PARAM_NAME(id, name)                  name,
+
+static const char *const __commands[] = { LISTENER_COMMANDS(BENCH_COMMAND_NAME) };
+static const char *const __params[] = { FETCH_PARAMS(BENCH_PARAM_NAME) };
+
+/* What requests ask for, unknown names included */
+static const char *const __command_lookups[] = {
+	"fetch", "current", "fetch", "statistics", "config", "fetch", "favicon.ico", "nope"
+};
+static const char *const __param_lookups[] = {
+	"from", "to", "tempunit", "select", "on", "from", "limit", "to"
+};
+
+static volatile long __sink;
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int lookup_walk(const char *const *names, size_t count, const char *name) {
+	for (size_t i = 0; i < count; i++)
+		if (strcmp(names[i], name) == 0)
+			return i;
+
+	return PERFECT_HASH_NO_KEY;
+}
+
+static void run(const char *label, const char *const *names, size_t count,
+		const char *const *lookups, size_t lookup_count, long iterations) {
+	rpiwd_perfect_hash table;
+	size_t lengths[BENCH_MAX_NAMES * 2];
+	long long start, walk_ns, hash_ns;
+	long sum = 0;
+
+	if (perfect_hash_build(&table, names, count) == -1) {
+		fprintf(stderr, "%s: no perfect hash found\n", label);
+		return;
+	}
+
+	/* The parser hands over names with their lengths */
+	for (size_t i = 0; i < lookup_count; i++)
+		lengths[i] = strlen(lookups[i]);
+
+	start = now_ns();
+	for (long i = 0; i < iterations; i++)
+		for (size_t j = 0; j < lookup_count; j++)
+			sum += lookup_walk(names, count, lookups[j]);
+	walk_ns = now_ns() - start;
+
+	start = now_ns();
+	for (long i = 0; i < iterations; i++)
+		for (size_t j = 0; j < lookup_count; j++)
+			sum += perfect_hash_lookup(&table, lookups[j], lengths[j]);
+	hash_ns = now_ns() - start;
+
+	__sink += sum;
+	printf("%-20s %2zu names: strcmp walk %6.1f ns/lookup  perfect hash %6.1f ns/lookup"
+			"  (seed %u, %u slots)\n", label, count,
+			(double)walk_ns / (iterations * lookup_count),
+			(double)hash_ns / (iterations * lookup_count),
+			table.seed, table.mask + 1);
+}
+
+int main(int argc, char **argv) {
+	static char names[BENCH_MAX_NAMES][BENCH_NAME_LENGTH];
+	static char misses[BENCH_MAX_NAMES][BENCH_NAME_LENGTH];
+	const char *name_ptrs[BENCH_MAX_NAMES], *lookups[BENCH_MAX_NAMES * 2];
+	long iterations = argc > 1 ? strtol(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%ld iterations\n", iterations);
+
+	run("commands", __commands, sizeof(__commands) / sizeof(__commands[0]),
+			__command_lookups, sizeof(__command_lookups) / sizeof(__command_lookups[0]),
+			iterations);
+	run("fetch parameters", __params, FETCH_PARAM_COUNT, __param_lookups,
+			sizeof(__param_lookups) / sizeof(__param_lookups[0]), iterations);
+
+	/* Every name once, and as many unknown ones */
+	for (size_t i = 0; i < BENCH_MAX_NAMES; i++) {
+		snprintf(names[i], BENCH_NAME_LENGTH, "command%02zu", i);
+		snprintf(misses[i], BENCH_NAME_LENGTH, "unknown%02zu", i);
+		name_ptrs[i] = names[i];
+	}
+
+	for (size_t count = 4; count <= BENCH_MAX_NAMES; count *= 2) {
+		for (size_t i = 0; i < count; i++) {
+			lookups[i * 2] = names[i];
+			lookups[i * 2 + 1] = misses[i];
+		}
+
+		run("synthetic", name_ptrs, count, lookups, count * 2,
+				iterations * 8 / (count * 2));
+	}
+
+	return EXIT_SUCCESS;
+}
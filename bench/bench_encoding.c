@@ -0,0 +1,229 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Encode time and payload size of JSON versus CBOR responses.
+ *
+ * Encodes a fetch result of the requested size in every way the daemon can:
+ * through parson (buffered responses), with the streaming JSON serializer
+ * (chunked responses), and as CBOR both ways. The configuration list stands
+ * in for statistics and configuration, which are key/value lists. Numbers are
+ * only meaningful on the target hardware, so run this on the Pi itself.
+ *
+ * Usage: bench_encoding [rows]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "datastructures.h"
+#include "dbhandler.h"
+
+#define BENCH_DEFAULT_ROWS              DBHANDLER_MAX_FETCHED_ENTRIES
+#define BENCH_KEY_VALUE_PAIRS           21      /* As many as /config has */
+#define BENCH_MIN_DURATION_NS           200000000LL
+
+static char unitstr[RPIWD_MAX_MEASUREMENTS] = { 'c', '%' };
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static entrylist *build_entrylist(int rows) {
+	char record_date[DATE_BUFFER_SIZE];
+	time_t when = 1500000000;
+	entrylist *list = entrylist_alloc(rows);
+	entry *ent;
+
+	if (!list)
+		return NULL;
+
+	/* Readings drift slowly, like real ones */
+	for (int i = 0; i < rows; i++, when += 300) {
+		strftime(record_date, sizeof(record_date), "%Y-%m-%d %H:%M:%S", gmtime(&when));
+
+		ent = &list->entries[list->size++];
+		ent->id = i + 1;
+		ent->record_date = strdup(record_date);
+		ent->temperature = 21.5f + (float)((i * 7) % 40) / 10.0f;
+		ent->humidity = 40.0f + (float)((i * 3) % 20);
+		ent->location = strdup("living room");
+		ent->device_name = strdup("dht22");
+	}
+
+	return list;
+}
+
+static key_value_list *build_key_value_list(void) {
+	key_value_list *list = key_value_list_alloc(BENCH_KEY_VALUE_PAIRS);
+	char key[32], value[32];
+
+	for (int i = 0; list && i < BENCH_KEY_VALUE_PAIRS; i++) {
+		snprintf(key, sizeof(key), "setting_number_%d", i);
+		snprintf(value, sizeof(value), "%d", i * 1000);
+		key_value_list_emplace(list, key, value);
+	}
+
+	return list;
+}
+
+/* Encoders; each returns the payload size */
+static size_t entrylist_json(void *data) {
+	entrylist *list = data;
+	JSON_Value *jval = entrylist_to_json_value(&list, unitstr);
+	char *serialized = json_serialize_to_heap(jval);
+	size_t length = serialized ? strlen(serialized) : 0;
+
+	json_value_free(jval);
+	free(serialized);
+
+	return length;
+}
+
+static size_t entrylist_json_stream(void *data) {
+	entrylist *list = data;
+	strbuf buf;
+	size_t length;
+
+	strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY);
+	entrylist_json_stream_begin(&buf, unitstr);
+	for (size_t i = 0; i < list->size; i++)
+		entry_json_stream_append(&buf, &list->entries[i], i == 0);
+	entrylist_json_stream_end(&buf, list->size);
+
+	length = buf.length;
+	strbuf_free(&buf);
+
+	return length;
+}
+
+static size_t entrylist_cbor(void *data) {
+	strbuf buf;
+	size_t length;
+
+	strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY);
+	entrylist_to_cbor(&buf, data, unitstr);
+
+	length = buf.length;
+	strbuf_free(&buf);
+
+	return length;
+}
+
+static size_t entrylist_cbor_stream(void *data) {
+	entrylist *list = data;
+	strbuf buf;
+	size_t length;
+
+	strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY);
+	entrylist_cbor_stream_begin(&buf, unitstr);
+	for (size_t i = 0; i < list->size; i++)
+		entry_cbor_stream_append(&buf, &list->entries[i]);
+	entrylist_cbor_stream_end(&buf, list->size);
+
+	length = buf.length;
+	strbuf_free(&buf);
+
+	return length;
+}
+
+static size_t key_value_list_json(void *data) {
+	key_value_list *list = data;
+	JSON_Value *jval = key_value_list_to_json_value(&list);
+	char *serialized = json_serialize_to_heap(jval);
+	size_t length = serialized ? strlen(serialized) : 0;
+
+	json_value_free(jval);
+	free(serialized);
+
+	return length;
+}
+
+static size_t key_value_list_cbor(void *data) {
+	strbuf buf;
+	size_t length;
+
+	strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY);
+	key_value_list_to_cbor(&buf, data);
+
+	length = buf.length;
+	strbuf_free(&buf);
+
+	return length;
+}
+
+static void run(const char *name, size_t (*encode)(void *), void *data, size_t baseline) {
+	long long start, elapsed;
+	size_t length = 0;
+	long count = 0;
+	double usec;
+
+	start = now_ns();
+	do {
+		length = encode(data);
+		count++;
+		elapsed = now_ns() - start;
+	} while (elapsed < BENCH_MIN_DURATION_NS);
+
+	usec = elapsed / 1e3 / count;
+
+	printf("%-18s %9zu bytes (%5.1f%%)  %10.1f us  %7.1f MB/s\n",
+			name, length, 100.0 * length / baseline, usec, length / usec);
+}
+
+int main(int argc, char **argv) {
+	int rows = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_ROWS;
+	entrylist *list;
+	key_value_list *kvlist;
+	size_t baseline;
+
+	if (rows <= 0) {
+		fprintf(stderr, "usage: %s [rows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	list = build_entrylist(rows);
+	kvlist = build_key_value_list();
+	if (!list || !kvlist) {
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Sizes are relative to the streaming serializer. It produces the same
+	 * document as parson, except that parson keeps no more than 960 keys in
+	 * an object and silently drops rows beyond that. */
+	printf("fetch, %d rows\n", rows);
+	baseline = entrylist_json_stream(list);
+	run("json", entrylist_json, list, baseline);
+	run("json stream", entrylist_json_stream, list, baseline);
+	run("cbor", entrylist_cbor, list, baseline);
+	run("cbor stream", entrylist_cbor_stream, list, baseline);
+
+	printf("key/value list, %d pairs\n", BENCH_KEY_VALUE_PAIRS);
+	baseline = key_value_list_json(kvlist);
+	run("json", key_value_list_json, kvlist, baseline);
+	run("cbor", key_value_list_cbor, kvlist, baseline);
+
+	entrylist_free(list);
+	key_value_list_free(kvlist);
+
+	return EXIT_SUCCESS;
+}
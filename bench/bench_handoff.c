@@ -0,0 +1,214 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-request handoff latency: POSIX message queues vs. message rings.
+ *
+ * A "worker" thread sends a message to a "DB" thread, which sends it straight
+ * back, just like a fetch request and its completion. The round trip is timed
+ * for every message, so the numbers include the wakeup of a sleeping thread.
+ *
+ * Usage: bench_handoff [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <mqueue.h>
+
+#include "mqmsg.h"
+#include "msgring.h"
+
+#define BENCH_DEFAULT_ITERATIONS        100000
+#define BENCH_MQ_REQUEST_NAME           "/rpiwd_bench_request"
+#define BENCH_MQ_REPLY_NAME             "/rpiwd_bench_reply"
+#define BENCH_MQ_MAX_MESSAGES           8
+#define BENCH_RING_CAPACITY             256
+#define BENCH_MTYPE_QUIT                -1
+
+static long __iterations;
+static mqd_t __mq_request, __mq_reply;
+static rpiwd_msgring __ring_request, __ring_reply;
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, long long *samples, long count) {
+	long long total = 0;
+
+	for (long i = 0; i < count; i++)
+		total += samples[i];
+
+	qsort(samples, count, sizeof(long long), compare_ll);
+
+	printf("%-8s round trip (ns): mean %8lld  p50 %8lld  p99 %8lld  max %8lld\n",
+			name, total / count, samples[count / 2], samples[count * 99 / 100],
+			samples[count - 1]);
+}
+
+/* POSIX message queues, as used before the rings */
+static void *mq_echo_thread(void *unused) {
+	rpiwd_mqmsg msg;
+
+	while (mq_receive(__mq_request, (char *)&msg, sizeof(rpiwd_mqmsg), NULL) != -1) {
+		if (msg.mtype == BENCH_MTYPE_QUIT)
+			break;
+
+		msg.is_completed = 1;
+		mq_send(__mq_reply, (const char *)&msg, sizeof(rpiwd_mqmsg), 0);
+	}
+
+	return NULL;
+}
+
+static int bench_mq(long long *samples) {
+	struct mq_attr attr;
+	pthread_t thread;
+	rpiwd_mqmsg msg;
+	long long start;
+
+	memset(&msg, 0, sizeof(rpiwd_mqmsg));
+
+	attr.mq_flags = attr.mq_curmsgs = 0;
+	attr.mq_maxmsg = BENCH_MQ_MAX_MESSAGES;
+	attr.mq_msgsize = sizeof(rpiwd_mqmsg);
+
+	mq_unlink(BENCH_MQ_REQUEST_NAME);
+	mq_unlink(BENCH_MQ_REPLY_NAME);
+	__mq_request = mq_open(BENCH_MQ_REQUEST_NAME, O_CREAT | O_RDWR, 0600, &attr);
+	__mq_reply = mq_open(BENCH_MQ_REPLY_NAME, O_CREAT | O_RDWR, 0600, &attr);
+	if (__mq_request == (mqd_t)-1 || __mq_reply == (mqd_t)-1) {
+		fprintf(stderr, "mq_open: %s\n", strerror(errno));
+		return -1;
+	}
+
+	pthread_create(&thread, NULL, mq_echo_thread, NULL);
+
+	for (long i = 0; i < __iterations; i++) {
+		msg.mtype = DB_MSGTYPE_FETCH;
+
+		start = now_ns();
+		mq_send(__mq_request, (const char *)&msg, sizeof(rpiwd_mqmsg), 0);
+		mq_receive(__mq_reply, (char *)&msg, sizeof(rpiwd_mqmsg), NULL);
+		samples[i] = now_ns() - start;
+	}
+
+	msg.mtype = BENCH_MTYPE_QUIT;
+	mq_send(__mq_request, (const char *)&msg, sizeof(rpiwd_mqmsg), 0);
+	pthread_join(thread, NULL);
+
+	mq_close(__mq_request);
+	mq_close(__mq_reply);
+	mq_unlink(BENCH_MQ_REQUEST_NAME);
+	mq_unlink(BENCH_MQ_REPLY_NAME);
+
+	return 1;
+}
+
+/* Message rings, consumed the same way the DB thread does */
+static void ring_receive(rpiwd_msgring *ring, rpiwd_mqmsg *msg) {
+	while (!rpiwd_msgring_try_pop(ring, msg))
+		rpiwd_msgring_wait(ring);
+}
+
+static void *ring_echo_thread(void *unused) {
+	rpiwd_mqmsg msg;
+
+	for (;;) {
+		ring_receive(&__ring_request, &msg);
+		if (msg.mtype == BENCH_MTYPE_QUIT)
+			break;
+
+		msg.is_completed = 1;
+		rpiwd_msgring_send(msg.receiver, &msg);
+	}
+
+	return NULL;
+}
+
+static int bench_ring(long long *samples) {
+	pthread_t thread;
+	rpiwd_mqmsg msg;
+	long long start;
+
+	memset(&msg, 0, sizeof(rpiwd_mqmsg));
+
+	if (rpiwd_msgring_init(&__ring_request, BENCH_RING_CAPACITY, false) == -1 ||
+		rpiwd_msgring_init(&__ring_reply, BENCH_RING_CAPACITY, false) == -1) {
+		fprintf(stderr, "rpiwd_msgring_init: %s\n", strerror(errno));
+		return -1;
+	}
+
+	pthread_create(&thread, NULL, ring_echo_thread, NULL);
+
+	for (long i = 0; i < __iterations; i++) {
+		msg.mtype = DB_MSGTYPE_FETCH;
+		msg.receiver = &__ring_reply;
+
+		start = now_ns();
+		rpiwd_msgring_send(&__ring_request, &msg);
+		ring_receive(&__ring_reply, &msg);
+		samples[i] = now_ns() - start;
+	}
+
+	msg.mtype = BENCH_MTYPE_QUIT;
+	rpiwd_msgring_send(&__ring_request, &msg);
+	pthread_join(thread, NULL);
+
+	rpiwd_msgring_destroy(&__ring_request);
+	rpiwd_msgring_destroy(&__ring_reply);
+
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	long long *samples;
+
+	__iterations = argc > 1 ? strtol(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+	if (__iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	samples = malloc(sizeof(long long) * __iterations);
+	if (!samples)
+		return EXIT_FAILURE;
+
+	printf("%ld round trips of a %zu byte message\n", __iterations, sizeof(rpiwd_mqmsg));
+
+	if (bench_mq(samples) == 1)
+		report("mqueue", samples, __iterations);
+
+	if (bench_ring(samples) == 1)
+		report("msgring", samples, __iterations);
+
+	free(samples);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,298 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * HTTP request parser throughput over a corpus of real requests.
+ *
+ * Every request is delivered in segments of a fixed size, the way a slow
+ * client's TCP segments would arrive. The incremental parser is compared to
+ * searching the whole buffer for the end of the headers after every segment,
+ * which is what the daemon used to do before tokenizing the request. The
+ * rescan does no parsing at all, so it is a lower bound for the old cost.
+ *
+ * The second part parses complete requests down to the command and its
+ * parameters and reports requests per second on one core, against the old
+ * approach of copying the query string and duplicating every parameter.
+ *
+ * Usage: bench_httpparser [corpus file] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "httpparser.h"
+
+#ifndef BENCH_CORPUS_DIR
+#define BENCH_CORPUS_DIR                "corpus"
+#endif
+
+#define BENCH_DEFAULT_CORPUS            BENCH_CORPUS_DIR "/requests.txt"
+#define BENCH_DEFAULT_ITERATIONS        20000
+#define BENCH_MAX_REQUESTS              64
+#define BENCH_REQUEST_BUFFER_SIZE       4096
+#define BENCH_LINE_BUFFER_SIZE          1024
+
+static char *__requests[BENCH_MAX_REQUESTS];
+static size_t __lengths[BENCH_MAX_REQUESTS];
+static int __num_requests;
+static volatile size_t __sink;
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int load_corpus(const char *path) {
+	char line[BENCH_LINE_BUFFER_SIZE], request[BENCH_REQUEST_BUFFER_SIZE];
+	size_t length = 0, line_length;
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return -1;
+
+	/* Requests are separated by "%%"; lines get CRLF endings */
+	while (__num_requests < BENCH_MAX_REQUESTS) {
+		bool at_eof = !fgets(line, sizeof(line), f);
+
+		if (!at_eof && line[0] == '#')
+			continue;
+
+		if (at_eof || strcmp(line, "%%\n") == 0) {
+			if (length > 0) {
+				__requests[__num_requests] = strndup(request, length);
+				__lengths[__num_requests++] = length;
+			}
+
+			length = 0;
+			if (at_eof)
+				break;
+
+			continue;
+		}
+
+		line_length = strcspn(line, "\n");
+		if (length + line_length + 2 >= sizeof(request))
+			break;
+
+		memcpy(request + length, line, line_length);
+		memcpy(request + length + line_length, "\r\n", 2);
+		length += line_length + 2;
+	}
+
+	fclose(f);
+	return __num_requests;
+}
+
+/* Incremental: every byte is looked at once */
+static int parse_incremental(const char *request, size_t length, size_t segment) {
+	http_parser parser;
+	size_t received = 0;
+	int flag = HTTP_PARSER_REQUEST_INCOMPLETE;
+
+	http_parser_init(&parser);
+
+	while (flag == HTTP_PARSER_REQUEST_INCOMPLETE && received < length) {
+		received += segment;
+		if (received > length)
+			received = length;
+
+		flag = http_parser_execute(&parser, request, received);
+	}
+
+	__sink += parser.target_length;
+	return flag;
+}
+
+/* Rescanning: search everything received so far after each segment */
+static int parse_rescan(const char *request, size_t length, size_t segment) {
+	char buffer[BENCH_REQUEST_BUFFER_SIZE + 1];
+	size_t received = 0, chunk;
+
+	while (received < length) {
+		chunk = length - received < segment ? length - received : segment;
+		memcpy(buffer + received, request + received, chunk);
+		received += chunk;
+		buffer[received] = '\0';
+
+		if (strstr(buffer, "\r\n\r\n")) {
+			__sink += received;
+			return HTTP_PARSER_ERROR_SUCCESS;
+		}
+	}
+
+	return HTTP_PARSER_REQUEST_INCOMPLETE;
+}
+
+/* Whole request: request line, headers and query parameters */
+static int parse_command(const char *request, size_t length) {
+	char buffer[BENCH_REQUEST_BUFFER_SIZE + 1];
+	http_parser parser;
+	http_cmd cmd;
+	int response = HTTP_PARSER_ERROR_SUCCESS, flag;
+
+	/* The socket read copies the request into the connection buffer, too */
+	memcpy(buffer, request, length);
+	buffer[length] = '\0';
+
+	http_parser_init(&parser);
+	flag = http_parser_execute(&parser, buffer, length);
+	if (flag != HTTP_PARSER_ERROR_SUCCESS)
+		return flag;
+
+	if (!parse_http_request(buffer, &parser, &cmd, &response))
+		return response;
+
+	__sink += cmd.length;
+	return HTTP_PARSER_ERROR_SUCCESS;
+}
+
+/* What the daemon used to do after finding the request: tokenize a copy of
+ * the request line, then strdup() every parameter and compare every pair of
+ * names. Headers go through the same parser, so only the command differs. */
+typedef struct legacy_param_s {
+	char *name, *value;
+} legacy_param;
+
+static int parse_command_legacy(const char *request, size_t length) {
+	char buffer[BENCH_REQUEST_BUFFER_SIZE + 1], *line, *target, *query, *part,
+		 *saveptr, *pairptr, *name, *value;
+	http_parser parser;
+	legacy_param *params;
+	size_t count = 1, n = 0;
+	int flag;
+
+	memcpy(buffer, request, length);
+	buffer[length] = '\0';
+
+	http_parser_init(&parser);
+	flag = http_parser_execute(&parser, buffer, length);
+	if (flag != HTTP_PARSER_ERROR_SUCCESS)
+		return flag;
+
+	line = strndup(buffer, strcspn(buffer, "\r\n"));
+	strtok_r(line, " ", &saveptr);
+	target = strtok_r(NULL, " ", &saveptr);
+	if (!target || !strtok_r(NULL, " ", &saveptr)) {
+		free(line);
+		return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+	}
+
+	query = strchr(target, '?');
+	for (part = query; part && *part; part++)
+		count += *part == '&';
+
+	params = malloc(sizeof(legacy_param) * count);
+	if (query) {
+		for (part = strtok_r(query + 1, "&", &saveptr); part;
+				part = strtok_r(NULL, "&", &saveptr)) {
+			name = strtok_r(part, "=", &pairptr);
+			value = strtok_r(NULL, "=", &pairptr);
+			params[n].name = name ? strdup(name) : NULL;
+			params[n++].value = value ? strdup(value) : NULL;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+		for (size_t j = i + 1; j < n; j++)
+			if (strcmp(params[i].name, params[j].name) == 0)
+				flag = HTTP_PARSER_ERROR_DUPLICATE_PARAMS;
+
+	for (size_t i = 0; i < n; i++) {
+		free(params[i].name);
+		free(params[i].value);
+	}
+
+	__sink += n;
+	free(params);
+	free(line);
+	return flag;
+}
+
+static void run_commands(const char *name, int (*parse)(const char *, size_t),
+		long iterations) {
+	long long start, elapsed;
+	long count = 0;
+
+	start = now_ns();
+	for (long i = 0; i < iterations; i++) {
+		for (int r = 0; r < __num_requests; r++) {
+			if (parse(__requests[r], __lengths[r]) != HTTP_PARSER_ERROR_SUCCESS) {
+				fprintf(stderr, "%s: request %d did not parse\n", name, r);
+				return;
+			}
+
+			count++;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	printf("%-12s full request: %8.1f ns/request  %10.0f requests/s\n", name,
+			(double)elapsed / count, count * 1e9 / elapsed);
+}
+
+static void run(const char *name, int (*parse)(const char *, size_t, size_t),
+		size_t segment, long iterations) {
+	long long start, elapsed;
+	size_t bytes = 0;
+	long count = 0;
+
+	start = now_ns();
+	for (long i = 0; i < iterations; i++) {
+		for (int r = 0; r < __num_requests; r++) {
+			if (parse(__requests[r], __lengths[r], segment) != HTTP_PARSER_ERROR_SUCCESS) {
+				fprintf(stderr, "%s: request %d did not parse\n", name, r);
+				return;
+			}
+
+			bytes += __lengths[r];
+			count++;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	printf("%-12s segment %4zu: %8.1f ns/request  %8.1f MB/s\n", name, segment,
+			(double)elapsed / count, bytes * 1000.0 / elapsed);
+}
+
+int main(int argc, char **argv) {
+	static const size_t segments[] = { BENCH_REQUEST_BUFFER_SIZE, 536, 64, 1 };
+	const char *path = argc > 1 ? argv[1] : BENCH_DEFAULT_CORPUS;
+	long iterations = argc > 2 ? strtol(argv[2], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+
+	if (load_corpus(path) <= 0 || iterations <= 0) {
+		fprintf(stderr, "usage: %s [corpus file] [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	printf("%d requests, %ld iterations\n", __num_requests, iterations);
+
+	for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
+		run("incremental", parse_incremental, segments[i], iterations);
+		run("rescan", parse_rescan, segments[i], iterations);
+	}
+
+	run_commands("spans", parse_command, iterations);
+	run_commands("copies", parse_command_legacy, iterations);
+
+	for (int r = 0; r < __num_requests; r++)
+		free(__requests[r]);
+
+	return EXIT_SUCCESS;
+}
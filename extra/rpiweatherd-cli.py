@@ -39,6 +39,7 @@ CONFIG = None
 
 # Other constants
 ENTRY_COMPACT_FORMAT = '{:<20}{:>20}{}{:>15}%'
+WATCH_WAIT_SECONDS = 60
 
 class CmdShell(cmd.Cmd):
     prompt= '(rpiweatherd-cli) '
@@ -226,6 +227,53 @@ class CmdShell(cmd.Cmd):
         if data and data['length'] > 0:
             self.__print_entry(data['-1'], data['units']['tempunit'])
     
+    def do_watch(self, args):
+        '''
+        Print every new measurement as the server takes it, until Ctrl-C
+        is pressed
+        '''
+        global CONN_DETAILS
+
+        # Shouldn't have any arguments
+        if len(args) > 0:
+            print('Command does not accept any parameters.')
+            return
+        
+        # Verify connection
+        if not self.__is_connected():
+            print('Must be connected to a server.')
+            return
+
+        # The server holds each request until there is a measurement newer
+        # than the last one printed, so only one is ever outstanding
+        last_id = None
+        try:
+            while True:
+                command = 'current?wait={}'.format(WATCH_WAIT_SECONDS)
+                if last_id is not None:
+                    command += '&since_id={}'.format(last_id)
+
+                data = self.get_data(CONN_DETAILS[0], CONN_DETAILS[1], command)
+                if not data:
+                    return
+                elif data['errcode'] != 0:
+                    print('Error {}: {}'.format(data['errcode'], data['errmsg']))
+                    return
+
+                entry = data[str(data['id'])]
+
+                # The latest reading rather than a new row: the wait ran
+                # out, or measurements were missed. Wait for the next one.
+                if entry['id'] == -1:
+                    entry['record_date'] = 'Now'
+                    last_id = None
+                else:
+                    last_id = entry['id']
+
+                self.__print_entry(entry, data['units']['tempunit'], True)
+        except KeyboardInterrupt:
+            print('Stopped.')
+
     def do_statistics(self, args):
         '''
         View server statistics
@@ -0,0 +1,66 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_ARENA_H
+#define RPIWD_ARENA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/* Constants */
+#define ARENA_CHUNK_SIZE                4096 /* Kept between requests */
+#define ARENA_ALIGNMENT                 8    /* Enough for doubles on ARM */
+#define ARENA_ALIGN(size)               (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/* A chunk; its memory follows the header */
+typedef struct rpiwd_arena_chunk_s {
+    struct rpiwd_arena_chunk_s *next;       /* Older chunk */
+    size_t size, used;
+} rpiwd_arena_chunk;
+
+#define ARENA_CHUNK_HEADER_SIZE         ARENA_ALIGN(sizeof(rpiwd_arena_chunk))
+
+/* Bump allocator for everything a request allocates and drops at once.
+ * Nothing is freed on its own; a reset frees everything, and keeps the first
+ * chunk for the next request. An arena is used by one thread at a time. */
+typedef struct rpiwd_arena_s {
+    rpiwd_arena_chunk *head;                /* Chunk allocations come from */
+} rpiwd_arena;
+
+/* Init/quit */
+void arena_init(rpiwd_arena *arena);
+void arena_reset(rpiwd_arena *arena);
+void arena_destroy(rpiwd_arena *arena);
+
+/* Allocating */
+void *arena_alloc(rpiwd_arena *arena, size_t size);
+char *arena_strdup(rpiwd_arena *arena, const char *str);
+char *arena_vprintf(rpiwd_arena *arena, const char *format, va_list args);
+
+/* Allocation functions for libraries that take a malloc()/free() pair
+ * (parson). They allocate from the calling thread's current arena and
+ * fall back to the heap when there is none. */
+void arena_make_current(rpiwd_arena *arena);
+void *arena_current_malloc(size_t size);
+void arena_current_free(void *ptr);
+
+/* Internal helpers */
+static rpiwd_arena_chunk *arena_chunk_alloc(size_t size);
+
+#endif /* RPIWD_ARENA_H */
@@ -0,0 +1,54 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RPIWD_COMPRESSION_H
+#define RPIWD_COMPRESSION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "rpiweatherd_config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif /* HAVE_ZLIB */
+
+/* zlib parameters. 15 window bits plus 16 selects a gzip wrapper. */
+#define COMPRESSION_WINDOW_BITS         15
+#define COMPRESSION_GZIP_WRAPPER        16
+#define COMPRESSION_MEM_LEVEL           8
+#define COMPRESSION_FLUSH_OVERHEAD      64  /* Bytes; sync flush marker and trailer */
+#define COMPRESSION_LEVEL_MIN           0   /* Disables compression */
+#define COMPRESSION_LEVEL_MAX           9
+
+/* An open gzip stream, for responses that are sent in chunks */
+typedef struct rpiwd_gzip_stream_s rpiwd_gzip_stream;
+
+/* Whether the daemon was built with zlib */
+bool compression_available(void);
+
+/* Whole buffers */
+char *gzip_compress(const char *data, size_t length, int level, size_t *out_length);
+
+/* Streams */
+rpiwd_gzip_stream *gzip_stream_open(int level);
+char *gzip_stream_write(rpiwd_gzip_stream *stream, const char *data, size_t length,
+        bool finish, size_t *out_length);
+void gzip_stream_close(rpiwd_gzip_stream *stream);
+
+#endif /* RPIWD_COMPRESSION_H */
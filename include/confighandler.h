@@ -41,10 +41,34 @@
 #define CONFIG_UNITS				 		"units"
 #define CONFIG_COMM_PORT			 		"comm_port"
 #define CONFIG_NUM_WORKER_THREADS			"num_worker_threads"
+#define CONFIG_MIN_WORKER_THREADS			"min_worker_threads"
+#define CONFIG_MAX_WORKER_THREADS			"max_worker_threads"
+#define CONFIG_KEEPALIVE_TIMEOUT			"keepalive_timeout"
+#define CONFIG_KEEPALIVE_MAX_REQUESTS		"keepalive_max_requests"
+#define CONFIG_REUSEPORT					"reuseport"
+#define CONFIG_COMPRESSION_LEVEL			"compression_level"
+#define CONFIG_COMPRESSION_MIN_SIZE			"compression_min_size"
+#define CONFIG_RATE_LIMIT_REQUESTS			"rate_limit_requests"
+#define CONFIG_RATE_LIMIT_BURST				"rate_limit_burst"
+#define CONFIG_RATE_LIMIT_CURRENT			"rate_limit_current"
+#define CONFIG_DB_READ_DEADLINE				"db_read_deadline"
+#define CONFIG_DB_WRITE_DEADLINE			"db_write_deadline"
+#define CONFIG_HEADER_TIMEOUT				"header_timeout"
+#define CONFIG_REQUEST_TIMEOUT				"request_timeout"
+#define CONFIG_UNIX_SOCKET					"unix_socket"
+
+/* Number of configuration keys reported by the 'config' command */
+#define CONFIG_KEY_COUNT					21
 
 #define CONFIG_ERROR_COMM_PORT 		 		-1
 #define CONFIG_ERROR_DEVICE_CONFIG	 		-2
 #define CONFIG_ERROR_NUM_WTHREADS			-3
+#define CONFIG_ERROR_KEEPALIVE				-4
+#define CONFIG_ERROR_REUSEPORT				-5
+#define CONFIG_ERROR_COMPRESSION			-6
+#define CONFIG_ERROR_RATE_LIMIT				-7
+#define CONFIG_ERROR_DB_DEADLINE			-8
+#define CONFIG_ERROR_TIMEOUT				-9
 
 /* Possible configuration values */
 #define CONFIG_UNITS_METRIC					"metric"
@@ -57,19 +81,49 @@
 #define CONFIG_COMM_PORT_DEFAULT			6005
 #define CONFIG_UNITS_DEFAULT				"imperial"
 #define CONFIG_NUM_WORKER_THREADS_DEFAULT	1
-#define CONFIG_NUM_WORKER_THREADS_MAX		4
+#define CONFIG_NUM_WORKER_THREADS_MAX		64
+#define CONFIG_WORKER_THREADS_UNSET			0	/* min/max default to num_worker_threads */
+#define CONFIG_KEEPALIVE_TIMEOUT_DEFAULT	5	/* Seconds; 0 disables keep-alive */
+#define CONFIG_KEEPALIVE_MAX_REQUESTS_DEFAULT	100
+#define CONFIG_REUSEPORT_DEFAULT			0	/* One shared acceptor thread */
+#define CONFIG_COMPRESSION_LEVEL_DEFAULT	6	/* zlib level; 0 disables compression */
+#define CONFIG_COMPRESSION_LEVEL_MAX		9
+#define CONFIG_COMPRESSION_MIN_SIZE_DEFAULT	1024	/* Bytes; smaller bodies are sent as is */
+#define CONFIG_RATE_LIMIT_REQUESTS_DEFAULT	600		/* Per client and minute; 0 disables */
+#define CONFIG_RATE_LIMIT_BURST_DEFAULT		20
+#define CONFIG_RATE_LIMIT_CURRENT_DEFAULT	30		/* Sensor reads per client and minute */
+#define CONFIG_DB_READ_DEADLINE_DEFAULT		2000	/* Milliseconds; 0 waits forever */
+#define CONFIG_DB_WRITE_DEADLINE_DEFAULT	1000	/* Milliseconds; 0 waits forever */
+#define CONFIG_HEADER_TIMEOUT_DEFAULT		2		/* Seconds to send the request headers */
+#define CONFIG_REQUEST_TIMEOUT_DEFAULT		60		/* Seconds for a whole request; 0 disables */
 #define CONFIG_MAX_QUERY_ATTEMPTS			64
 #define CONFIG_MAX_TRIGGERS                 16
 
 /* Configuration structure */
 typedef struct rpiwd_config_s {
 	size_t config_count;
+	unsigned int generation;                /* Bumped on every reload */
+	struct rpiwd_config_s *previous;        /* Older generation, kept for its readers */
 	char *measure_location;
 	char *device_name;
 	int device_config;
 	char *query_interval;
 	int comm_port;
-    int num_worker_threads;
+    int num_worker_threads;                 /* Initial worker pool size */
+    int min_worker_threads, max_worker_threads;
+    int keepalive_timeout;
+    int keepalive_max_requests;
+    int reuseport;
+    int compression_level;
+    int compression_min_size;
+    int rate_limit_requests;                /* Token bucket rates, per client and minute */
+    int rate_limit_burst;
+    int rate_limit_current;
+    int db_read_deadline;                   /* Milliseconds a request may wait for */
+    int db_write_deadline;                  /* the DB thread before it is shed */
+    int header_timeout;
+    int request_timeout;
+    char *unix_socket;                      /* Path of the local socket; NULL if unused */
 } rpiwd_config;
 
 /* Internal callback */
@@ -90,10 +144,13 @@ int config_has_errors(rpiwd_config *confstrct);
 
 /* Getting the current configuration */
 int init_current_config(const char *config_path);
+int reload_current_config(const char *config_path, rpiwd_config **previous);
 rpiwd_config *get_current_config(void);
 void free_current_config(void);
+static rpiwd_config *publish_config(rpiwd_config *confstrct);
 
 /* Getter for the unit string */
 char *get_unit_string(void);
+static void reset_unit_string(void);
 
 #endif /* RPIWD_CONFIGHANDLER_H */
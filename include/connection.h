@@ -0,0 +1,121 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_CONNECTION_H
+#define RPIWD_CONNECTION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "util.h"
+#include "httpparser.h"
+#include "compression.h"
+#include "ratelimit.h"
+#include "timerwheel.h"
+#include "arena.h"
+#include "websocket.h"
+
+/* Constants */
+#define CONN_INPUT_BUFFER_SIZE          4096
+#define CONN_FLUSH_MAX_IOV              16  /* Chunks written per sendmsg() */
+#define CONN_ETAG_LENGTH                48
+
+/* Connection states */
+#define CONN_STATE_READING              1   /* Waiting for a complete request */
+#define CONN_STATE_PROCESSING           2   /* Request was handed off to another thread */
+#define CONN_STATE_WRITING              3   /* Response is queued and being flushed */
+#define CONN_STATE_STREAMING            4   /* Subscribed to server-sent events */
+#define CONN_STATE_WEBSOCKET            5   /* Upgraded; reading WebSocket frames */
+#define CONN_STATE_PARKED               6   /* Long poll waiting for newer data */
+
+/* Parked request (see mqmsg.h) */
+struct rpiwd_mqmsg_s;
+
+/* conn_flush() return codes */
+#define CONN_FLUSH_DONE                 1
+#define CONN_FLUSH_PENDING              0
+#define CONN_FLUSH_ERROR               -1
+
+/* A pending chunk of output.
+ * The chunk owns its data and frees it once it was fully written.
+ * Consecutive chunks are written with a single sendmsg() call. */
+typedef struct conn_outbuf_s {
+    char *data;
+    size_t length, offset;
+    struct conn_outbuf_s *next;
+} conn_outbuf;
+
+/* Client connection structure.
+ * A connection is owned by exactly one worker thread, which is the only thread
+ * allowed to read/write its socket. */
+typedef struct rpiwd_conn_s {
+    int sockfd;
+    int state;
+    bool is_adopted;                        /* Linked into the owning worker's list */
+    bool is_closed;                         /* Socket is gone; free on completion */
+    bool close_after_write;                 /* Close once the output queue drains */
+    bool keep_alive;                        /* Current request keeps the connection */
+    bool accept_gzip;                       /* Current request takes gzip bodies */
+    bool is_admitted;                       /* Current request passed the rate limit */
+    rpiwd_ratelimit_key peer;               /* Client address, for rate limiting */
+    unsigned int requests_served;
+    rpiwd_timer timer;                      /* Next deadline; on the owner's wheel */
+    uint64_t request_deadline_ms;           /* Monotonic end of the current request */
+    uint64_t accepted_usec;                 /* Monotonic; for measuring queue wait */
+    char inbuf[CONN_INPUT_BUFFER_SIZE + 1]; /* +1 for the terminating NUL */
+    size_t inlen;
+    size_t request_length;                  /* Bytes of inbuf used by current request */
+    http_parser parser;                     /* Parsing state of the current request */
+    void *fetch_cursor;                     /* Streamed fetch between two batches */
+    rpiwd_gzip_stream *gzip_stream;         /* Compressor of a chunked response */
+    const char *content_type;               /* Of the current response; NULL for HTML */
+    char etag[CONN_ETAG_LENGTH];            /* Validator of the current response */
+    const char *if_none_match;              /* Tags the client has; points into inbuf */
+    size_t if_none_match_length;
+    rpiwd_arena arena;                      /* Memory of the current request */
+    rpiwd_websocket *ws;                    /* Once upgraded to WebSocket */
+    struct rpiwd_mqmsg_s *parked_request;   /* While parked; in the arena */
+    conn_outbuf *outq_head, *outq_tail;
+    size_t outq_length;                     /* Bytes queued and not written yet */
+    struct rpiwd_conn_s *prev, *next;       /* Owning worker's connection list */
+} rpiwd_conn;
+
+/* Allocating/freeing connections */
+rpiwd_conn *conn_alloc(int sockfd);
+void conn_free(rpiwd_conn *conn);
+
+/* Socket helpers */
+int conn_set_nonblocking(int sockfd);
+
+/* Reading */
+ssize_t conn_read(rpiwd_conn *conn, int *is_eof);
+void conn_consume_input(rpiwd_conn *conn, size_t length);
+
+/* Writing */
+int conn_queue_output(rpiwd_conn *conn, char *data, size_t length);
+int conn_flush(rpiwd_conn *conn);
+bool conn_has_pending_output(rpiwd_conn *conn);
+
+#endif /* RPIWD_CONNECTION_H */
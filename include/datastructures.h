@@ -20,12 +20,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <parson.h>
 
 #include "measurevals.h"
 
 /* Constants */
 #define JSON_SERIALIZER_TEMP_ID_BUFFER_SIZE	32
+#define STRBUF_DEFAULT_CAPACITY				256
+#define CSV_HUMIDITY_UNIT_NAME				"pct" /* '%' makes for a poor column name */
+
+/* CBOR (RFC 7049) major types and simple values */
+#define CBOR_MAJOR_UNSIGNED					0
+#define CBOR_MAJOR_NEGATIVE					1
+#define CBOR_MAJOR_TEXT						3
+#define CBOR_MAJOR_MAP						5
+#define CBOR_FLOAT32						0xfa
+#define CBOR_NULL							0xf6
+#define CBOR_INDEFINITE_MAP					0xbf
+#define CBOR_BREAK							0xff
 
 /* Entry structure */
 typedef struct entry_s {
@@ -53,6 +68,12 @@ typedef struct key_value_list_s {
 	key_value_pair *pairs;
 } key_value_list;
 
+/* Growable string buffer, for serializing without building a DOM first */
+typedef struct strbuf_s {
+	char *data;
+	size_t length, capacity;
+} strbuf;
+
 /* Allocating/freeing entry lists */
 entry *entry_alloc(void);
 void entry_free(entry *ent);
@@ -71,10 +92,47 @@ void key_value_list_free(key_value_list *list);
 
 int key_value_list_emplace(key_value_list *list, const char *key, const char *value);
 
+/* String buffers */
+int strbuf_init(strbuf *buf, size_t capacity);
+void strbuf_free(strbuf *buf);
+char *strbuf_release(strbuf *buf);
+int strbuf_append(strbuf *buf, const char *str, size_t length);
+int strbuf_appendf(strbuf *buf, const char *format, ...);
+
 /* JSON */
 JSON_Value *entry_to_json_value(entry *ent, char *unitstr);
 JSON_Value *entrylist_to_json_value(entrylist **list, char *unitstr);
 JSON_Value *key_value_list_to_json_value(key_value_list **list);
 void append_units(JSON_Object *jobj, char *unitstr);
+char *json_serialize_to_heap(const JSON_Value *value);
+
+/* Streaming JSON. Produces the same document as entrylist_to_json_value(),
+ * except that "length" comes last, after all entries were counted. */
+int entrylist_json_stream_begin(strbuf *buf, char *unitstr);
+int entry_json_stream_append(strbuf *buf, const entry *ent, bool is_first);
+int entrylist_json_stream_end(strbuf *buf, size_t length);
+int strbuf_append_json_string(strbuf *buf, const char *str);
+int strbuf_append_json_number(strbuf *buf, double num);
+
+/* CBOR. The same documents as the JSON ones, but entries are keyed by their
+ * IDs as numbers, and missing strings are null rather than left out.
+ * Streaming works the same way as with JSON, using maps of unknown length. */
+int entry_to_cbor(strbuf *buf, const entry *ent, char *unitstr);
+int entrylist_to_cbor(strbuf *buf, const entrylist *list, char *unitstr);
+int key_value_list_to_cbor(strbuf *buf, const key_value_list *list);
+int entrylist_cbor_stream_begin(strbuf *buf, char *unitstr);
+int entry_cbor_stream_append(strbuf *buf, const entry *ent);
+int entrylist_cbor_stream_end(strbuf *buf, size_t length);
+int strbuf_append_cbor_units(strbuf *buf, char *unitstr);
+int strbuf_append_cbor_head(strbuf *buf, int major, uint64_t value);
+int strbuf_append_cbor_byte(strbuf *buf, unsigned char byte);
+int strbuf_append_cbor_int(strbuf *buf, int64_t num);
+int strbuf_append_cbor_string(strbuf *buf, const char *str);
+int strbuf_append_cbor_float(strbuf *buf, float num);
+
+/* CSV. Only streamed: a header line, then one line per entry. */
+int entrylist_csv_stream_begin(strbuf *buf, char *unitstr);
+int entry_csv_stream_append(strbuf *buf, const entry *ent);
+int strbuf_append_csv_string(strbuf *buf, const char *str);
 
 #endif /* RPIWD_DATASTRUCTURES_H */
@@ -28,10 +28,11 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/stat.h>
-#include <mqueue.h>
+#include <poll.h>
 #include <parson.h>
 
 #include "mqmsg.h"
+#include "msgring.h"
 #include "datastructures.h"
 #include "confighandler.h"
 #include "logging.h"
@@ -40,8 +41,11 @@
 #define DB_DEFAULT_FILE_PATH                "/etc/rpiweatherd/rpiwd_data.db"
 #define DATE_BUFFER_SIZE                    20
 #define SQL_COMMAND_BUFFER_SIZE             512
-#define RPIWD_DB_MQ_NAME                    "/rpiwd_db_mqueue"
+#define DBHANDLER_QUEUE_CAPACITY            64  /* Reads; must be a power of two */
+#define DBHANDLER_PRIORITY_QUEUE_CAPACITY   256 /* Writes and open cursors */
+#define DBHANDLER_WRITE_RETRY_INTERVAL      1   /* Milliseconds between enqueue attempts */
 #define DBHANDLER_MAX_FETCHED_ENTRIES       2048
+#define DBHANDLER_STREAM_BATCH_SIZE         8192 /* Bytes per streamed batch */
 
 /* time_t manipulation helpers */
 #define DAY_START(t)                        ((t) - ((t) % 86400))
@@ -52,6 +56,7 @@
 #define DBHANDLER_ERROR_TOO_MANY_ENTRIES	-1
 #define DBHANDLER_ERROR_SQL_ERROR			-2
 #define DBHANDLER_ERROR_NO_MEMORY			-3
+#define DBHANDLER_ERROR_OVERLOADED			-4
 
 /* Stat table names */
 #define STAT_NAME_TOTAL_REQUESTS			"total_requests"
@@ -79,12 +84,20 @@ static const char *SQLCMD_TABLE_CREATION_QUERIES[] = {
 
 /* Data entry write query */
 static const char *SQLCMD_WRITE_ENTRY = "INSERT INTO tblData " \
-                       "VALUES(null, datetime('now'), @temp, @humid, " \
+                       "VALUES(null, @date, @temp, @humid, " \
                        "@location, @devicename);";
+#define DB_RECORD_DATE_FORMAT               "%Y-%m-%d %H:%M:%S" /* UTC, as datetime('now') */
 
 /* Data coun query */
 static const char *SQLCMD_COUNT_ALL_ROWS = "SELECT COUNT(*) FROM tblData;";
 
+/* Newest row; IDs are never reused, so this versions the whole table */
+static const char *SQLCMD_MAX_ROW_ID = "SELECT MAX(ID) FROM tblData;";
+
+/* Time of the newest row, as seconds since the epoch */
+static const char *SQLCMD_MAX_ROW_TIME =
+        "SELECT CAST(strftime('%s', MAX(RECORD_DATE)) AS INTEGER) FROM tblData;";
+
 /* Status table update queries */
 static const char *SQLCMD_INCREASE_STAT =
         "UPDATE tblStats SET VALUE = VALUE + 1 WHERE KEY = '%s';";
@@ -122,36 +135,80 @@ static const char *SQLCMD_SELECT_N =
 static const char *SQLCMD_COUNT_SELECT_N =
         "SELECT %d;";
 
-/* POSIX message queue ID for the DB thread */
-mqd_t __db_mqd;
+/* WHOLE TABLE; only ever streamed */
+static const char *SQLCMD_READ_ALL_ROWS =
+        "SELECT * FROM tblData;";
+
+/* BY ROW ID; rows written after the one a client has seen */
+static const char *SQLCMD_READ_SINCE_ID =
+        "SELECT * FROM tblData WHERE ID > %llu;";
+static const char *SQLCMD_COUNT_SINCE_ID =
+        "SELECT COUNT(*) FROM tblData WHERE ID > %llu;";
+
+/* Cursor of a streamed fetch.
+ * Owned by the DB thread; workers only pass it back to ask for the next batch. */
+typedef struct db_fetch_cursor_s {
+    sqlite3_stmt *query;
+    bool keep_native_unit;
+    char unitstr[RPIWD_MAX_MEASUREMENTS];
+    int format;                             /* RPIWD_FORMAT_* */
+    size_t rows;                            /* Rows sent so far */
+    struct db_fetch_cursor_s *next;         /* Of cancels waiting to be sent */
+} db_fetch_cursor;
+
+/* Called on the DB thread for every sample written, with its ID and date */
+typedef void (*dbhandler_write_hook)(const entry *ent);
 
 /* Init/quit functions */
 int init_dbhandler(void);
 void quit_dbhandler(void);
-void quit_db_mq(void);
+void quit_db_queue(void);
 
 /* DB Thread event loop */
 void *db_thread_event_loop(void *);
 void db_thread_cleanup_routine(void *arg);
+static bool db_thread_next_message(rpiwd_mqmsg *msg);
 
 /* Request functions */
-void request_write_entry(float temp, float humid, const char *location,
+bool dbhandler_try_send(rpiwd_mqmsg *msg);
+int request_write_entry(float temp, float humid, const char *location,
 		const char *device);
+bool request_cancel_fetch(void *cursor);
+void dbhandler_set_write_hook(dbhandler_write_hook hook);
+
+/* Validators; changes whenever a row is written */
+uint64_t dbhandler_data_version(void);
+time_t dbhandler_data_time(void);
+
+/* Load shedding */
+uint64_t dbhandler_shed_reads(void);
+uint64_t dbhandler_shed_writes(void);
+static bool is_read_request(int mtype);
+static void exec_read_request(rpiwd_mqmsg *msg);
 
 /* Query preperation functions */
-char *format_query(const char *format, ...);
+char *format_query(rpiwd_arena *arena, const char *format, ...);
 
 /* General functions */
 size_t exec_formatted_count_query(const char *count_query);
 entrylist *exec_fetch_query(const char *fcountq, const char *fselectq, bool keep_native_unit,
-                            int *errcode);
+                            rpiwd_arena *arena, int *errcode);
 key_value_list *exec_key_value_query(const char *fcountq, const char *fselectq,
 		int *errcode);
 
+/* Streamed fetch */
+db_fetch_cursor *open_fetch_cursor(const char *fselectq, bool keep_native_unit,
+        const char *unitstr, int format, int *errcode);
+char *fetch_cursor_next_batch(db_fetch_cursor *cursor, bool *is_done, size_t *length,
+        int *errcode);
+void close_fetch_cursor(db_fetch_cursor *cursor);
+
 /* Writing/reading functions */
-static int write_raw_entry(float temp, float humid, const char *location,
-                           const char *device);
+static int write_raw_entry(entry *ent);
 static void increase_stat(const char *stat_name);
+static void next_fetch_batch(rpiwd_mqmsg *msg);
+static entrylist *exec_fetch_arena_entrylist(rpiwd_arena *arena, size_t capacity);
+static char *exec_fetch_strdup(rpiwd_arena *arena, const char *str);
 
 /* Utility */
 const char *dbhandler_strerror(int errcode);
@@ -20,11 +20,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <wiringPi.h>
 
 #include "devicevals.h"
 #include "dht11.h"
+#include "util.h"
+#include "logging.h"
 
 /* Function return codes */
 #define RETCODE_DEVICE_INIT_OK          0
@@ -32,6 +40,8 @@
 
 /* Constants */
 #define ATTEMPT_LOG_THRESHOLD           5
+#define DEVICE_SAMPLE_VALUES            2   /* Temperature and humidity */
+#define ON_DEMAND_QUERY_ATTEMPTS        5   /* For a reading clients asked for */
 
 /* Typedefs for basic callbacks */
 typedef int (* device_callback)(int data_pin, float *arr);
@@ -44,6 +54,17 @@ typedef struct device_s {
 	device_test_callback test_function;
 } device;
 
+/* Latest successful reading.
+ * Written under the device lock, and read without any lock: the sequence
+ * number is odd while a write is under way, and changes with every write. */
+typedef struct device_sample_s {
+	unsigned int seq;
+	float values[DEVICE_SAMPLE_VALUES];
+	uint64_t taken_usec;                    /* Monotonic; 0 if there was none yet */
+	time_t taken_at;                        /* Wall clock, for its record date */
+	int id;                                 /* Row it was written to; -1 until then */
+} device_sample;
+
 extern device supported_devices[];
 
 /* The function actually used by the program; determines what device to initialize
@@ -56,10 +77,27 @@ int device_test_current(void);
 /* A function to query the current device */
 int device_query_current(float *arr);
 
+/* The latest reading, without querying the device; taken_usec is monotonic */
+bool device_latest_sample(float *arr, uint64_t *taken_usec, time_t *taken_at, int *id);
+
+/* The latest reading was written to the given row */
+void device_sample_written(const float *arr, int id);
+
+/* Ask the query loop for a reading now, rather than at the next interval;
+ * the query loop waits for that in between readings. The wait returns true
+ * if a reading was asked for, and false once the time is up or a signal
+ * came. */
+void device_request_sample(void);
+bool device_wait_sample_request(unsigned int milliseconds);
+
 /* Get the selected device */
 device *get_current_device(void);
 
 /* Supported device names */
 void print_supported_device_names(void);
 
+/* Internal helpers */
+static void device_publish_sample(const float *arr, uint64_t taken_usec);
+static void device_init_sample_request(void);
+
 #endif /* RPIWD_DEVICE_H */
@@ -23,9 +23,16 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <stdbool.h>
+#include <strings.h>
 #include <parson.h>
 
 #include "util.h"
+#include "connection.h"
+#include "httpparser.h"
+#include "compression.h"
+#include "websocket.h"
+#include "confighandler.h"
 #include "rpiweatherd_config.h"
 
 /* Macro to string helper macros */
@@ -35,71 +42,86 @@
 /* Various lengths */
 #define HTTP_RESPONSE_TEMPLATE		"HTTP/1.1 %s\r\n" \
 									"Date: %s\r\nServer: %s\r\n" \
-									"Cache-control: no-store\r\n" \
-									"Content-Type: text/html\r\n%s\r\n" \
-									"%s"
+									"Cache-control: %s\r\n" \
+									"Content-Type: %s\r\n" \
+									"Connection: %s\r\n%s\r\n"
 #define HTTP_RESPONSE_HEADER_SIZE	512
-#define HTTP_COMMAND_MAX_SIZE		1024
-#define HTTP_PROTO_MAX_SIZE			16
-#define HTTP_ARGS_MAX_SIZE			512
+#define HTTP_CACHE_CONTROL_NO_STORE	"no-store"
+#define HTTP_CACHE_CONTROL_ETAG		"no-cache\r\nETag: %s" /* Store, but revalidate */
+#define HTTP_CACHE_HEADERS_LENGTH	(CONN_ETAG_LENGTH + 32)
+#define HTTP_ETAG_FORMAT			"W/\"%llx-%llx\""
+#define HTTP_TRANSFER_ENCODING_CHUNKED	"Transfer-Encoding: chunked\r\n"
+#define HTTP_CONTENT_ENCODING_GZIP	"Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n"
+#define HTTP_CHUNK_SIZE_LINE_LENGTH	20
+#define HTTP_LAST_CHUNK				"0\r\n\r\n"
+#define HTTP_CONTENT_TYPE_HTML		"text/html"
+#define HTTP_CONTENT_TYPE_EVENT_STREAM	"text/event-stream"
+#define HTTP_CONTENT_TYPE_CBOR		"application/cbor"
+#define HTTP_CONTENT_TYPE_CSV		"text/csv; charset=utf-8; header=present"
+#define HTTP_EVENT_FORMAT			"id: %llu\ndata: %s\n\n"
+#define HTTP_EVENT_HEARTBEAT		":\n\n" /* A comment; keeps proxies from timing out */
+#define HTTP_WEBSOCKET_ACCEPT_TEMPLATE	"HTTP/1.1 101 Switching Protocols\r\n" \
+									"Server: %s\r\nUpgrade: websocket\r\n" \
+									"Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n"
+#define HTTP_WEBSOCKET_VERSION		"Sec-WebSocket-Version: " STR(WEBSOCKET_VERSION) "\r\n"
+#define HTTP_RETRY_AFTER			"Retry-After: %u\r\n"
+#define HTTP_RETRY_AFTER_LENGTH		32
 #define RESPONSE_BUFFER_SIZE		4096
 #define HTTP_MAX_RESPONSE_SIZE		16386
 
 /* HTTP codes */
+#define HTTP_CODE_SWITCHING_PROTOCOLS	101
 #define HTTP_CODE_OK					200
 #define HTTP_CODE_NO_CONTENT			204
+#define HTTP_CODE_NOT_MODIFIED			304
 #define HTTP_CODE_NOT_FOUND				404
 #define HTTP_CODE_REQUEST_TIMEOUT 		408
 #define HTTP_CODE_REQUEST_BAD_REQUEST	400
 #define HTTP_CODE_FORBIDDEN				403
+#define HTTP_CODE_UPGRADE_REQUIRED		426
 #define HTTP_CODE_TOO_MANY_REQUESTS		429
 #define HTTP_CODE_PAYLOAD_TOO_LARGE		413
 #define HTTP_CODE_URI_TOO_LONG			414
+#define HTTP_CODE_HEADERS_TOO_LARGE		431
 #define HTTP_CODE_INTERNAL_SERVER_ERROR	500
+#define HTTP_CODE_SERVICE_UNAVAILABLE	503
 #define HTTP_CODE_VERSION_NOT_SUPPORTED	505
 #define HTTP_CODE_INSUFFICIENT_STORAGE	507
 
-/* HTTP parser return codes */
-#define HTTP_PARSER_ERROR_SUCCESS				0
-#define HTTP_PARSER_ERROR_UNKNOWN_PARAM			-1
-#define HTTP_PARSER_ERROR_REQUEST_TOO_LONG 		-2
-#define HTTP_PARSER_ERROR_PARAMS_REQUIRED		-3
-#define HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT 	-4
-#define HTTP_PARSER_ERROR_WRONG_PROTOCOL 		-5
-#define HTTP_PARSER_ERROR_NO_MEMORY				-6
-#define HTTP_PARSER_ERROR_DUPLICATE_PARAMS		-7
-
-typedef struct http_cmd_param_s {
-	char *name, *value;
-} http_cmd_param;
-
-typedef struct http_cmd_s {
-	char *cmdname;
-	size_t length;
-	http_cmd_param *params;
-} http_cmd;
-
-/* http_cmd_param methods */
-void http_cmd_param_free(http_cmd_param *ptr);
-
-/* http_cmd methods */
-void http_cmd_free(http_cmd *ptr);
-int http_cmd_param_count(http_cmd *cmd, const char *name);
-
-/* HTTP Parsing */
-http_cmd *parse_http_request(const char *request, int *response);
-http_cmd_param parse_http_param(const char *paramstr);
-int break_request(const char *url, char *http_proto, char *args, char *commandstr);
-
 /* Sending/recieving */
-char *make_response(int code, const char *data);
-ssize_t send_response(int sockfd, int code, const char *data);
-ssize_t send_http_error_response(int sockfd, int httpcode, int errcode, const char *err);
-http_cmd *read_and_parse_response(int sockfd, int *response, int *is_eof);
-void end_response(int sockfd, http_cmd *cmd);
+size_t make_response_header(char *buf, size_t size, int code, const char *framing,
+		const char *content_type, const char *etag, bool keep_alive);
+ssize_t send_response(rpiwd_conn *conn, int code, char *data);
+ssize_t send_response_data(rpiwd_conn *conn, int code, char *data, size_t length);
+ssize_t send_chunked_response_start(rpiwd_conn *conn, int code, bool compress);
+ssize_t send_response_chunk(rpiwd_conn *conn, char *data, size_t data_length);
+ssize_t end_chunked_response(rpiwd_conn *conn);
+ssize_t send_not_modified_response(rpiwd_conn *conn);
+ssize_t send_event_stream_start(rpiwd_conn *conn);
+ssize_t send_event(rpiwd_conn *conn, const char *event, size_t length);
+char *make_event(unsigned long long id, const char *data);
+ssize_t send_websocket_accept(rpiwd_conn *conn, const char *key, size_t length);
+ssize_t send_upgrade_required_response(rpiwd_conn *conn, int errcode, const char *err);
+ssize_t send_websocket_message(rpiwd_conn *conn, int opcode, char *data, size_t length);
+ssize_t send_websocket_close(rpiwd_conn *conn, uint16_t status);
+bool set_response_etag(rpiwd_conn *conn, uint64_t version, uint64_t digest);
+ssize_t send_http_error_response(rpiwd_conn *conn, int httpcode, int errcode,
+		const char *err);
+ssize_t send_retry_later_response(rpiwd_conn *conn, int httpcode, int errcode,
+		const char *err, unsigned int retry_after);
+http_cmd *parse_buffered_request(rpiwd_conn *conn, http_cmd *cmd, int *response);
+void end_response(rpiwd_conn *conn);
+
+/* Internal helpers */
+static ssize_t queue_response(rpiwd_conn *conn, int code, char *data, size_t data_length,
+		const char *extra_headers);
+static char *make_error_body(int errcode, const char *err);
+static ssize_t queue_chunk(rpiwd_conn *conn, char *data, size_t length);
+static bool should_compress(rpiwd_conn *conn, size_t length);
 
 /* Utility */
 const char *http_code_str(int code);
 const char *http_parser_strerror(int errcode);
+int http_parser_http_code(int errcode);
 
 #endif /* RPIWD_HTTP_H */
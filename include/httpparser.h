@@ -0,0 +1,158 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_HTTPPARSER_H
+#define RPIWD_HTTPPARSER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <stdint.h>
+
+/* Limits */
+#define HTTP_METHOD_MAX_LENGTH			16
+#define HTTP_URI_MAX_LENGTH				1024
+#define HTTP_VERSION_MAX_LENGTH			16
+#define HTTP_HEADERS_MAX_SIZE			2048	/* All header lines together */
+#define HTTP_BODY_MAX_SIZE				512		/* Only /batch reads bodies */
+#define HTTP_MAX_PARAMS					16		/* Query string parameters */
+
+/* Headers the parser looks at */
+#define HTTP_HEADER_CONNECTION			"Connection"
+#define HTTP_HEADER_CONTENT_LENGTH		"Content-Length"
+#define HTTP_HEADER_TRANSFER_ENCODING	"Transfer-Encoding"
+#define HTTP_HEADER_ACCEPT_ENCODING		"Accept-Encoding"
+#define HTTP_HEADER_ACCEPT				"Accept"
+#define HTTP_HEADER_IF_NONE_MATCH		"If-None-Match"
+#define HTTP_HEADER_UPGRADE				"Upgrade"
+#define HTTP_HEADER_WEBSOCKET_KEY		"Sec-WebSocket-Key"
+#define HTTP_HEADER_WEBSOCKET_VERSION	"Sec-WebSocket-Version"
+#define HTTP_CONTENT_CODING_GZIP		"gzip"
+#define HTTP_CONTENT_CODING_X_GZIP		"x-gzip"
+#define HTTP_CONTENT_CODING_ANY			"*"
+#define HTTP_MEDIA_TYPE_CBOR			"application/cbor"
+#define HTTP_CONNECTION_KEEP_ALIVE		"keep-alive"
+#define HTTP_CONNECTION_CLOSE			"close"
+#define HTTP_CONNECTION_UPGRADE			"upgrade"
+#define HTTP_UPGRADE_WEBSOCKET			"websocket"
+
+/* HTTP parser return codes */
+#define HTTP_PARSER_REQUEST_INCOMPLETE			1
+#define HTTP_PARSER_ERROR_SUCCESS				0
+#define HTTP_PARSER_ERROR_UNKNOWN_PARAM			-1
+#define HTTP_PARSER_ERROR_REQUEST_TOO_LONG 		-2
+#define HTTP_PARSER_ERROR_PARAMS_REQUIRED		-3
+#define HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT 	-4
+#define HTTP_PARSER_ERROR_WRONG_PROTOCOL 		-5
+#define HTTP_PARSER_ERROR_NO_MEMORY				-6
+#define HTTP_PARSER_ERROR_DUPLICATE_PARAMS		-7
+#define HTTP_PARSER_ERROR_URI_TOO_LONG			-8
+#define HTTP_PARSER_ERROR_HEADERS_TOO_LARGE		-9
+#define HTTP_PARSER_ERROR_BODY_TOO_LARGE		-10
+#define HTTP_PARSER_ERROR_TOO_MANY_PARAMS		-11
+
+/* Parser states */
+#define HTTP_PARSER_STATE_METHOD		1
+#define HTTP_PARSER_STATE_TARGET		2
+#define HTTP_PARSER_STATE_VERSION		3
+#define HTTP_PARSER_STATE_LINE_LF		4	/* CR seen at the end of a line */
+#define HTTP_PARSER_STATE_HEADER_START	5
+#define HTTP_PARSER_STATE_HEADER_NAME	6
+#define HTTP_PARSER_STATE_VALUE_START	7
+#define HTTP_PARSER_STATE_VALUE			8
+#define HTTP_PARSER_STATE_END_LF		9	/* CR seen on the empty line */
+#define HTTP_PARSER_STATE_BODY			10
+#define HTTP_PARSER_STATE_DONE			11
+
+/* Known headers */
+#define HTTP_PARSER_HEADER_OTHER		0
+#define HTTP_PARSER_HEADER_CONNECTION	1
+#define HTTP_PARSER_HEADER_CONTENT_LEN	2
+#define HTTP_PARSER_HEADER_TRANSFER_ENC	3
+#define HTTP_PARSER_HEADER_ACCEPT_ENC	4
+#define HTTP_PARSER_HEADER_IF_NONE_MATCH	5
+#define HTTP_PARSER_HEADER_UPGRADE		6
+#define HTTP_PARSER_HEADER_WS_KEY		7
+#define HTTP_PARSER_HEADER_WS_VERSION	8
+#define HTTP_PARSER_HEADER_ACCEPT		9
+
+/* Resumable HTTP request parser.
+ * The parser never copies anything: it walks the connection's input buffer,
+ * remembers how far it got and records where the request line parts are.
+ * Feeding it the same (grown) buffer again continues where it stopped. */
+typedef struct http_parser_s {
+    int state;
+    size_t offset;                          /* Bytes of the buffer already parsed */
+    size_t mark;                            /* Start of the current element */
+    size_t method_start, method_length;
+    size_t target_start, target_length;
+    size_t version_start, version_length;
+    size_t headers_start;
+    int header;                             /* HTTP_PARSER_HEADER_* being parsed */
+    bool connection_close, connection_keep_alive, connection_upgrade;
+    bool upgrade_websocket;                 /* Client asked to switch to WebSocket */
+    size_t websocket_key_start, websocket_key_length;
+    int websocket_version;
+    bool accept_gzip;                       /* Client takes gzip-compressed bodies */
+    bool accept_cbor;                       /* Client asked for CBOR bodies */
+    size_t if_none_match_start, if_none_match_length; /* Entity tags the client has */
+    bool has_content_length;                /* Even if it was 0 */
+    size_t content_length, body_start;
+    size_t request_length;                  /* Total length, once complete */
+} http_parser;
+
+/* A query string parameter.
+ * Name and value point into the connection's input buffer, where they were
+ * NUL-terminated in place. The value is NULL if the parameter has none. */
+typedef struct http_cmd_param_s {
+	char *name, *value;
+	size_t name_length, value_length;
+} http_cmd_param;
+
+typedef struct http_cmd_s {
+	char *cmdname;
+	size_t cmdname_length;
+	size_t length;
+	http_cmd_param params[HTTP_MAX_PARAMS];
+	bool keep_alive;		/* Client asked for a persistent connection */
+	bool is_http11;			/* Client understands chunked responses */
+	bool accept_gzip;		/* Client takes gzip-compressed bodies */
+	bool accept_cbor;		/* Client asked for CBOR bodies */
+	const char *if_none_match;	/* Cached entity tags; not NUL-terminated */
+	size_t if_none_match_length;
+	const char *websocket_key;	/* Set for a WebSocket handshake; not NUL-terminated */
+	size_t websocket_key_length;
+	int websocket_version;
+	char *body;				/* Request body, if any; not NUL-terminated */
+	size_t body_length;
+} http_cmd;
+
+/* Init */
+void http_parser_init(http_parser *parser);
+
+/* Parsing */
+int http_parser_execute(http_parser *parser, const char *buf, size_t length);
+bool http_parser_keep_alive(const http_parser *parser, const char *buf);
+http_cmd *parse_http_request(char *buf, const http_parser *parser, http_cmd *cmd,
+		int *response);
+int http_parse_query(char *query, char *end, http_cmd *cmd);
+size_t http_url_decode(char *str, size_t length);
+
+/* Conditional requests */
+bool http_etag_matches(const char *list, size_t length, const char *etag);
+
+#endif /* RPIWD_HTTPPARSER_H */
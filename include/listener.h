@@ -26,28 +26,71 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <netdb.h>
-#include <mqueue.h>
 #include <sys/sysinfo.h>
 #include <sys/statvfs.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <poll.h>
 
 #include "mqmsg.h"
+#include "msgring.h"
 #include "dbhandler.h"
 #include "http.h"
+#include "connection.h"
 #include "device.h"
+#include "ratelimit.h"
+#include "timerwheel.h"
+#include "perfecthash.h"
+#include "arena.h"
 #include "confighandler.h"
 #include "datastructures.h"
 #include "measurevals.h"
 #include "rpiweatherd_config.h"
 
-#define MAX_WORKER_THREADS                       4
-#define LISTENER_MQUEUE_MAX_MESSAGES             512
-#define LISTENER_MAX_MESSAGE_SIZE                128
-#define RPIWD_WORKER_QUEUE_NAME                  "/rpiwd_worker_mqueue"
+#define MAX_WORKER_THREADS                       64
+#define LISTENER_QUEUE_CAPACITY                  512 /* Must be a power of two */
+#define LISTENER_MAX_EVENTS                      64
+#define LISTENER_IDLE_INTERVAL                   1000 /* Milliseconds; wait without timers */
 #define RPIWD_MAXHOST                            128
 #define STR_PORT_BUFFER_SIZE                     16
-#define DEFAULT_SOCKET_TIMEOUT                   2
 #define STATS_COMMAND_BUFFER_LENGTH              64
-#define STATS_EXTRA_STATS_COUNT                  5
+#define STATS_EXTRA_STATS_COUNT                  12
+#define LISTENER_COMMAND_BURST                   3    /* Bucket size of per-command limits */
+#define LISTENER_DRAIN_TIMEOUT                   10000 /* Milliseconds to answer requests on reload */
+#define LISTENER_DRAIN_POLL_INTERVAL             10
+
+/* Server-sent events and WebSocket subscribers */
+#define STREAM_MAX_PENDING_OUTPUT                65536 /* Bytes; slower subscribers are dropped */
+#define STREAM_HEARTBEAT_INTERVAL                15000 /* Milliseconds */
+#define STREAM_BATCH_SIZE                        32   /* Samples sent in one WebSocket frame */
+#define STREAM_NUMBER_BUFFER_LENGTH              32
+#define STREAM_SAMPLES_PREFIX                    "{\"type\":\"samples\",\"data\":"
+
+/* Response encodings; JSON unless asked for with Accept or this parameter */
+#define LISTENER_FORMAT_PARAM                    "format"
+#define LISTENER_FORMAT_JSON                     "json"
+#define LISTENER_FORMAT_CBOR                     "cbor"
+#define LISTENER_FORMAT_CSV                      "csv"  /* Streamed fetches and exports */
+
+/* Long polls */
+#define LONGPOLL_MAX_WAIT                        300  /* Seconds */
+
+/* Current values */
+#define CURRENT_DEFAULT_MAX_AGE_INTERVALS        2     /* Query intervals, without 'maxage' */
+#define CURRENT_SAMPLE_WAIT                      10000 /* Milliseconds for a fresh reading */
+
+/* Worker pool management */
+#define POOL_MANAGER_INTERVAL                    1000 /* Milliseconds */
+#define POOL_GROW_WAIT_THRESHOLD                 2000 /* Average queue wait, microseconds */
+#define POOL_GROW_DEPTH_THRESHOLD                (LISTENER_MAX_EVENTS / 2) /* Ready events */
+#define POOL_IDLE_EVENTS_PER_WORKER              10   /* Per interval; less is idle */
+#define POOL_SHRINK_IDLE_INTERVALS               30   /* Idle intervals before shrinking */
+
+/* Worker states */
+#define WORKER_STATE_FREE                        0    /* Slot is unused */
+#define WORKER_STATE_RUNNING                     1
+#define WORKER_STATE_RETIRING                    2    /* No new connections; exits when drained */
+#define WORKER_STATE_EXITED                      3    /* Thread is done and must be joined */
 
 /* Callback return codes */
 #define CALLBACK_RETCODE_SUCCESS                 0
@@ -60,33 +103,204 @@
 #define CALLBACK_RETCODE_MEMORY_ERROR		-1007
 #define CALLBACK_RETCODE_DEVICE_ERROR		-1008
 #define CALLBACK_RETCODE_DUPLICATE_PARAMS       -1009
+#define CALLBACK_RETCODE_RATE_LIMITED           -1010
+#define CALLBACK_RETCODE_UPGRADE_REQUIRED       -1011
+#define CALLBACK_RETCODE_BAD_HANDSHAKE          -1012
+#define CALLBACK_RETCODE_BAD_MESSAGE            -1013
+#define CALLBACK_RETCODE_RESULT_TOO_LARGE       -1014
+#define CALLBACK_RETCODE_HTTP11_REQUIRED        -1015
+#define CALLBACK_RETCODE_SAMPLE_PENDING         -1016 /* Not an error; waits for a reading */
+
+/* Commands: name, callback, and limit on top of the one for every request.
+ * Command and parameter names are looked up through perfect hashes built
+ * from these tables (see init_dispatch_tables()). */
+#define LISTENER_COMMANDS(X) \
+	X("fetch", fetch_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("current", current_command_callback, RATELIMIT_BUCKET_CURRENT) \
+	X("statistics", statistics_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("config", config_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("stream", stream_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("ws", websocket_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("batch", batch_command_callback, RATELIMIT_BUCKET_NONE) \
+	X("export", export_command_callback, RATELIMIT_BUCKET_NONE)
+
+/* Parameters of the 'fetch' and 'current' commands */
+#define FETCH_PARAMS(X) \
+	X(FETCH_PARAM_TEMPUNIT, "tempunit") \
+	X(FETCH_PARAM_FROM, "from") \
+	X(FETCH_PARAM_TO, "to") \
+	X(FETCH_PARAM_ON, "on") \
+	X(FETCH_PARAM_SELECT, "select") \
+	X(FETCH_PARAM_SINCE_ID, "since_id") \
+	X(FETCH_PARAM_WAIT, "wait") \
+	X(FETCH_PARAM_MAXAGE, "maxage")
+
+#define FETCH_PARAM_ID(id, name)                 id,
+enum { FETCH_PARAMS(FETCH_PARAM_ID) FETCH_PARAM_COUNT };
 
 /* Command callback structure */
 typedef struct cmd_callback_s {
 	const char *cmd_name;
 	int (*callback)(http_cmd *params, rpiwd_mqmsg *msgbuff);
+	int ratelimit_bucket; /* Limit on top of the one for every request */
 } cmd_callback;
 
+/* A new sample, on its way to subscribers.
+ * Workers share one copy; the last one to let go of it frees it. */
+typedef struct stream_sample_s {
+	entry ent;                                    /* In the configured unit */
+	float celsius;                                /* Temperature as it was measured */
+	char unitstr[RPIWD_MAX_MEASUREMENTS];
+	char *event;                                  /* Formatted for event streams */
+	unsigned int refcount;                        /* Accessed atomically */
+} stream_sample;
+
+/* Worker thread structure.
+ * Every worker runs its own epoll loop and owns the connections registered in it. */
+typedef struct rpiwd_worker_s {
+	int id;
+	pthread_t thread_id;
+	int epfd;
+	int listener_sockfd;                          /* Own socket in SO_REUSEPORT mode */
+	int state;                                    /* WORKER_STATE_*; accessed atomically */
+	bool close_all;                               /* Drain ran out of time; accessed atomically */
+	rpiwd_msgring completions;                    /* Requests answered by the DB thread */
+	unsigned int inflight;                        /* Requests still in the DB thread */
+	uint64_t wait_usec, wait_samples, events;     /* Load counters; collected and reset */
+	unsigned int max_depth;                       /* by the pool manager every interval */
+	rpiwd_conn *connections;                      /* Open connections */
+	unsigned int subscribers;                     /* Of those, taking samples; read by publishers */
+	rpiwd_timerwheel timers;                      /* Deadlines of those connections */
+	rpiwd_conn *graveyard;                        /* Closed, freed after each round */
+	db_fetch_cursor *cancels;                     /* Not sent yet for want of room */
+} rpiwd_worker;
+
 /* Init/quit */
-void init_listener_loop(int num_worker_threads, int comm_port);
-void listener_loop_cleanup_routine(void *);
+void init_listener_loop(int num_worker_threads, int min_worker_threads,
+		int max_worker_threads, int comm_port, bool reuseport, const char *unix_socket);
+void reload_listener_loop(int num_worker_threads, int min_worker_threads,
+		int max_worker_threads, int comm_port, bool reuseport, const char *unix_socket);
 void quit_listener_loop(void);
-void quit_listener_mq(void);
+void listener_stop_threads(void);
+void listener_close_unix_socket(void);
+void listener_publish_sample(const entry *ent);
+void listener_publish_reading(void);
+stream_sample *stream_sample_alloc(const entry *ent, const char *unitstr);
+void stream_sample_release(stream_sample *sample);
+char *stream_samples_to_json(stream_sample **samples, size_t count,
+		const websocket_filter *filter, size_t *length);
 
 /* Main listener loop callback passed to pthread_create() */
-void *main_listener_loop(void *comm_port);
+void *main_listener_loop(void *unused);
+void listener_accept_connection(int sockfd);
 void *worker_listener_loop(void *arg);
 
+/* Worker init/quit */
+int init_worker(rpiwd_worker *worker, int id, int comm_port);
+void worker_cleanup_routine(void *arg);
+
+/* Worker pool management */
+void pool_manager_tick(bool can_shrink);
+void *pool_manager_loop(void *unused);
+int pool_grow(void);
+void pool_retire_worker(void);
+void pool_drain_workers(int timeout_ms);
+void pool_reap_workers(void);
+rpiwd_worker *pool_next_worker(void);
+int pool_size(void);
+uint64_t pool_queue_wait(void);
+unsigned int pool_queue_depth(void);
+unsigned int pool_subscribers(void);
+uint64_t pool_stream_evictions(void);
+
+/* Worker event handling */
+void worker_accept_connections(rpiwd_worker *worker);
+void worker_adopt_connection(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_handle_event(rpiwd_worker *worker, rpiwd_conn *conn, uint32_t events);
+void worker_handle_request(rpiwd_worker *worker, rpiwd_conn *conn);
+bool worker_admit_request(rpiwd_worker *worker, rpiwd_conn *conn);
+bool worker_admit_command(rpiwd_worker *worker, rpiwd_conn *conn, http_cmd *cmd);
+void worker_shed_request(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_submit_request(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff);
+bool worker_revalidate_fetch(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff);
+void worker_not_modified(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_reject_request(rpiwd_worker *worker, rpiwd_conn *conn, int httpcode,
+		int errcode, const char *err, unsigned int retry_after);
+void worker_handle_completions(rpiwd_worker *worker);
+void worker_complete_request(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff);
+void worker_complete_stream(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff);
+char *message_to_cbor(rpiwd_mqmsg *msgbuff, size_t *length);
+void worker_request_next_batch(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_cancel_fetch(rpiwd_worker *worker, void *cursor);
+void worker_send_cancels(rpiwd_worker *worker);
+void worker_subscribe(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff);
+void worker_publish_event(rpiwd_worker *worker, const char *event);
+void worker_publish_samples(rpiwd_worker *worker, stream_sample **samples, size_t count);
+void worker_discard_input(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_watch_parked(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_free_message(rpiwd_mqmsg *msgbuff);
+
+/* Worker long polls */
+bool worker_has_newer_data(const rpiwd_mqmsg *msgbuff);
+bool worker_has_reading(const rpiwd_mqmsg *msgbuff);
+void worker_park_request(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff);
+void worker_wake_parked(rpiwd_worker *worker, stream_sample **samples, size_t count);
+void worker_wake_readers(rpiwd_worker *worker);
+void worker_resume_request(rpiwd_worker *worker, rpiwd_conn *conn, const stream_sample *sample);
+
+/* Worker WebSocket handling */
+void worker_upgrade_websocket(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff);
+void worker_handle_websocket(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_websocket_message(rpiwd_worker *worker, rpiwd_conn *conn);
+int worker_websocket_subscribe(rpiwd_worker *worker, rpiwd_conn *conn, JSON_Object *obj);
+void worker_websocket_unsubscribe(rpiwd_worker *worker, rpiwd_conn *conn);
+int worker_websocket_fetch(rpiwd_worker *worker, rpiwd_conn *conn, JSON_Object *obj);
+void worker_complete_websocket(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff);
+void worker_websocket_reply(rpiwd_worker *worker, rpiwd_conn *conn, const char *type,
+		int errcode, const char *errmsg);
+void worker_websocket_send(rpiwd_worker *worker, rpiwd_conn *conn, char *message);
+void worker_close_websocket(rpiwd_worker *worker, rpiwd_conn *conn, uint16_t status);
+
+/* Worker connection management */
+void worker_finish_response(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_flush_connection(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_close_connection(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_close_idle(rpiwd_worker *worker);
+void worker_close_all(rpiwd_worker *worker);
+void worker_free_closed(rpiwd_worker *worker);
+void worker_start_request(rpiwd_worker *worker, rpiwd_conn *conn);
+void worker_set_deadline(rpiwd_worker *worker, rpiwd_conn *conn, uint64_t deadline_ms);
+void worker_expire_connection(rpiwd_timer *timer, void *arg);
+void worker_record_wait(rpiwd_worker *worker, uint64_t since, uint64_t now);
+
 /* Various utility methods */
-int get_bound_socket(int port);
+int get_bound_socket(int port, bool reuseport);
+int get_unix_socket(const char *path);
 
 /* Command callbacks */
 const char *command_callback_strerror(int errcode);
+void init_dispatch_tables(void);
+cmd_callback *find_command(const char *cmd_name, size_t length);
 int dispatch_command(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int take_format_param(http_cmd *params, int *format);
+int command_ratelimit_bucket(const char *cmd_name, size_t length);
 
 int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+long parse_wait_param(const char *value);
+int parse_max_age_param(const char *value);
+int parse_since_id_param(const char *value, uint64_t *since_id);
 int current_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int current_latest_sample(rpiwd_mqmsg *msgbuff);
 int statistics_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
 int config_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int stream_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int websocket_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int batch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int export_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff);
+int batch_dispatch_command(http_cmd_param *param, rpiwd_mqmsg *msgbuff);
+int batch_query_error(int response);
+bool batch_needs_db(const rpiwd_mqmsg_batch *batch);
+JSON_Value *batch_to_json_value(rpiwd_mqmsg_batch *batch);
+int batch_to_cbor(strbuf *buf, rpiwd_mqmsg_batch *batch);
 
 #endif /* RPIWD_LISTENER_H */
@@ -20,10 +20,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-
-#include <mqueue.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "confighandler.h" /* __rpiwd_unitstring */
+#include "arena.h"
 
 /* Message types */
 #define DB_MSGTYPE_WRITEENTRY   100
@@ -31,12 +32,30 @@
 #define DB_MSGTYPE_CURRENT		102
 #define DB_MSGTYPE_STATS		103
 #define DB_MSGTYPE_CONFIG		104
+#define DB_MSGTYPE_FETCH_STREAM	105	/* Fetch, answered in batches */
+#define DB_MSGTYPE_FETCH_NEXT	106	/* Next batch of a streamed fetch */
+#define DB_MSGTYPE_FETCH_CANCEL	107	/* Client is gone; drop the cursor */
+#define DB_MSGTYPE_SUBSCRIBE	108	/* Event stream; answered by the worker */
+#define DB_MSGTYPE_SAMPLE		109	/* New sample for event stream subscribers */
+#define DB_MSGTYPE_WEBSOCKET	110	/* WebSocket upgrade; answered by the worker */
+#define DB_MSGTYPE_BATCH		111	/* Several commands; see rpiwd_mqmsg_batch */
+#define DB_MSGTYPE_READING		112	/* New reading for requests waiting on one */
 
-#define MQ_MAXMESSAGES		20
-#define MQ_MAXMSGSIZE		1024
+#define DB_MSG_BATCH_MAX_PARTS	8
 
 #define DB_MSG_NO_SOCKFD		-100
 
+/* Response encodings */
+#define RPIWD_FORMAT_JSON		0
+#define RPIWD_FORMAT_CBOR		1
+#define RPIWD_FORMAT_CSV		2	/* Streamed fetches only */
+
+/* Client connection (see connection.h) */
+struct rpiwd_conn_s;
+
+/* Message ring (see msgring.h) */
+struct rpiwd_msgring_s;
+
 /* Message return codes */
 #define RPIWD_MQ_RETCODE_OK				0
 #define RPIWD_MQ_RETCODE_SQL_ERR		-1
@@ -46,14 +65,36 @@ typedef struct rpiwd_mqmsg_s {
     int mtype;						      /* Operation type */
     int is_completed;				      /* Used by HTTP listener */
     int sockfd;						      /* Client socket to respond to */
+    struct rpiwd_conn_s *conn;            /* Client connection to respond to */
     int retcode;					      /* Operation return code (for logging) */
-    mqd_t receiver_mq;				      /* Reciever queue id (for read requests) */
-    char *fcountq, *fselectq; 		      /* Formatted count and selection queries */
+    struct rpiwd_msgring_s *receiver;     /* Reciever queue (for read requests) */
+    rpiwd_arena *arena;                   /* Request's arena; NULL if it has none */
+    char *fcountq, *fselectq; 		      /* Formatted count and selection queries.
+                                             From the arena, if there is one */
     char unitstr[RPIWD_MAX_MEASUREMENTS]; /* Measurements unit string; used mainly by the
                                              JSON-izing callbacks */
+    void *cursor;                         /* Open streaming cursor (see dbhandler.h) */
+    uint64_t deadline_usec;               /* Monotonic; not worth answering after. 0 = none */
+    unsigned int wait_ms;                 /* Long poll; wait this long for newer data */
+    uint64_t newer_than_id;               /* Newer data: rows after this one, */
+    time_t newer_than_time;               /* written after this time */
+    int max_age_ms;                       /* Of a cached device reading; -1 = the default */
+    uint64_t reading_after_usec;          /* Monotonic; a reading taken since will do.
+                                             0 = none was asked for */
+    int format;                           /* RPIWD_FORMAT_*, of the response */
 	void *data;
+    size_t length;                        /* Of data, for streamed batches */
 } rpiwd_mqmsg;
 
+/* Commands of a batch request.
+ * The DB thread runs the parts that need it in one go; the rest are complete
+ * before the batch is sent. */
+typedef struct rpiwd_mqmsg_batch_s {
+    size_t length;
+    const char *names[DB_MSG_BATCH_MAX_PARTS];  /* Command names */
+    rpiwd_mqmsg parts[DB_MSG_BATCH_MAX_PARTS];
+} rpiwd_mqmsg_batch;
+
 /* Allocating/freeing dbhandler message structures */
 void rpiwd_mqmsg_init(rpiwd_mqmsg *ret);
 
@@ -0,0 +1,69 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_MSGRING_H
+#define RPIWD_MSGRING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "mqmsg.h"
+
+/* Constants */
+#define RPIWD_CACHELINE_SIZE            64
+#define MSGRING_PUSH_RETRY_INTERVAL     100000 /* Nanoseconds between retries when full */
+
+/* A single slot in the ring.
+ * The sequence number tells producers and consumers whose turn it is. */
+typedef struct rpiwd_msgring_cell_s {
+    size_t sequence;
+    rpiwd_mqmsg msg;
+} rpiwd_msgring_cell;
+
+/* Bounded multi-producer/multi-consumer ring of messages.
+ * Messages are copied in and out; the eventfd wakes up a sleeping consumer. */
+typedef struct rpiwd_msgring_s {
+    rpiwd_msgring_cell *cells;
+    size_t mask;
+    int eventfd;
+    char pad0[RPIWD_CACHELINE_SIZE];
+    size_t enqueue_pos;
+    char pad1[RPIWD_CACHELINE_SIZE];
+    size_t dequeue_pos;
+    char pad2[RPIWD_CACHELINE_SIZE];
+} rpiwd_msgring;
+
+/* Init/destroy. Capacity must be a power of two. */
+int rpiwd_msgring_init(rpiwd_msgring *ring, size_t capacity, bool nonblocking);
+void rpiwd_msgring_destroy(rpiwd_msgring *ring);
+
+/* Non-blocking operations */
+bool rpiwd_msgring_try_push(rpiwd_msgring *ring, const rpiwd_mqmsg *msg);
+bool rpiwd_msgring_try_pop(rpiwd_msgring *ring, rpiwd_mqmsg *msg);
+
+/* Push and wake the consumer; waits for a free slot if the ring is full */
+void rpiwd_msgring_send(rpiwd_msgring *ring, const rpiwd_mqmsg *msg);
+
+/* Consumer wakeup handling */
+void rpiwd_msgring_notify(rpiwd_msgring *ring);
+int rpiwd_msgring_wait(rpiwd_msgring *ring);
+
+#endif /* RPIWD_MSGRING_H */
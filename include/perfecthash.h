@@ -0,0 +1,51 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_PERFECTHASH_H
+#define RPIWD_PERFECTHASH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Constants */
+#define PERFECT_HASH_MAX_KEYS           32
+#define PERFECT_HASH_MAX_SLOTS          (PERFECT_HASH_MAX_KEYS * 2)
+#define PERFECT_HASH_MAX_SEEDS          65536   /* Seeds tried before giving up */
+#define PERFECT_HASH_NO_KEY             -1
+
+/* Perfect hash over a fixed set of names, e.g. commands or parameters.
+ * Building it searches for a seed under which every name has a slot of its
+ * own, so a lookup is one hash of the name and at most one comparison.
+ * It is read-only once built, and needs no locking. */
+typedef struct rpiwd_perfect_hash_s {
+    uint32_t seed;
+    uint32_t mask;                                  /* Slot count - 1 */
+    uint8_t slots[PERFECT_HASH_MAX_SLOTS];          /* Key index + 1; 0 if empty */
+    const char *const *keys;
+    size_t lengths[PERFECT_HASH_MAX_KEYS];
+} rpiwd_perfect_hash;
+
+/* Building; keys must outlive the table */
+int perfect_hash_build(rpiwd_perfect_hash *table, const char *const *keys, size_t count);
+
+/* Index of the key in the array it was built from, or PERFECT_HASH_NO_KEY */
+int perfect_hash_lookup(const rpiwd_perfect_hash *table, const char *name, size_t length);
+
+/* Internal helpers */
+static uint32_t perfect_hash_string(const char *name, size_t length, uint32_t seed);
+
+#endif /* RPIWD_PERFECTHASH_H */
@@ -0,0 +1,74 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_RATELIMIT_H
+#define RPIWD_RATELIMIT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/* Constants */
+#define RATELIMIT_KEY_LENGTH            16   /* IPv4 addresses or IPv6 /64 prefixes */
+#define RATELIMIT_TABLE_SIZE            256  /* Tracked clients; must be a power of two */
+#define RATELIMIT_PROBE_LENGTH          8    /* Slots searched before evicting */
+#define RATELIMIT_TOKEN                 1000000ULL /* Fixed point; one request */
+
+/* Buckets every client has */
+#define RATELIMIT_BUCKET_NONE          -1
+#define RATELIMIT_BUCKET_REQUESTS       0    /* Any request */
+#define RATELIMIT_BUCKET_CURRENT        1    /* Sensor reads */
+#define RATELIMIT_BUCKET_COUNT          2
+
+/* Client key.
+ * IPv6 clients usually own a whole /64, so only the prefix is kept; IPv4 and
+ * IPv4-mapped addresses end up as the same key. */
+typedef struct rpiwd_ratelimit_key_s {
+    uint8_t addr[RATELIMIT_KEY_LENGTH];
+} rpiwd_ratelimit_key;
+
+/* A token bucket in fixed point; refilled lazily whenever it is used */
+typedef struct rpiwd_token_bucket_s {
+    uint64_t tokens;
+    uint64_t updated_usec;
+} rpiwd_token_bucket;
+
+/* Per-client entry of the table */
+typedef struct rpiwd_ratelimit_entry_s {
+    bool in_use;
+    rpiwd_ratelimit_key key;
+    uint64_t last_seen_usec;                /* Least recently seen is evicted first */
+    rpiwd_token_bucket buckets[RATELIMIT_BUCKET_COUNT];
+} rpiwd_ratelimit_entry;
+
+/* Keys */
+void ratelimit_key_from_sockaddr(rpiwd_ratelimit_key *key, const struct sockaddr *addr);
+
+/* Takes a token from the client's bucket. The bucket holds up to 'burst'
+ * tokens and refills at 'per_minute' tokens a minute; a rate of 0 means no
+ * limit. Returns false with the seconds until the next token if it is empty. */
+bool ratelimit_admit(const rpiwd_ratelimit_key *key, int bucket, int per_minute,
+		int burst, uint64_t now_usec, unsigned int *retry_after);
+
+/* Internal helpers */
+static rpiwd_ratelimit_entry *ratelimit_lookup(const rpiwd_ratelimit_key *key,
+		uint64_t now_usec);
+
+#endif /* RPIWD_RATELIMIT_H */
@@ -0,0 +1,72 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_TIMERWHEEL_H
+#define RPIWD_TIMERWHEEL_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Constants */
+#define TIMERWHEEL_TICK_MS              100  /* Resolution of all deadlines */
+#define TIMERWHEEL_LEVELS               4
+#define TIMERWHEEL_SLOT_BITS            6
+#define TIMERWHEEL_SLOTS                (1 << TIMERWHEEL_SLOT_BITS)
+#define TIMERWHEEL_SLOT_MASK            (TIMERWHEEL_SLOTS - 1)
+#define TIMERWHEEL_MAX_TICKS            ((1ULL << (TIMERWHEEL_SLOT_BITS * TIMERWHEEL_LEVELS)) - 1)
+
+/* A timer. Embedded in whatever it times out; 'data' points back at it. */
+typedef struct rpiwd_timer_s {
+    uint64_t expires;                       /* In ticks */
+    struct rpiwd_timer_s **slot;            /* List the timer is on; NULL if idle */
+    struct rpiwd_timer_s *prev, *next;
+    void *data;
+} rpiwd_timer;
+
+/* Hierarchical timer wheel.
+ * Level 0 has one slot per tick; every slot of the next level spans a whole lap
+ * of the level below, and is spread over it when that level comes around to it.
+ * Starting, stopping and expiring a timer are O(1). A wheel belongs to one
+ * thread and is not locked. */
+typedef struct rpiwd_timerwheel_s {
+    uint64_t now;                           /* Current tick */
+    size_t count;                           /* Pending timers */
+    rpiwd_timer *slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+} rpiwd_timerwheel;
+
+/* Called for every expired timer; it may restart it or start others */
+typedef void (*rpiwd_timer_callback)(rpiwd_timer *timer, void *arg);
+
+/* Init */
+void timerwheel_init(rpiwd_timerwheel *wheel, uint64_t now_ms);
+void timer_init(rpiwd_timer *timer, void *data);
+
+/* Starting/stopping timers */
+void timerwheel_schedule(rpiwd_timerwheel *wheel, rpiwd_timer *timer, uint64_t expires_ms);
+void timerwheel_cancel(rpiwd_timerwheel *wheel, rpiwd_timer *timer);
+bool timer_is_pending(const rpiwd_timer *timer);
+
+/* Expires every timer that is due by now_ms; returns how many */
+size_t timerwheel_advance(rpiwd_timerwheel *wheel, uint64_t now_ms,
+		rpiwd_timer_callback callback, void *arg);
+
+/* Internal helpers */
+static void timerwheel_insert(rpiwd_timerwheel *wheel, rpiwd_timer *timer);
+static void timerwheel_unlink(rpiwd_timer *timer);
+static void timerwheel_cascade(rpiwd_timerwheel *wheel, int level);
+
+#endif /* RPIWD_TIMERWHEEL_H */
@@ -27,6 +27,7 @@
 #include <limits.h>
 #include <time.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -48,6 +49,7 @@
 #define PID_NUMBER_BUFFER_LENGTH	16
 #define RPIWD_COPYFILE_BUFFSIZE     2048
 #define RPIWD_DOUBLE_BUFFER_LENGTH   24
+#define RPIWD_HASH64_SEED           14695981039346656037ULL /* FNV-1a offset basis */
 
 /* ASCII Art defines */
 #define ASCII_TITLE "rpiweatherd, version %s\n" \
@@ -68,9 +70,15 @@ time_t normalize_date(const char *value, bool *rdtn_performed);
 /* Custom sleep function */
 void rpiwd_sleep(unsigned int milliseconds);
 
+/* Monotonic clock in microseconds, for measuring intervals */
+uint64_t rpiwd_monotonic_usec(void);
+
 /* String manipulation */
 char *rpiwd_getline(const char *line, const char *newline);
 
+/* Hashing; chain calls by passing the previous result as the seed */
+uint64_t rpiwd_hash64(const void *data, size_t length, uint64_t seed);
+
 /* Daemon PID File and checks */
 int pid_file_exists(void);
 int write_pid_file(void);
@@ -0,0 +1,118 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RPIWD_WEBSOCKET_H
+#define RPIWD_WEBSOCKET_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "datastructures.h"
+
+/* Handshake (RFC 6455, section 4) */
+#define WEBSOCKET_GUID                  "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_VERSION               13
+#define WEBSOCKET_KEY_LENGTH            24  /* 16 random bytes in base64 */
+#define WEBSOCKET_ACCEPT_LENGTH         29  /* A SHA-1 digest in base64, plus NUL */
+#define WEBSOCKET_SHA1_LENGTH           20
+#define WEBSOCKET_SHA1_ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/* Limits */
+#define WEBSOCKET_MAX_MESSAGE_SIZE      1024 /* Client messages are small commands */
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD   125
+#define WEBSOCKET_MAX_HEADER_SIZE       10   /* Server frames are never masked */
+#define WEBSOCKET_FILTER_NAME_LENGTH    64
+
+/* Opcodes */
+#define WEBSOCKET_OPCODE_CONTINUATION   0x0
+#define WEBSOCKET_OPCODE_TEXT           0x1
+#define WEBSOCKET_OPCODE_BINARY         0x2
+#define WEBSOCKET_OPCODE_CLOSE          0x8
+#define WEBSOCKET_OPCODE_PING           0x9
+#define WEBSOCKET_OPCODE_PONG           0xA
+
+/* Close status codes */
+#define WEBSOCKET_CLOSE_NORMAL          1000
+#define WEBSOCKET_CLOSE_GOING_AWAY      1001
+#define WEBSOCKET_CLOSE_PROTOCOL_ERROR  1002
+#define WEBSOCKET_CLOSE_UNSUPPORTED     1003
+#define WEBSOCKET_CLOSE_TOO_BIG         1009
+
+/* Frame parser return codes */
+#define WEBSOCKET_FRAME_INCOMPLETE      1
+#define WEBSOCKET_FRAME_COMPLETE        0   /* Also: a whole message was assembled */
+#define WEBSOCKET_ERROR_PROTOCOL        -1
+#define WEBSOCKET_ERROR_TOO_BIG         -2
+#define WEBSOCKET_ERROR_UNSUPPORTED     -3
+
+/* A frame received from a client.
+ * The payload points into the input buffer, where it was unmasked in place. */
+typedef struct websocket_frame_s {
+    bool fin;
+    int opcode;
+    char *payload;
+    size_t length;
+    size_t frame_length;                    /* Header and payload */
+} websocket_frame;
+
+/* Samples a subscriber wants. Empty names and infinite bounds match anything. */
+typedef struct websocket_filter_s {
+    char location[WEBSOCKET_FILTER_NAME_LENGTH];
+    char device_name[WEBSOCKET_FILTER_NAME_LENGTH];
+    float min_temperature, max_temperature;
+    float min_humidity, max_humidity;
+} websocket_filter;
+
+/* State of an upgraded connection.
+ * Its size is fixed, so a client cannot make the server hold more than this
+ * and its output queue. */
+typedef struct rpiwd_websocket_s {
+    bool subscribed;                        /* Receives samples */
+    websocket_filter filter;
+    bool has_request_id;                    /* Client's ID of the fetch in progress */
+    double request_id;
+    int message_opcode;                     /* Of the message being assembled */
+    size_t message_length;
+    char message[WEBSOCKET_MAX_MESSAGE_SIZE + 1]; /* NUL-terminated once complete */
+} rpiwd_websocket;
+
+/* Allocating/freeing */
+rpiwd_websocket *websocket_alloc(void);
+void websocket_free(rpiwd_websocket *ws);
+
+/* Handshake */
+void websocket_accept_key(const char *key, size_t length, char *accept);
+
+/* Framing */
+int websocket_parse_frame(char *buf, size_t length, websocket_frame *frame);
+int websocket_add_fragment(rpiwd_websocket *ws, const websocket_frame *frame);
+size_t websocket_frame_header(char *buf, int opcode, size_t length);
+uint16_t websocket_close_status(int errcode);
+
+/* Filters */
+void websocket_filter_reset(websocket_filter *filter);
+bool websocket_filter_is_empty(const websocket_filter *filter);
+bool websocket_filter_matches(const websocket_filter *filter, const entry *ent);
+
+/* Internal helpers */
+static void websocket_sha1(const uint8_t *data, size_t length, uint8_t *digest);
+static void websocket_sha1_block(uint32_t *state, const uint8_t *block);
+static size_t websocket_base64(const uint8_t *data, size_t length, char *out);
+
+#endif /* RPIWD_WEBSOCKET_H */
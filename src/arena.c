@@ -0,0 +1,136 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "arena.h"
+
+/* Arena the calling thread allocates from through arena_current_malloc() */
+static __thread rpiwd_arena *__current_arena;
+
+/* Init/quit */
+void arena_init(rpiwd_arena *arena) {
+	/* The first chunk is allocated on first use */
+	arena->head = NULL;
+}
+
+void arena_reset(rpiwd_arena *arena) {
+	rpiwd_arena_chunk *chunk = arena->head, *next;
+
+	/* Free every chunk but the first, which is reused. A first chunk that
+	 * had to be bigger than usual is not worth keeping around either. */
+	while (chunk && (chunk->next || chunk->size > ARENA_CHUNK_SIZE)) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	if (chunk)
+		chunk->used = 0;
+
+	arena->head = chunk;
+}
+
+void arena_destroy(rpiwd_arena *arena) {
+	rpiwd_arena_chunk *chunk = arena->head, *next;
+
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->head = NULL;
+}
+
+/* Allocating */
+void *arena_alloc(rpiwd_arena *arena, size_t size) {
+	rpiwd_arena_chunk *chunk = arena->head;
+	void *ptr;
+
+	size = ARENA_ALIGN(size > 0 ? size : 1);
+
+	/* Start a new chunk when the current one is full. Big allocations get a
+	 * chunk of their own size. */
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_chunk_alloc(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = arena->head;
+		arena->head = chunk;
+	}
+
+	ptr = (char *)chunk + ARENA_CHUNK_HEADER_SIZE + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+char *arena_strdup(rpiwd_arena *arena, const char *str) {
+	size_t length = strlen(str) + 1;
+	char *ptr = arena_alloc(arena, length);
+
+	if (ptr)
+		memcpy(ptr, str, length);
+
+	return ptr;
+}
+
+char *arena_vprintf(rpiwd_arena *arena, const char *format, va_list args) {
+	va_list copy;
+	char *ptr;
+	int length;
+
+	/* Measure first, so the string takes no more than it needs */
+	va_copy(copy, args);
+	length = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+
+	if (length < 0)
+		return NULL;
+
+	ptr = arena_alloc(arena, length + 1);
+	if (ptr)
+		vsnprintf(ptr, length + 1, format, args);
+
+	return ptr;
+}
+
+/* Allocation functions for libraries */
+void arena_make_current(rpiwd_arena *arena) {
+	__current_arena = arena;
+}
+
+void *arena_current_malloc(size_t size) {
+	return __current_arena ? arena_alloc(__current_arena, size) : malloc(size);
+}
+
+void arena_current_free(void *ptr) {
+	/* Arena memory goes away with the arena */
+	if (!__current_arena)
+		free(ptr);
+}
+
+static rpiwd_arena_chunk *arena_chunk_alloc(size_t size) {
+	rpiwd_arena_chunk *chunk = malloc(ARENA_CHUNK_HEADER_SIZE + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
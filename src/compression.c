@@ -0,0 +1,137 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "compression.h"
+
+#ifdef HAVE_ZLIB
+
+struct rpiwd_gzip_stream_s {
+	z_stream zs;
+};
+
+bool compression_available(void) {
+	return true;
+}
+
+char *gzip_compress(const char *data, size_t length, int level, size_t *out_length) {
+	z_stream zs;
+	char *out;
+	uLong bound;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level, Z_DEFLATED,
+				COMPRESSION_WINDOW_BITS + COMPRESSION_GZIP_WRAPPER,
+				COMPRESSION_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	/* deflateBound() is enough for a single Z_FINISH call */
+	bound = deflateBound(&zs, length);
+	out = malloc(bound);
+	if (!out) {
+		deflateEnd(&zs);
+		return NULL;
+	}
+
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = length;
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = bound;
+
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&zs);
+		free(out);
+		return NULL;
+	}
+
+	*out_length = zs.total_out;
+	deflateEnd(&zs);
+
+	return out;
+}
+
+rpiwd_gzip_stream *gzip_stream_open(int level) {
+	rpiwd_gzip_stream *stream = calloc(1, sizeof(rpiwd_gzip_stream));
+	if (!stream)
+		return NULL;
+
+	if (deflateInit2(&stream->zs, level, Z_DEFLATED,
+				COMPRESSION_WINDOW_BITS + COMPRESSION_GZIP_WRAPPER,
+				COMPRESSION_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+char *gzip_stream_write(rpiwd_gzip_stream *stream, const char *data, size_t length,
+		bool finish, size_t *out_length) {
+	uLong bound, before = stream->zs.total_out;
+	char *out;
+	int flag;
+
+	/* A sync flush after every piece lets the client decompress what it has
+	 * so far. It costs a few bytes on top of deflateBound(). */
+	bound = deflateBound(&stream->zs, length) + COMPRESSION_FLUSH_OVERHEAD;
+	out = malloc(bound);
+	if (!out)
+		return NULL;
+
+	stream->zs.next_in = (Bytef *)data;
+	stream->zs.avail_in = length;
+	stream->zs.next_out = (Bytef *)out;
+	stream->zs.avail_out = bound;
+
+	flag = deflate(&stream->zs, finish ? Z_FINISH : Z_SYNC_FLUSH);
+	if (flag != (finish ? Z_STREAM_END : Z_OK) || stream->zs.avail_in > 0) {
+		free(out);
+		return NULL;
+	}
+
+	*out_length = stream->zs.total_out - before;
+	return out;
+}
+
+void gzip_stream_close(rpiwd_gzip_stream *stream) {
+	deflateEnd(&stream->zs);
+	free(stream);
+}
+
+#else
+
+/* Built without zlib; responses are always sent as they are */
+bool compression_available(void) {
+	return false;
+}
+
+char *gzip_compress(const char *data, size_t length, int level, size_t *out_length) {
+	return NULL;
+}
+
+rpiwd_gzip_stream *gzip_stream_open(int level) {
+	return NULL;
+}
+
+char *gzip_stream_write(rpiwd_gzip_stream *stream, const char *data, size_t length,
+		bool finish, size_t *out_length) {
+	return NULL;
+}
+
+void gzip_stream_close(rpiwd_gzip_stream *stream) {
+}
+
+#endif /* HAVE_ZLIB */
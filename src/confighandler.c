@@ -16,7 +16,10 @@
 
 #include "confighandler.h"
 
-static rpiwd_config __current_configuration;
+/* The configuration in use. A configuration is never changed once published;
+ * a reload publishes a new one. Older generations are kept until exit, since
+ * other threads may still be reading them. */
+static rpiwd_config *__current_configuration;
 static pthread_mutex_t __mtx_config = PTHREAD_MUTEX_INITIALIZER;
 static size_t temp_count;
 static char __rpiwd_unitstring[RPIWD_MAX_MEASUREMENTS];
@@ -60,6 +63,78 @@ int inih_callback(void *info, const char *section, const char *name, const char
 		if (errno == ERANGE)
 			return CONFIG_ERROR_NUM_WTHREADS; /* Configuration error */
     }
+	else if (strcmp(name, CONFIG_MIN_WORKER_THREADS) == 0) { /* Worker pool lower bound */
+		confstrct->min_worker_threads = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_NUM_WTHREADS; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_MAX_WORKER_THREADS) == 0) { /* Worker pool upper bound */
+		confstrct->max_worker_threads = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_NUM_WTHREADS; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_KEEPALIVE_TIMEOUT) == 0) { /* Keep-alive idle timeout */
+		confstrct->keepalive_timeout = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_KEEPALIVE; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_KEEPALIVE_MAX_REQUESTS) == 0) { /* Requests per conn. */
+		confstrct->keepalive_max_requests = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_KEEPALIVE; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_REUSEPORT) == 0) { /* Per-worker listener sockets */
+		confstrct->reuseport = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_REUSEPORT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_COMPRESSION_LEVEL) == 0) { /* zlib compression level */
+		confstrct->compression_level = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_COMPRESSION; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_COMPRESSION_MIN_SIZE) == 0) { /* Smallest compressed body */
+		confstrct->compression_min_size = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_COMPRESSION; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_RATE_LIMIT_REQUESTS) == 0) { /* Requests per client */
+		confstrct->rate_limit_requests = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_RATE_LIMIT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_RATE_LIMIT_BURST) == 0) { /* Requests bucket size */
+		confstrct->rate_limit_burst = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_RATE_LIMIT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_RATE_LIMIT_CURRENT) == 0) { /* Sensor reads per client */
+		confstrct->rate_limit_current = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_RATE_LIMIT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_DB_READ_DEADLINE) == 0) { /* Queued read lifetime */
+		confstrct->db_read_deadline = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_DB_DEADLINE; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_DB_WRITE_DEADLINE) == 0) { /* Wait for a queue slot */
+		confstrct->db_write_deadline = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_DB_DEADLINE; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_HEADER_TIMEOUT) == 0) { /* Time to send headers */
+		confstrct->header_timeout = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_TIMEOUT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_REQUEST_TIMEOUT) == 0) { /* Time for a whole request */
+		confstrct->request_timeout = strtol(value, NULL, 10);
+		if (errno == ERANGE)
+			return CONFIG_ERROR_TIMEOUT; /* Configuration error */
+	}
+	else if (strcmp(name, CONFIG_UNIX_SOCKET) == 0) /* Local socket path */
+		confstrct->unix_socket = strdup(value);
 	else
 		return 0; /* Unknown section, name or error */
 
@@ -93,6 +168,23 @@ int write_config_file(const char *path, rpiwd_config *confstrct) {
 	fprintf(f, "\n[Server Configuration]\n");
 	fprintf(f, "%s=%d\n", CONFIG_COMM_PORT, confstrct->comm_port);
 	fprintf(f, "%s=%d\n", CONFIG_NUM_WORKER_THREADS, confstrct->num_worker_threads);
+	fprintf(f, "%s=%d\n", CONFIG_MIN_WORKER_THREADS, confstrct->min_worker_threads);
+	fprintf(f, "%s=%d\n", CONFIG_MAX_WORKER_THREADS, confstrct->max_worker_threads);
+	fprintf(f, "%s=%d\n", CONFIG_KEEPALIVE_TIMEOUT, confstrct->keepalive_timeout);
+	fprintf(f, "%s=%d\n", CONFIG_KEEPALIVE_MAX_REQUESTS,
+			confstrct->keepalive_max_requests);
+	fprintf(f, "%s=%d\n", CONFIG_REUSEPORT, confstrct->reuseport);
+	fprintf(f, "%s=%d\n", CONFIG_COMPRESSION_LEVEL, confstrct->compression_level);
+	fprintf(f, "%s=%d\n", CONFIG_COMPRESSION_MIN_SIZE, confstrct->compression_min_size);
+	fprintf(f, "%s=%d\n", CONFIG_RATE_LIMIT_REQUESTS, confstrct->rate_limit_requests);
+	fprintf(f, "%s=%d\n", CONFIG_RATE_LIMIT_BURST, confstrct->rate_limit_burst);
+	fprintf(f, "%s=%d\n", CONFIG_RATE_LIMIT_CURRENT, confstrct->rate_limit_current);
+	fprintf(f, "%s=%d\n", CONFIG_DB_READ_DEADLINE, confstrct->db_read_deadline);
+	fprintf(f, "%s=%d\n", CONFIG_DB_WRITE_DEADLINE, confstrct->db_write_deadline);
+	fprintf(f, "%s=%d\n", CONFIG_HEADER_TIMEOUT, confstrct->header_timeout);
+	fprintf(f, "%s=%d\n", CONFIG_REQUEST_TIMEOUT, confstrct->request_timeout);
+	if (confstrct->unix_socket)
+		fprintf(f, "%s=%s\n", CONFIG_UNIX_SOCKET, confstrct->unix_socket);
 
 	/* Close file */
 	fclose(f);
@@ -105,9 +197,33 @@ int parse_config_file(const char *path, rpiwd_config *confstrct) {
 	/* A static variable should be reset just in case */
 	temp_count = 0;
 
+	/* Optional settings */
+	confstrct->keepalive_timeout = CONFIG_KEEPALIVE_TIMEOUT_DEFAULT;
+	confstrct->keepalive_max_requests = CONFIG_KEEPALIVE_MAX_REQUESTS_DEFAULT;
+	confstrct->reuseport = CONFIG_REUSEPORT_DEFAULT;
+	confstrct->compression_level = CONFIG_COMPRESSION_LEVEL_DEFAULT;
+	confstrct->compression_min_size = CONFIG_COMPRESSION_MIN_SIZE_DEFAULT;
+	confstrct->rate_limit_requests = CONFIG_RATE_LIMIT_REQUESTS_DEFAULT;
+	confstrct->rate_limit_burst = CONFIG_RATE_LIMIT_BURST_DEFAULT;
+	confstrct->rate_limit_current = CONFIG_RATE_LIMIT_CURRENT_DEFAULT;
+	confstrct->db_read_deadline = CONFIG_DB_READ_DEADLINE_DEFAULT;
+	confstrct->db_write_deadline = CONFIG_DB_WRITE_DEADLINE_DEFAULT;
+	confstrct->header_timeout = CONFIG_HEADER_TIMEOUT_DEFAULT;
+	confstrct->request_timeout = CONFIG_REQUEST_TIMEOUT_DEFAULT;
+	confstrct->unix_socket = NULL;
+	confstrct->min_worker_threads = confstrct->max_worker_threads =
+		CONFIG_WORKER_THREADS_UNSET;
+
 	int parse_flag = ini_parse(path, inih_callback, confstrct);
 	confstrct->config_count = temp_count;
 
+	/* Without explicit bounds the worker pool stays at its initial size */
+	if (confstrct->min_worker_threads == CONFIG_WORKER_THREADS_UNSET)
+		confstrct->min_worker_threads = confstrct->num_worker_threads;
+
+	if (confstrct->max_worker_threads == CONFIG_WORKER_THREADS_UNSET)
+		confstrct->max_worker_threads = confstrct->num_worker_threads;
+
 	return parse_flag;
 }
 
@@ -121,6 +237,11 @@ void free_config(rpiwd_config *confstrct) {
 	if (confstrct->query_interval)
 		free(confstrct->query_interval);
 
+	if (confstrct->unix_socket)
+		free(confstrct->unix_socket);
+
+	confstrct->unix_socket = NULL;
+
 	confstrct->comm_port = confstrct->device_config = 0;
 }
 
@@ -184,41 +305,157 @@ int config_has_errors(rpiwd_config *confstrct) {
 		fprintf(stderr, "\nconfiguration error: num_worker_threads out of bounds.");
 	}
 
+	/* Pool bounds must contain the initial size */
+	if (confstrct->min_worker_threads < 1 ||
+		confstrct->min_worker_threads > confstrct->num_worker_threads) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: min_worker_threads must be between 1 "
+				"and num_worker_threads.");
+	}
+
+	if (confstrct->max_worker_threads < confstrct->num_worker_threads ||
+		confstrct->max_worker_threads > CONFIG_NUM_WORKER_THREADS_MAX) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: max_worker_threads must be between "
+				"num_worker_threads and %d.", CONFIG_NUM_WORKER_THREADS_MAX);
+	}
+
+	/* Check keep-alive settings */
+	if (confstrct->keepalive_timeout < 0) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: keepalive_timeout is negative.");
+	}
+
+	if (confstrct->keepalive_max_requests < 1) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: keepalive_max_requests must be positive.");
+	}
+
+	/* reuseport is a boolean */
+	if (confstrct->reuseport != 0 && confstrct->reuseport != 1) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: reuseport must be 0 or 1.");
+	}
+
+	/* Check compression settings */
+	if (confstrct->compression_level < 0 ||
+		confstrct->compression_level > CONFIG_COMPRESSION_LEVEL_MAX) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: compression_level must be between 0 "
+				"and %d.", CONFIG_COMPRESSION_LEVEL_MAX);
+	}
+
+	if (confstrct->compression_min_size < 0) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: compression_min_size is negative.");
+	}
+
+	/* Check rate limits; a rate of 0 turns a limit off */
+	if (confstrct->rate_limit_requests < 0 || confstrct->rate_limit_current < 0) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: rate limits must not be negative.");
+	}
+
+	if (confstrct->rate_limit_burst < 1) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: rate_limit_burst must be positive.");
+	}
+
+	/* Check DB queue deadlines; 0 means no deadline */
+	if (confstrct->db_read_deadline < 0 || confstrct->db_write_deadline < 0) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: DB deadlines must not be negative.");
+	}
+
+	/* Check connection timeouts */
+	if (confstrct->header_timeout < 1) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: header_timeout must be positive.");
+	}
+
+	if (confstrct->request_timeout < 0) {
+		flag++;
+		fprintf(stderr, "\nconfiguration error: request_timeout is negative.");
+	}
+
 	/* Return flag */
 	return flag;
 }
 
 rpiwd_config *get_current_config(void) {
-	rpiwd_config *ret = NULL;
+	return __atomic_load_n(&__current_configuration, __ATOMIC_ACQUIRE);
+}
 
-	pthread_mutex_lock(&__mtx_config);
-		ret = &__current_configuration;
-	pthread_mutex_unlock(&__mtx_config);
+static rpiwd_config *publish_config(rpiwd_config *confstrct) {
+	rpiwd_config *previous = __current_configuration;
+
+	confstrct->previous = previous;
+	confstrct->generation = previous ? previous->generation + 1 : 0;
+	__atomic_store_n(&__current_configuration, confstrct, __ATOMIC_RELEASE);
 
-	return ret;
+	return previous;
 }
 
 int init_current_config(const char *config_path) {
+    rpiwd_config *confstrct = calloc(1, sizeof(rpiwd_config));
     int flag;
 
-    /* Lock to prevent other threads from accessing the configuration while
-     * it is being updated. */
+    if (!confstrct)
+        return -1;
+
+    /* Serialize with reloads; readers never wait */
     pthread_mutex_lock(&__mtx_config);
-        /* Parse/Re-parse configuration file */
-        flag = parse_config_file(config_path, &__current_configuration);
+        /* Parse configuration file */
+        flag = parse_config_file(config_path, confstrct);
+        publish_config(confstrct);
 
-        /* Initialize unit string with the defaults */
-        memset(__rpiwd_unitstring, 0, sizeof(char) * RPIWD_MAX_MEASUREMENTS);
-        __rpiwd_unitstring[RPIWD_MEASURE_TEMPERATURE] = RPIWD_DEFAULT_TEMP_UNIT;
-        __rpiwd_unitstring[RPIWD_MEASURE_HUMIDITY] = RPIWD_DEFAULT_HUMID_UNIT;
+        reset_unit_string();
 	pthread_mutex_unlock(&__mtx_config);
 
 	return flag;
 }
 
+int reload_current_config(const char *config_path, rpiwd_config **previous) {
+    rpiwd_config *confstrct = calloc(1, sizeof(rpiwd_config));
+    int flag;
+
+    if (!confstrct)
+        return -1;
+
+    /* A broken file leaves the running configuration alone */
+    pthread_mutex_lock(&__mtx_config);
+        flag = parse_config_file(config_path, confstrct);
+        if (flag != 0 || config_has_errors(confstrct) > 0) {
+            pthread_mutex_unlock(&__mtx_config);
+
+            free_config(confstrct);
+            free(confstrct);
+            return -1;
+        }
+
+        *previous = publish_config(confstrct);
+        reset_unit_string();
+    pthread_mutex_unlock(&__mtx_config);
+
+    return 1;
+}
+
 void free_current_config(void) {
+	rpiwd_config *ptr, *previous;
+
 	pthread_mutex_lock(&__mtx_config);
-		free_config(&__current_configuration);
+		ptr = __current_configuration;
+		__current_configuration = NULL;
+
+		/* All generations; no thread reads them anymore */
+		while (ptr) {
+			previous = ptr->previous;
+
+			free_config(ptr);
+			free(ptr);
+
+			ptr = previous;
+		}
 	pthread_mutex_unlock(&__mtx_config);
 }
 
@@ -226,3 +463,17 @@ char *get_unit_string(void) {
     /* This is read-only to all other modules, so we shouldn't lock this. */
     return __rpiwd_unitstring;
 }
+
+static void reset_unit_string(void) {
+    /* Units start out as the defaults on startup and on every reload.
+     * Written slot by slot, and never cleared in between, since readers
+     * copy the string without a lock. */
+    for (int i = 0; i < RPIWD_MAX_MEASUREMENTS; i++) {
+        if (i == RPIWD_MEASURE_TEMPERATURE)
+            __rpiwd_unitstring[i] = RPIWD_DEFAULT_TEMP_UNIT;
+        else if (i == RPIWD_MEASURE_HUMIDITY)
+            __rpiwd_unitstring[i] = RPIWD_DEFAULT_HUMID_UNIT;
+        else
+            __rpiwd_unitstring[i] = '\0';
+    }
+}
@@ -0,0 +1,215 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "connection.h"
+
+/* Allocating/freeing connections */
+rpiwd_conn *conn_alloc(int sockfd) {
+	rpiwd_conn *conn = malloc(sizeof(rpiwd_conn));
+	if (!conn)
+		return NULL;
+
+	conn->sockfd = sockfd;
+	conn->state = CONN_STATE_READING;
+	conn->is_adopted = conn->is_closed = conn->close_after_write = false;
+	conn->keep_alive = conn->accept_gzip = conn->is_admitted = false;
+	memset(&conn->peer, 0, sizeof(rpiwd_ratelimit_key));
+	conn->requests_served = 0;
+	timer_init(&conn->timer, conn);
+	conn->request_deadline_ms = 0;
+	conn->accepted_usec = rpiwd_monotonic_usec();
+	conn->inbuf[0] = '\0';
+	conn->inlen = conn->request_length = 0;
+	http_parser_init(&conn->parser);
+	conn->fetch_cursor = NULL;
+	conn->gzip_stream = NULL;
+	conn->content_type = NULL;
+	conn->etag[0] = '\0';
+	conn->if_none_match = NULL;
+	conn->if_none_match_length = 0;
+	arena_init(&conn->arena);
+	conn->ws = NULL;
+	conn->parked_request = NULL;
+	conn->outq_head = conn->outq_tail = NULL;
+	conn->outq_length = 0;
+	conn->prev = conn->next = NULL;
+
+	return conn;
+}
+
+void conn_free(rpiwd_conn *conn) {
+	conn_outbuf *ptr = conn->outq_head, *next;
+
+	/* Free any output that was never written */
+	while (ptr) {
+		next = ptr->next;
+
+		free(ptr->data);
+		free(ptr);
+
+		ptr = next;
+	}
+
+	/* A chunked response that was cut short */
+	if (conn->gzip_stream)
+		gzip_stream_close(conn->gzip_stream);
+
+	arena_destroy(&conn->arena);
+	websocket_free(conn->ws);
+	free(conn);
+}
+
+/* Socket helpers */
+int conn_set_nonblocking(int sockfd) {
+	int flags = fcntl(sockfd, F_GETFL, 0);
+	if (flags == -1)
+		return -1;
+
+	return fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Reading */
+ssize_t conn_read(rpiwd_conn *conn, int *is_eof) {
+	ssize_t flag, total = 0;
+
+	/* Sockets are edge-triggered, so read until the kernel has nothing left
+	 * or the input buffer is full. */
+	while (conn->inlen < CONN_INPUT_BUFFER_SIZE) {
+		flag = read(conn->sockfd, conn->inbuf + conn->inlen,
+				CONN_INPUT_BUFFER_SIZE - conn->inlen);
+		if (flag == -1) {
+			if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+
+			return -1;
+		}
+		else if (flag == 0) { /* Socket EOF */
+			*is_eof = 1;
+			break;
+		}
+
+		conn->inlen += flag;
+		total += flag;
+	}
+
+	/* Keep the buffer NUL-terminated for the parser */
+	conn->inbuf[conn->inlen] = '\0';
+
+	return total;
+}
+
+void conn_consume_input(rpiwd_conn *conn, size_t length) {
+	if (length > conn->inlen)
+		length = conn->inlen;
+
+	/* Move whatever follows (e.g. a pipelined request) to the front */
+	memmove(conn->inbuf, conn->inbuf + length, conn->inlen - length);
+	conn->inlen -= length;
+	conn->inbuf[conn->inlen] = '\0';
+
+	/* The next request is parsed from scratch and pays for itself */
+	http_parser_init(&conn->parser);
+	conn->is_admitted = false;
+	conn->content_type = NULL;
+	conn->etag[0] = '\0';
+	conn->if_none_match = NULL;
+	conn->if_none_match_length = 0;
+	arena_reset(&conn->arena);
+}
+
+/* Writing */
+int conn_queue_output(rpiwd_conn *conn, char *data, size_t length) {
+	conn_outbuf *buf = malloc(sizeof(conn_outbuf));
+	if (!buf) {
+		free(data);
+		return -1;
+	}
+
+	buf->data = data;
+	buf->length = length;
+	buf->offset = 0;
+	buf->next = NULL;
+
+	/* Append to output queue */
+	if (conn->outq_tail)
+		conn->outq_tail->next = buf;
+	else
+		conn->outq_head = buf;
+
+	conn->outq_tail = buf;
+	conn->outq_length += length;
+
+	return 1;
+}
+
+int conn_flush(rpiwd_conn *conn) {
+	struct iovec iov[CONN_FLUSH_MAX_IOV];
+	struct msghdr msg;
+	conn_outbuf *buf;
+	ssize_t flag;
+	size_t written;
+	int count;
+
+	while (conn->outq_head) {
+		/* Gather as many pending chunks as fit into one call */
+		count = 0;
+		for (buf = conn->outq_head; buf && count < CONN_FLUSH_MAX_IOV; buf = buf->next) {
+			iov[count].iov_base = buf->data + buf->offset;
+			iov[count++].iov_len = buf->length - buf->offset;
+		}
+
+		/* sendmsg() is writev() with flags; no SIGPIPE for closed peers */
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		flag = sendmsg(conn->sockfd, &msg, MSG_NOSIGNAL);
+		if (flag == -1) {
+			if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return CONN_FLUSH_PENDING; /* Wait for EPOLLOUT */
+
+			return CONN_FLUSH_ERROR;
+		}
+
+		/* Retire fully written chunks. A short write leaves the rest of the
+		 * current chunk queued, and the loop tries again until the kernel
+		 * pushes back. */
+		written = flag;
+		conn->outq_length -= written;
+		while ((buf = conn->outq_head) && written >= buf->length - buf->offset) {
+			written -= buf->length - buf->offset;
+			conn->outq_head = buf->next;
+			if (!conn->outq_head)
+				conn->outq_tail = NULL;
+
+			free(buf->data);
+			free(buf);
+		}
+
+		if (buf)
+			buf->offset += written;
+	}
+
+	return CONN_FLUSH_DONE;
+}
+
+bool conn_has_pending_output(rpiwd_conn *conn) {
+	return conn->outq_head != NULL;
+}
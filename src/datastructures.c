@@ -16,6 +16,93 @@
 
 #include "datastructures.h"
 
+/* String buffers */
+int strbuf_init(strbuf *buf, size_t capacity) {
+	buf->data = malloc(capacity);
+	if (!buf->data)
+		return -1;
+
+	buf->data[0] = '\0';
+	buf->length = 0;
+	buf->capacity = capacity;
+
+	return 1;
+}
+
+void strbuf_free(strbuf *buf) {
+	free(buf->data);
+	buf->data = NULL;
+	buf->length = buf->capacity = 0;
+}
+
+char *strbuf_release(strbuf *buf) {
+	char *data = buf->data;
+
+	/* The caller owns the string now */
+	buf->data = NULL;
+	buf->length = buf->capacity = 0;
+
+	return data;
+}
+
+static int strbuf_reserve(strbuf *buf, size_t length) {
+	size_t capacity = buf->capacity ? buf->capacity : STRBUF_DEFAULT_CAPACITY;
+	char *data;
+
+	/* Keep room for the terminating NUL */
+	if (buf->length + length < buf->capacity)
+		return 1;
+
+	while (capacity <= buf->length + length)
+		capacity *= 2;
+
+	data = realloc(buf->data, capacity);
+	if (!data)
+		return -1;
+
+	buf->data = data;
+	buf->capacity = capacity;
+
+	return 1;
+}
+
+int strbuf_append(strbuf *buf, const char *str, size_t length) {
+	if (strbuf_reserve(buf, length) == -1)
+		return -1;
+
+	memcpy(buf->data + buf->length, str, length);
+	buf->length += length;
+	buf->data[buf->length] = '\0';
+
+	return 1;
+}
+
+int strbuf_appendf(strbuf *buf, const char *format, ...) {
+	va_list args;
+	int length;
+
+	/* Try with what is left; grow and retry if that was not enough */
+	va_start(args, format);
+	length = vsnprintf(buf->data + buf->length, buf->capacity - buf->length, format, args);
+	va_end(args);
+
+	if (length < 0)
+		return -1;
+
+	if (buf->length + length >= buf->capacity) {
+		if (strbuf_reserve(buf, length) == -1)
+			return -1;
+
+		va_start(args, format);
+		vsnprintf(buf->data + buf->length, buf->capacity - buf->length, format, args);
+		va_end(args);
+	}
+
+	buf->length += length;
+
+	return 1;
+}
+
 /* Allocating/freeing entry lists */
 entry *entry_alloc(void) {
 	entry *ptr = malloc(sizeof(entry));
@@ -121,6 +208,7 @@ void key_value_list_free(key_value_list *list) {
 		key_value_pair_free(&(list->pairs[i]));
 
 	/* Free the list */
+	free(list->pairs);
 	free(list);
 }
 
@@ -272,6 +360,24 @@ JSON_Value *key_value_list_to_json_value(key_value_list **list) {
 	return rootval;
 }
 
+char *json_serialize_to_heap(const JSON_Value *value) {
+	/* Unlike json_serialize_to_string(), the string always comes from
+	 * malloc(), whatever parson is set up to allocate with */
+	size_t size = json_serialization_size(value);
+	char *buf;
+
+	if (size == 0)
+		return NULL;
+
+	buf = malloc(size);
+	if (buf && json_serialize_to_buffer(value, buf, size) != JSONSuccess) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
 
 void append_units(JSON_Object *jobj, char *unitstr) {
     /* Quickly convert the unit characters to a string */
@@ -284,3 +390,331 @@ void append_units(JSON_Object *jobj, char *unitstr) {
     json_object_dotset_string(jobj, "units.tempunit", unitbuffer);
     json_object_dotset_string(jobj, "units.humidunit", unitbuffer + 2);
 }
+
+int entrylist_json_stream_begin(strbuf *buf, char *unitstr) {
+	/* Same order as entrylist_to_json_value(), minus "length" */
+	return strbuf_appendf(buf, "{\"units\":{\"tempunit\":\"%c\",\"humidunit\":\"%c\"},"
+			"\"errcode\":0,\"errmsg\":\"\",\"results\":{",
+			unitstr[RPIWD_MEASURE_TEMPERATURE], RPIWD_DEFAULT_HUMID_UNIT);
+}
+
+int entry_json_stream_append(strbuf *buf, const entry *ent, bool is_first) {
+	int flag = strbuf_appendf(buf, "%s\"%d\":{\"id\":%d,\"record_date\":",
+			is_first ? "" : ",", ent->id, ent->id);
+
+	flag = flag == -1 ? -1 : strbuf_append_json_string(buf, ent->record_date);
+	flag = flag == -1 ? -1 : strbuf_append(buf, ",\"temperature\":", 15);
+	flag = flag == -1 ? -1 : strbuf_append_json_number(buf, ent->temperature);
+	flag = flag == -1 ? -1 : strbuf_append(buf, ",\"humidity\":", 12);
+	flag = flag == -1 ? -1 : strbuf_append_json_number(buf, ent->humidity);
+	flag = flag == -1 ? -1 : strbuf_append(buf, ",\"location\":", 12);
+	flag = flag == -1 ? -1 : strbuf_append_json_string(buf, ent->location);
+	flag = flag == -1 ? -1 : strbuf_append(buf, ",\"device_name\":", 15);
+	flag = flag == -1 ? -1 : strbuf_append_json_string(buf, ent->device_name);
+	flag = flag == -1 ? -1 : strbuf_append(buf, "}", 1);
+
+	return flag;
+}
+
+int entrylist_json_stream_end(strbuf *buf, size_t length) {
+	return strbuf_appendf(buf, "},\"length\":%zu}", length);
+}
+
+int strbuf_append_json_string(strbuf *buf, const char *str) {
+	const char *start = str;
+	char escaped[8];
+
+	if (strbuf_append(buf, "\"", 1) == -1)
+		return -1;
+
+	/* Escape the way parson does, so both paths produce the same text */
+	for (; *str; str++) {
+		unsigned char c = (unsigned char)*str;
+
+		if (c >= 0x20 && c != '"' && c != '\\' && c != '/')
+			continue;
+
+		if (strbuf_append(buf, start, str - start) == -1)
+			return -1;
+
+		switch (c) {
+			case '"': strcpy(escaped, "\\\""); break;
+			case '\\': strcpy(escaped, "\\\\"); break;
+			case '/': strcpy(escaped, "\\/"); break;
+			case '\b': strcpy(escaped, "\\b"); break;
+			case '\f': strcpy(escaped, "\\f"); break;
+			case '\n': strcpy(escaped, "\\n"); break;
+			case '\r': strcpy(escaped, "\\r"); break;
+			case '\t': strcpy(escaped, "\\t"); break;
+			default: sprintf(escaped, "\\u%04x", c); break;
+		}
+
+		if (strbuf_append(buf, escaped, strlen(escaped)) == -1)
+			return -1;
+
+		start = str + 1;
+	}
+
+	if (strbuf_append(buf, start, str - start) == -1)
+		return -1;
+
+	return strbuf_append(buf, "\"", 1);
+}
+
+int strbuf_append_json_number(strbuf *buf, double num) {
+	/* Same formats as parson */
+	if (num == (double)(int)num)
+		return strbuf_appendf(buf, "%d", (int)num);
+
+	return strbuf_appendf(buf, "%f", num);
+}
+
+/* CBOR */
+int entry_to_cbor(strbuf *buf, const entry *ent, char *unitstr) {
+	int flag;
+
+	/* Same keys as entry_to_json_value() */
+	flag = strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 6);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 1);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_units(buf, unitstr);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "id");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, ent->id);
+	flag = flag == -1 ? -1 : entry_cbor_stream_append(buf, ent);
+
+	return flag;
+}
+
+int entrylist_to_cbor(strbuf *buf, const entrylist *list, char *unitstr) {
+	int flag;
+
+	/* Same keys as entrylist_to_json_value() */
+	flag = strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 5);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, list->size);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_units(buf, unitstr);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "results");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, list->size);
+
+	for (size_t i = 0; flag != -1 && i < list->size; i++)
+		flag = entry_cbor_stream_append(buf, &list->entries[i]);
+
+	return flag;
+}
+
+int key_value_list_to_cbor(strbuf *buf, const key_value_list *list) {
+	int flag;
+
+	/* Same keys as key_value_list_to_json_value(); values stay strings */
+	flag = strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 4);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, list->length);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "results");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, list->length);
+
+	for (size_t i = 0; flag != -1 && i < list->length; i++) {
+		flag = strbuf_append_cbor_string(buf, list->pairs[i].key);
+		flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, list->pairs[i].value);
+	}
+
+	return flag;
+}
+
+int entrylist_cbor_stream_begin(strbuf *buf, char *unitstr) {
+	int flag;
+
+	/* Maps of unknown length; "length" comes last, like in the JSON stream */
+	flag = strbuf_append_cbor_byte(buf, CBOR_INDEFINITE_MAP);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_units(buf, unitstr);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "results");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_byte(buf, CBOR_INDEFINITE_MAP);
+
+	return flag;
+}
+
+int entry_cbor_stream_append(strbuf *buf, const entry *ent) {
+	/* The ID is the key, as a number rather than a string of one */
+	int flag = strbuf_append_cbor_int(buf, ent->id);
+
+	flag = flag == -1 ? -1 : strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 6);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "id");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, ent->id);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "record_date");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, ent->record_date);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "temperature");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_float(buf, ent->temperature);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "humidity");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_float(buf, ent->humidity);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "location");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, ent->location);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "device_name");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, ent->device_name);
+
+	return flag;
+}
+
+int entrylist_cbor_stream_end(strbuf *buf, size_t length) {
+	int flag = strbuf_append_cbor_byte(buf, CBOR_BREAK);
+
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, length);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_byte(buf, CBOR_BREAK);
+
+	return flag;
+}
+
+int strbuf_append_cbor_units(strbuf *buf, char *unitstr) {
+	char unitbuffer[4];
+	int flag;
+
+	/* Same as append_units() */
+	unitbuffer[0] = unitstr[RPIWD_MEASURE_TEMPERATURE];
+	unitbuffer[1] = unitbuffer[3] = '\0';
+	unitbuffer[2] = RPIWD_DEFAULT_HUMID_UNIT;
+
+	flag = strbuf_append_cbor_string(buf, "units");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 2);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "tempunit");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, unitbuffer);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "humidunit");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, unitbuffer + 2);
+
+	return flag;
+}
+
+int strbuf_append_cbor_head(strbuf *buf, int major, uint64_t value) {
+	char head[9];
+	size_t length;
+
+	/* Major type in the top 3 bits; small values fit into the rest,
+	 * larger ones follow in 1, 2, 4 or 8 bytes, big-endian */
+	if (value < 24) {
+		head[0] = (char)(major << 5 | value);
+		length = 1;
+	}
+	else if (value <= UINT8_MAX) {
+		head[0] = (char)(major << 5 | 24);
+		length = 2;
+	}
+	else if (value <= UINT16_MAX) {
+		head[0] = (char)(major << 5 | 25);
+		length = 3;
+	}
+	else if (value <= UINT32_MAX) {
+		head[0] = (char)(major << 5 | 26);
+		length = 5;
+	}
+	else {
+		head[0] = (char)(major << 5 | 27);
+		length = 9;
+	}
+
+	for (size_t i = length - 1; i > 0; i--, value >>= 8)
+		head[i] = (char)(value & 0xff);
+
+	return strbuf_append(buf, head, length);
+}
+
+int strbuf_append_cbor_byte(strbuf *buf, unsigned char byte) {
+	/* Markers that are a head of their own */
+	return strbuf_append(buf, (const char *)&byte, 1);
+}
+
+int strbuf_append_cbor_int(strbuf *buf, int64_t num) {
+	/* Negative numbers are stored as -1 - n */
+	if (num < 0)
+		return strbuf_append_cbor_head(buf, CBOR_MAJOR_NEGATIVE, (uint64_t)(-1 - num));
+
+	return strbuf_append_cbor_head(buf, CBOR_MAJOR_UNSIGNED, (uint64_t)num);
+}
+
+int strbuf_append_cbor_string(strbuf *buf, const char *str) {
+	size_t length;
+
+	/* parson leaves NULL strings out; there is no leaving out here */
+	if (!str)
+		return strbuf_append_cbor_byte(buf, CBOR_NULL);
+
+	length = strlen(str);
+	if (strbuf_append_cbor_head(buf, CBOR_MAJOR_TEXT, length) == -1)
+		return -1;
+
+	return strbuf_append(buf, str, length);
+}
+
+int strbuf_append_cbor_float(strbuf *buf, float num) {
+	char value[5];
+	uint32_t bits;
+
+	/* Readings are floats to begin with, so single precision loses nothing */
+	memcpy(&bits, &num, sizeof(bits));
+
+	value[0] = (char)CBOR_FLOAT32;
+	for (int i = 4; i > 0; i--, bits >>= 8)
+		value[i] = (char)(bits & 0xff);
+
+	return strbuf_append(buf, value, sizeof(value));
+}
+
+/* CSV */
+int entrylist_csv_stream_begin(strbuf *buf, char *unitstr) {
+	/* Units go into the header, since every value is a bare number */
+	return strbuf_appendf(buf, "id,record_date,temperature_%c,humidity_%s,location,device_name\r\n",
+			unitstr[RPIWD_MEASURE_TEMPERATURE], CSV_HUMIDITY_UNIT_NAME);
+}
+
+int entry_csv_stream_append(strbuf *buf, const entry *ent) {
+	int flag = strbuf_appendf(buf, "%d,%s,%g,%g,", ent->id,
+			ent->record_date ? ent->record_date : "", ent->temperature, ent->humidity);
+
+	flag = flag == -1 ? -1 : strbuf_append_csv_string(buf, ent->location);
+	flag = flag == -1 ? -1 : strbuf_append(buf, ",", 1);
+	flag = flag == -1 ? -1 : strbuf_append_csv_string(buf, ent->device_name);
+	flag = flag == -1 ? -1 : strbuf_append(buf, "\r\n", 2);
+
+	return flag;
+}
+
+int strbuf_append_csv_string(strbuf *buf, const char *str) {
+	const char *quote;
+
+	if (!str)
+		return 1;
+
+	/* Fields are only quoted when they have to be (RFC 4180) */
+	if (!strpbrk(str, ",\"\r\n"))
+		return strbuf_append(buf, str, strlen(str));
+
+	if (strbuf_append(buf, "\"", 1) == -1)
+		return -1;
+
+	/* Quotes inside are doubled */
+	while ((quote = strchr(str, '"')) != NULL) {
+		if (strbuf_append(buf, str, quote - str + 1) == -1 ||
+			strbuf_append(buf, "\"", 1) == -1)
+			return -1;
+
+		str = quote + 1;
+	}
+
+	if (strbuf_append(buf, str, strlen(str)) == -1)
+		return -1;
+
+	return strbuf_append(buf, "\"", 1);
+}
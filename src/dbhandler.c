@@ -18,10 +18,15 @@
 
 static sqlite3 *db;
 static pthread_t __db_thread_pid;
+static rpiwd_msgring __db_queue;             /* Reads */
+static rpiwd_msgring __db_priority_queue;    /* Writes and open cursors */
+static uint64_t __shed_reads, __shed_writes;
+static uint64_t __data_version;               /* Newest row ID */
+static time_t __data_time;                    /* And when it was written */
+static dbhandler_write_hook __write_hook;
 
 int init_dbhandler(void) {
 	int result = 0;
-    struct mq_attr attr;
     const char **sqlcmd = SQLCMD_TABLE_CREATION_QUERIES;
 
 	/* Open the database, or create it. */
@@ -50,13 +55,21 @@ int init_dbhandler(void) {
 		return -1;
 	}
 
-	/* Initialize message queue */
-	attr.mq_flags = attr.mq_curmsgs = 0;
-	attr.mq_maxmsg = MQ_MAXMESSAGES;
-	attr.mq_msgsize = MQ_MAXMSGSIZE;
-	__db_mqd = mq_open(RPIWD_DB_MQ_NAME, O_CREAT | O_RDWR, 0666, &attr);
-	if (__db_mqd == (mqd_t) -1) {
-        rpiwd_log(LOG_ERR, "error: mq_open: %s", strerror(errno));
+	__data_version = exec_formatted_count_query(SQLCMD_MAX_ROW_ID);
+	__data_time = exec_formatted_count_query(SQLCMD_MAX_ROW_TIME);
+
+	/* Initialize message queues. The DB thread polls both eventfds when idle. */
+	if (rpiwd_msgring_init(&__db_queue, DBHANDLER_QUEUE_CAPACITY, true) == -1) {
+        rpiwd_log(LOG_ERR, "error creating DB queue: %s", strerror(errno));
+		sqlite3_close(db);
+		return -1;
+	}
+
+	if (rpiwd_msgring_init(&__db_priority_queue, DBHANDLER_PRIORITY_QUEUE_CAPACITY,
+				true) == -1) {
+        rpiwd_log(LOG_ERR, "error creating DB queue: %s", strerror(errno));
+		rpiwd_msgring_destroy(&__db_queue);
+		sqlite3_close(db);
 		return -1;
 	}
 
@@ -75,16 +88,15 @@ void quit_dbhandler(void) {
 	pthread_join(__db_thread_pid, NULL);
 }
 
-void quit_db_mq(void) {
-	/* Close message queue */
-	mq_close(__db_mqd);
-	mq_unlink(RPIWD_DB_MQ_NAME);
+void quit_db_queue(void) {
+	/* Must only be called once nobody sends to the DB thread anymore */
+	rpiwd_msgring_destroy(&__db_queue);
+	rpiwd_msgring_destroy(&__db_priority_queue);
 }
 
 /* DB Thread event loop */
 void *db_thread_event_loop(void *unused) {
 	int old;
-	ssize_t res;
     rpiwd_mqmsg msg_buffer;
     bool keep_native_unit;
 
@@ -94,15 +106,26 @@ void *db_thread_event_loop(void *unused) {
 	pthread_cleanup_push(db_thread_cleanup_routine, NULL);
 
 	/* Recieve messages (NOTE: Cancellation point for thread here) */
-	while ((res = mq_receive(__db_mqd, (char *)&msg_buffer, MQ_MAXMSGSIZE, NULL)) != -1) {
+	for (;;) {
+		if (!db_thread_next_message(&msg_buffer))
+			break;
+
+		/* A read that waited past its deadline is not worth running; its
+		 * client has probably given up. The worker tells it to retry. */
+		if (is_read_request(msg_buffer.mtype) && msg_buffer.deadline_usec &&
+			rpiwd_monotonic_usec() > msg_buffer.deadline_usec) {
+			msg_buffer.retcode = DBHANDLER_ERROR_OVERLOADED;
+			__atomic_add_fetch(&__shed_reads, 1, __ATOMIC_RELAXED);
+		}
 		/* Get message type. This is the requested command. */
-		if (msg_buffer.mtype == DB_MSGTYPE_WRITEENTRY) {
+		else if (msg_buffer.mtype == DB_MSGTYPE_WRITEENTRY) {
 			entry *ent = (entry *)msg_buffer.data;
+			dbhandler_write_hook hook;
 
-			write_raw_entry(ent->temperature, 
-					ent->humidity, 
-					ent->location, 
-					ent->device_name);
+			/* Whoever listens hears of the sample once it can be fetched */
+			if (write_raw_entry(ent) == 1 &&
+				(hook = __atomic_load_n(&__write_hook, __ATOMIC_ACQUIRE)) != NULL)
+				hook(ent);
 
 			entry_ptr_free(ent);
 
@@ -112,58 +135,97 @@ void *db_thread_event_loop(void *unused) {
 			/* No need to send anything anywhere so continue here... */
 			continue;
 		}
-        else if (msg_buffer.mtype == DB_MSGTYPE_FETCH) {
-            /* Check if a conversion is required */
+        else if (msg_buffer.mtype == DB_MSGTYPE_FETCH || msg_buffer.mtype == DB_MSGTYPE_STATS)
+			exec_read_request(&msg_buffer);
+		else if (msg_buffer.mtype == DB_MSGTYPE_BATCH) {
+			rpiwd_mqmsg_batch *batch = (rpiwd_mqmsg_batch *)msg_buffer.data;
+
+			/* All parts in this one visit. Parts the worker could not even
+			 * start already carry their error. */
+			for (size_t i = 0; i < batch->length; i++) {
+				if (batch->parts[i].retcode == DBHANDLER_ERROR_SUCCESS &&
+					(batch->parts[i].mtype == DB_MSGTYPE_FETCH ||
+					 batch->parts[i].mtype == DB_MSGTYPE_STATS))
+					exec_read_request(&batch->parts[i]);
+			}
+		}
+		else if (msg_buffer.mtype == DB_MSGTYPE_FETCH_STREAM) {
             keep_native_unit = msg_buffer.unitstr[RPIWD_MEASURE_TEMPERATURE] ==
                                RPIWD_TEMPERATURE_CELSIUS;
-			/* Execute query */
-            msg_buffer.data = exec_fetch_query(msg_buffer.fcountq,
-                    msg_buffer.fselectq,
-                    keep_native_unit,
-                    &msg_buffer.retcode);
 
-			/* Update statistics */
-			increase_stat(STAT_NAME_TOTAL_REQUESTS);
-		}
-		else if (msg_buffer.mtype == DB_MSGTYPE_STATS) {
-			/* Execute query */
-			key_value_list *listptr = exec_key_value_query(msg_buffer.fcountq,
-					msg_buffer.fselectq, &msg_buffer.retcode);
-
-			/* Add items to existing list in msg_buffer.data and free this list */
-			for (int i = 0; i < listptr->length; i++)
-				key_value_list_emplace((key_value_list *)msg_buffer.data,
-						listptr->pairs[i].key, listptr->pairs[i].value);
-
-			key_value_list_free(listptr);
+			/* No count query and no entry limit; only one batch is in memory
+			 * at a time, and the worker asks for the next one when the
+			 * client has taken this one. */
+			msg_buffer.cursor = open_fetch_cursor(msg_buffer.fselectq,
+					keep_native_unit, msg_buffer.unitstr, msg_buffer.format,
+					&msg_buffer.retcode);
+			if (msg_buffer.cursor)
+				next_fetch_batch(&msg_buffer);
 
 			/* Update statistics */
 			increase_stat(STAT_NAME_TOTAL_REQUESTS);
 		}
+		else if (msg_buffer.mtype == DB_MSGTYPE_FETCH_NEXT)
+			next_fetch_batch(&msg_buffer);
+		else if (msg_buffer.mtype == DB_MSGTYPE_FETCH_CANCEL) {
+			close_fetch_cursor((db_fetch_cursor *)msg_buffer.cursor);
+			continue;
+		}
 
 		/* Mark as complete and send back to reciever message queue */
 		msg_buffer.is_completed = 1;
-		mq_send(msg_buffer.receiver_mq, (const char *)&msg_buffer, 
-				sizeof(rpiwd_mqmsg), 0);
+		rpiwd_msgring_send(msg_buffer.receiver, &msg_buffer);
 	}
 
 	/* Cleanup */
 	pthread_cleanup_pop(0);
 }
 
+static bool db_thread_next_message(rpiwd_mqmsg *msg) {
+	struct pollfd pfds[2];
+
+	pfds[0].fd = __db_priority_queue.eventfd;
+	pfds[1].fd = __db_queue.eventfd;
+	pfds[0].events = pfds[1].events = POLLIN;
+
+	for (;;) {
+		/* Writes and cursors go first; reads only when nothing else waits */
+		if (rpiwd_msgring_try_pop(&__db_priority_queue, msg) ||
+			rpiwd_msgring_try_pop(&__db_queue, msg))
+			return true;
+
+		/* Sleep until either queue is notified */
+		if (poll(pfds, 2, -1) == -1 && errno != EINTR)
+			return false;
+
+		/* Reset both; they are drained before sleeping again */
+		rpiwd_msgring_wait(&__db_priority_queue);
+		rpiwd_msgring_wait(&__db_queue);
+	}
+}
+
 void db_thread_cleanup_routine(void *arg) {
-	/* Close and unlink MQ */
-	quit_db_mq();
+	sqlite3_stmt *query;
+
+	/* Streamed fetches that were not finished still hold statements */
+	while ((query = sqlite3_next_stmt(db, NULL)) != NULL)
+		sqlite3_finalize(query);
 
-	/* Close DB connection */
+	/* Close DB connection. The queue outlives the thread, since workers may
+	 * still be sending to it; see quit_db_queue(). */
 	sqlite3_close(db);
 }
 
-void request_write_entry(float temp, float humid, const char *location,
+int request_write_entry(float temp, float humid, const char *location,
 		const char *device) {
-	/* Build message buffer */
+	struct timespec tms = { .tv_sec = 0,
+		.tv_nsec = DBHANDLER_WRITE_RETRY_INTERVAL * 1000000L };
+	int deadline = get_current_config()->db_write_deadline;
+	uint64_t expires = rpiwd_monotonic_usec() + (uint64_t)deadline * 1000;
 	rpiwd_mqmsg msgbuff;
 
+	/* Build message buffer */
+	rpiwd_mqmsg_init(&msgbuff);
 	msgbuff.mtype = DB_MSGTYPE_WRITEENTRY;
 	msgbuff.sockfd = DB_MSG_NO_SOCKFD;
 	msgbuff.data = entry_alloc();
@@ -172,22 +234,137 @@ void request_write_entry(float temp, float humid, const char *location,
 	((entry *)msgbuff.data)->location = strdup(location);
 	((entry *)msgbuff.data)->device_name = strdup(device);
 
-	/* Send message */
-	mq_send(__db_mqd, (const char *)&msgbuff, sizeof(rpiwd_mqmsg), 0);
+	/* Writes only share their queue with cursor batches, so a slot frees up
+	 * quickly unless the DB thread is stuck. In that case, drop the sample
+	 * rather than stall the sampling loop. */
+	while (!rpiwd_msgring_try_push(&__db_priority_queue, &msgbuff)) {
+		if (deadline > 0 && rpiwd_monotonic_usec() >= expires) {
+			__atomic_add_fetch(&__shed_writes, 1, __ATOMIC_RELAXED);
+			rpiwd_log(LOG_WARNING, "DB queue is full; dropping a sample.");
+
+			entry_ptr_free((entry *)msgbuff.data);
+			return -1;
+		}
+
+		nanosleep(&tms, NULL);
+	}
+
+	rpiwd_msgring_notify(&__db_priority_queue);
+	return 1;
+}
+
+bool request_cancel_fetch(void *cursor) {
+	rpiwd_mqmsg msgbuff;
+
+	rpiwd_mqmsg_init(&msgbuff);
+	msgbuff.mtype = DB_MSGTYPE_FETCH_CANCEL;
+	msgbuff.sockfd = DB_MSG_NO_SOCKFD;
+	msgbuff.cursor = cursor;
+
+	/* Don't wait for room; this is also called while shutting down, when the
+	 * DB thread may be gone. Its cleanup finalizes whatever is left. Until
+	 * then, the cursor's statement holds a read lock, so a cancel that did
+	 * not fit must be sent again (see worker_send_cancels()). */
+	if (!rpiwd_msgring_try_push(&__db_priority_queue, &msgbuff))
+		return false;
+
+	rpiwd_msgring_notify(&__db_priority_queue);
+	return true;
+}
+
+void dbhandler_set_write_hook(dbhandler_write_hook hook) {
+	__atomic_store_n(&__write_hook, hook, __ATOMIC_RELEASE);
+}
+
+bool dbhandler_try_send(rpiwd_mqmsg *msg) {
+	int deadline = get_current_config()->db_read_deadline;
+	rpiwd_msgring *queue = is_read_request(msg->mtype) ? &__db_queue :
+		&__db_priority_queue;
+
+	if (queue == &__db_queue && deadline > 0)
+		msg->deadline_usec = rpiwd_monotonic_usec() + (uint64_t)deadline * 1000;
+
+	/* Never wait for room; a full queue is answered right away */
+	if (!rpiwd_msgring_try_push(queue, msg)) {
+		__atomic_add_fetch(&__shed_reads, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	rpiwd_msgring_notify(queue);
+	return true;
 }
 
-static int write_raw_entry(float temp, float humid, const char *location, const char *device) {
+/* Load shedding */
+uint64_t dbhandler_data_version(void) {
+	return __atomic_load_n(&__data_version, __ATOMIC_ACQUIRE);
+}
+
+time_t dbhandler_data_time(void) {
+	return __atomic_load_n(&__data_time, __ATOMIC_ACQUIRE);
+}
+
+uint64_t dbhandler_shed_reads(void) {
+	return __atomic_load_n(&__shed_reads, __ATOMIC_RELAXED);
+}
+
+uint64_t dbhandler_shed_writes(void) {
+	return __atomic_load_n(&__shed_writes, __ATOMIC_RELAXED);
+}
+
+static bool is_read_request(int mtype) {
+	return mtype == DB_MSGTYPE_FETCH || mtype == DB_MSGTYPE_FETCH_STREAM ||
+		mtype == DB_MSGTYPE_STATS || mtype == DB_MSGTYPE_BATCH;
+}
+
+static void exec_read_request(rpiwd_mqmsg *msg) {
+	key_value_list *listptr;
+    bool keep_native_unit;
+
+	if (msg->mtype == DB_MSGTYPE_FETCH) {
+        /* Check if a conversion is required */
+        keep_native_unit = msg->unitstr[RPIWD_MEASURE_TEMPERATURE] ==
+                           RPIWD_TEMPERATURE_CELSIUS;
+
+		/* Execute query */
+        msg->data = exec_fetch_query(msg->fcountq, msg->fselectq, keep_native_unit,
+                msg->arena, &msg->retcode);
+	}
+	else {
+		/* Execute query */
+		listptr = exec_key_value_query(msg->fcountq, msg->fselectq, &msg->retcode);
+
+		/* Add items to existing list in msg->data and free this list */
+		for (int i = 0; i < listptr->length; i++)
+			key_value_list_emplace((key_value_list *)msg->data,
+					listptr->pairs[i].key, listptr->pairs[i].value);
+
+		key_value_list_free(listptr);
+	}
+
+	/* Update statistics */
+	increase_stat(STAT_NAME_TOTAL_REQUESTS);
+}
+
+static int write_raw_entry(entry *ent) {
+	char date_buffer[DATE_BUFFER_SIZE];
 	sqlite3_stmt *query;
+	struct tm tm;
+	time_t now;
 	int rc;
 
+	/* Date the row here rather than in SQL, so the entry carries it too */
+	now = time(NULL);
+	strftime(date_buffer, sizeof(date_buffer), DB_RECORD_DATE_FORMAT, gmtime_r(&now, &tm));
+
 	/* Prepare query */
     rc = sqlite3_prepare_v2(db, SQLCMD_WRITE_ENTRY, -1, &query, 0);
 	if (rc == SQLITE_OK) {
 		/* Bind parameters */
-		sqlite3_bind_double(query, 1, temp);
-		sqlite3_bind_double(query, 2, humid);
-		sqlite3_bind_text(query, 3, location, -1, SQLITE_STATIC);
-		sqlite3_bind_text(query, 4, device, -1, SQLITE_STATIC);
+		sqlite3_bind_text(query, 1, date_buffer, -1, SQLITE_STATIC);
+		sqlite3_bind_double(query, 2, ent->temperature);
+		sqlite3_bind_double(query, 3, ent->humidity);
+		sqlite3_bind_text(query, 4, ent->location, -1, SQLITE_STATIC);
+		sqlite3_bind_text(query, 5, ent->device_name, -1, SQLITE_STATIC);
 	}
 	else {
 		/* Log error */
@@ -202,13 +379,20 @@ static int write_raw_entry(float temp, float humid, const char *location, const
 		return -1;
 	}
 
+	ent->id = (int)sqlite3_last_insert_rowid(db);
+	ent->record_date = strdup(date_buffer);
+
+	/* Cached responses of fetch requests are stale from now on */
+	__atomic_store_n(&__data_time, now, __ATOMIC_RELEASE);
+	__atomic_store_n(&__data_version, (uint64_t)ent->id, __ATOMIC_RELEASE);
+
 	sqlite3_finalize(query);
 	return 1;
 }
 
 static void increase_stat(const char *stat_name) {
 	/* Get formatted query */
-	char *fquery = format_query(SQLCMD_INCREASE_STAT, stat_name);
+	char *fquery = format_query(NULL, SQLCMD_INCREASE_STAT, stat_name);
 
 	/* Execute query */
 	sqlite3_exec(db, fquery, NULL, NULL, NULL);
@@ -217,21 +401,27 @@ static void increase_stat(const char *stat_name) {
 	free(fquery);
 }
 
-char *format_query(const char *format, ...) {
+char *format_query(rpiwd_arena *arena, const char *format, ...) {
 	va_list args;
+	char *qString;
 
-	char *qString = calloc(SQL_COMMAND_BUFFER_SIZE, sizeof(char));
-	if (qString) {
+	/* Queries of a request live as long as the request does */
+	if (arena) {
 		va_start(args, format);
-		vsnprintf(qString, SQL_COMMAND_BUFFER_SIZE * sizeof(char), format, args);
+		qString = arena_vprintf(arena, format, args);
 		va_end(args);
 
 		return qString;
 	}
-	else {
+
+	qString = calloc(SQL_COMMAND_BUFFER_SIZE, sizeof(char));
+	if (qString) {
+		va_start(args, format);
+		vsnprintf(qString, SQL_COMMAND_BUFFER_SIZE * sizeof(char), format, args);
 		va_end(args);
-		return NULL;
 	}
+
+	return qString;
 }
 
 size_t exec_formatted_count_query(const char *count_query) {
@@ -266,7 +456,7 @@ size_t exec_formatted_count_query(const char *count_query) {
 }
 
 entrylist *exec_fetch_query(const char *fcountq, const char *fselectq,
-                            bool keep_native_unit, int *errcode) {
+                            bool keep_native_unit, rpiwd_arena *arena, int *errcode) {
 	size_t count = exec_formatted_count_query(fcountq);
     entrylist *list;
 	sqlite3_stmt *query;
@@ -278,8 +468,9 @@ entrylist *exec_fetch_query(const char *fcountq, const char *fselectq,
         return NULL;
     }
 
-    /* Allocate list */
-    list = entrylist_alloc(count);
+    /* Allocate list. With an arena, the list and its strings are gone when
+     * the request is; otherwise, they are the caller's to free. */
+    list = arena ? exec_fetch_arena_entrylist(arena, count) : entrylist_alloc(count);
 
 	/* Check list allocation */
 	if (!list)
@@ -292,10 +483,13 @@ entrylist *exec_fetch_query(const char *fcountq, const char *fselectq,
 		while ((rc = sqlite3_step(query)) == SQLITE_ROW) {
 			/* Initialize entry */
 			list->entries[i].id = sqlite3_column_int(query, 0);
-			list->entries[i].record_date = strdup(sqlite3_column_text(query, 1));
+			list->entries[i].record_date = exec_fetch_strdup(arena,
+					(const char *)sqlite3_column_text(query, 1));
 			list->entries[i].humidity = sqlite3_column_double(query, 3);
-			list->entries[i].location = strdup(sqlite3_column_text(query, 4));
-			list->entries[i].device_name = strdup(sqlite3_column_text(query, 5));
+			list->entries[i].location = exec_fetch_strdup(arena,
+					(const char *)sqlite3_column_text(query, 4));
+			list->entries[i].device_name = exec_fetch_strdup(arena,
+					(const char *)sqlite3_column_text(query, 5));
 
             /* Fetch temperature and then check if a conversion is required. */
             list->entries[i].temperature = sqlite3_column_double(query, 2);
@@ -315,7 +509,9 @@ entrylist *exec_fetch_query(const char *fcountq, const char *fselectq,
         *errcode = DBHANDLER_ERROR_SQL_ERROR;
 
         /* Reset list */
-        entrylist_free(list);
+        if (!arena)
+            entrylist_free(list);
+
         return NULL;
 	}
 
@@ -325,6 +521,142 @@ entrylist *exec_fetch_query(const char *fcountq, const char *fselectq,
 	return list;
 }
 
+static entrylist *exec_fetch_arena_entrylist(rpiwd_arena *arena, size_t capacity) {
+	entrylist *list = arena_alloc(arena, sizeof(entrylist));
+	if (!list)
+		return NULL;
+
+	list->entries = arena_alloc(arena, sizeof(entry) * capacity);
+	if (!list->entries)
+		return NULL;
+
+	list->capacity = capacity;
+	list->size = 0;
+
+	return list;
+}
+
+static char *exec_fetch_strdup(rpiwd_arena *arena, const char *str) {
+	return arena ? arena_strdup(arena, str) : strdup(str);
+}
+
+db_fetch_cursor *open_fetch_cursor(const char *fselectq, bool keep_native_unit,
+        const char *unitstr, int format, int *errcode) {
+	db_fetch_cursor *cursor = malloc(sizeof(db_fetch_cursor));
+	if (!cursor) {
+		*errcode = DBHANDLER_ERROR_NO_MEMORY;
+		return NULL;
+	}
+
+	/* Prepare query; rows are stepped through one batch at a time */
+	if (sqlite3_prepare_v2(db, fselectq, -1, &cursor->query, 0) != SQLITE_OK) {
+        rpiwd_log(LOG_ERR, "Error retrieving entries: %s", sqlite3_errmsg(db));
+		*errcode = DBHANDLER_ERROR_SQL_ERROR;
+		free(cursor);
+		return NULL;
+	}
+
+	cursor->keep_native_unit = keep_native_unit;
+	memcpy(cursor->unitstr, unitstr, sizeof(cursor->unitstr));
+	cursor->format = format;
+	cursor->rows = 0;
+
+	*errcode = DBHANDLER_ERROR_SUCCESS;
+	return cursor;
+}
+
+char *fetch_cursor_next_batch(db_fetch_cursor *cursor, bool *is_done, size_t *length,
+        int *errcode) {
+	strbuf batch;
+	entry ent;
+	int rc = SQLITE_ROW, flag = 1;
+
+	*is_done = false;
+	if (strbuf_init(&batch, DBHANDLER_STREAM_BATCH_SIZE + STRBUF_DEFAULT_CAPACITY) == -1) {
+		*errcode = DBHANDLER_ERROR_NO_MEMORY;
+		return NULL;
+	}
+
+	/* The first batch opens the document */
+	if (cursor->rows == 0) {
+		if (cursor->format == RPIWD_FORMAT_CBOR)
+			flag = entrylist_cbor_stream_begin(&batch, cursor->unitstr);
+		else if (cursor->format == RPIWD_FORMAT_CSV)
+			flag = entrylist_csv_stream_begin(&batch, cursor->unitstr);
+		else
+			flag = entrylist_json_stream_begin(&batch, cursor->unitstr);
+	}
+
+	/* Serialize rows straight from the statement until the batch is full */
+	while (flag != -1 && batch.length < DBHANDLER_STREAM_BATCH_SIZE &&
+		   (rc = sqlite3_step(cursor->query)) == SQLITE_ROW) {
+		/* Strings point into SQLite's row; they are only used right here */
+		ent.id = sqlite3_column_int(cursor->query, 0);
+		ent.record_date = (char *)sqlite3_column_text(cursor->query, 1);
+		ent.temperature = sqlite3_column_double(cursor->query, 2);
+		ent.humidity = sqlite3_column_double(cursor->query, 3);
+		ent.location = (char *)sqlite3_column_text(cursor->query, 4);
+		ent.device_name = (char *)sqlite3_column_text(cursor->query, 5);
+
+		if (!cursor->keep_native_unit)
+			RPIWD_CELSIUS_TO_FARENHEIT(ent.temperature);
+
+		if (cursor->format == RPIWD_FORMAT_CBOR)
+			flag = entry_cbor_stream_append(&batch, &ent);
+		else if (cursor->format == RPIWD_FORMAT_CSV)
+			flag = entry_csv_stream_append(&batch, &ent);
+		else
+			flag = entry_json_stream_append(&batch, &ent, cursor->rows == 0);
+		cursor->rows++;
+	}
+
+	if (flag == -1 || (rc != SQLITE_ROW && rc != SQLITE_DONE)) {
+		if (flag != -1)
+			rpiwd_log(LOG_ERR, "Error retrieving entries: %s", sqlite3_errmsg(db));
+
+		*errcode = flag == -1 ? DBHANDLER_ERROR_NO_MEMORY : DBHANDLER_ERROR_SQL_ERROR;
+		strbuf_free(&batch);
+		return NULL;
+	}
+
+	/* The last batch closes it; CSV has nothing to close */
+	if (rc == SQLITE_DONE) {
+		*is_done = true;
+		if (cursor->format == RPIWD_FORMAT_CBOR)
+			flag = entrylist_cbor_stream_end(&batch, cursor->rows);
+		else if (cursor->format == RPIWD_FORMAT_JSON)
+			flag = entrylist_json_stream_end(&batch, cursor->rows);
+
+		if (flag == -1) {
+			*errcode = DBHANDLER_ERROR_NO_MEMORY;
+			strbuf_free(&batch);
+			return NULL;
+		}
+	}
+
+	/* CBOR has NUL bytes of its own, so the length is passed along */
+	*length = batch.length;
+	*errcode = DBHANDLER_ERROR_SUCCESS;
+	return strbuf_release(&batch);
+}
+
+void close_fetch_cursor(db_fetch_cursor *cursor) {
+	sqlite3_finalize(cursor->query);
+	free(cursor);
+}
+
+static void next_fetch_batch(rpiwd_mqmsg *msg) {
+	db_fetch_cursor *cursor = (db_fetch_cursor *)msg->cursor;
+	bool is_done;
+
+	/* The cursor goes back to the worker until the last batch is out */
+	msg->data = fetch_cursor_next_batch(cursor, &is_done, &msg->length, &msg->retcode);
+	if (!msg->data || is_done) {
+		close_fetch_cursor(cursor);
+		msg->cursor = NULL;
+	}
+}
+
 key_value_list *exec_key_value_query(const char *fcountq, const char *fselectq, 
 		int *errcode) {
 	size_t count = exec_formatted_count_query(fcountq);
@@ -347,8 +679,8 @@ key_value_list *exec_key_value_query(const char *fcountq, const char *fselectq,
 		/* Step while there is anything there */
 		while ((rc = sqlite3_step(query)) == SQLITE_ROW) {
 			addflag = key_value_list_emplace(kvlist,
-					sqlite3_column_text(query, 0),
-					sqlite3_column_text(query, 1));
+					(const char *)sqlite3_column_text(query, 0),
+					(const char *)sqlite3_column_text(query, 1));
 
 			if (!addflag) {
 				*errcode = DBHANDLER_ERROR_NO_MEMORY;
@@ -379,6 +711,8 @@ const char *dbhandler_strerror(int errcode) {
 			return "Internal SQL error";
 		case DBHANDLER_ERROR_NO_MEMORY:
 			return "Out of memory.";
+		case DBHANDLER_ERROR_OVERLOADED:
+			return "Server is busy; try again later.";
 	}
 
 	return "General DBHANDLER error.";
@@ -18,6 +18,9 @@
 
 static pthread_mutex_t __mtx_device_lock = PTHREAD_MUTEX_INITIALIZER;
 static device *__selected_device;
+static device_sample __latest_sample;
+static pthread_once_t __sample_request_once = PTHREAD_ONCE_INIT;
+static int __sample_request_fd = -1;
 
 /* Array of supported device structures */
 device supported_devices[] = {
@@ -28,6 +31,9 @@ device supported_devices[] = {
 int device_init_by_name(const char *device_name, int data_pin) {
 	device *ptr = supported_devices;
 
+	/* Requests may be reading the device while it is reconfigured */
+	pthread_mutex_lock(&__mtx_device_lock);
+
 	while (ptr->device_name) {
 		if (strcmp(ptr->device_name, device_name) == 0) {
 			/* Set pinout */
@@ -41,11 +47,16 @@ int device_init_by_name(const char *device_name, int data_pin) {
 		ptr++;
 	}
 
-	if (!ptr)
+	if (!ptr) {
+		pthread_mutex_unlock(&__mtx_device_lock);
 		return RETCODE_DEVICE_INIT_UNKNOWN;
+	}
 
-	/* Set the device */
+	/* Set the device; what the previous one read is no longer current */
 	__selected_device = ptr;
+	device_publish_sample((float [DEVICE_SAMPLE_VALUES]){ 0 }, 0);
+
+	pthread_mutex_unlock(&__mtx_device_lock);
 
 	/* Return the structure to be copied over to the application.
 	 * If device wasn't found return NULL */
@@ -70,11 +81,104 @@ int device_query_current(float *arr) {
 	pthread_mutex_lock(&__mtx_device_lock);
         retflag = __selected_device->query_function(__selected_device->pin_data,
 				arr);
+
+		/* The lock keeps writers of the latest sample apart */
+		if (retflag == RPIWD_DEVRETCODE_SUCCESS)
+			device_publish_sample(arr, rpiwd_monotonic_usec());
 	pthread_mutex_unlock(&__mtx_device_lock);
 
 	return retflag;
 }
 
+bool device_latest_sample(float *arr, uint64_t *taken_usec, time_t *taken_at, int *id) {
+	float values[DEVICE_SAMPLE_VALUES];
+	uint64_t taken;
+	time_t taken_time;
+	unsigned int seq;
+	int row_id;
+
+	/* Copy the sample until no write happened meanwhile. A write is a few
+	 * stores, so this hardly ever takes a second round. */
+	do {
+		seq = __atomic_load_n(&__latest_sample.seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		for (int i = 0; i < DEVICE_SAMPLE_VALUES; i++)
+			__atomic_load(&__latest_sample.values[i], &values[i], __ATOMIC_RELAXED);
+		taken = __atomic_load_n(&__latest_sample.taken_usec, __ATOMIC_RELAXED);
+		taken_time = __atomic_load_n(&__latest_sample.taken_at, __ATOMIC_RELAXED);
+		row_id = __atomic_load_n(&__latest_sample.id, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&__latest_sample.seq, __ATOMIC_RELAXED));
+
+	if (taken == 0)
+		return false;
+
+	memcpy(arr, values, sizeof(values));
+	*taken_usec = taken;
+	*taken_at = taken_time;
+	*id = row_id;
+
+	return true;
+}
+
+void device_sample_written(const float *arr, int id) {
+	unsigned int seq;
+
+	/* The row holds the latest reading, unless the device was read again
+	 * meanwhile; a reading with the same values may as well be that row */
+	pthread_mutex_lock(&__mtx_device_lock);
+		if (__latest_sample.taken_usec != 0 && __latest_sample.id == -1 &&
+			memcmp(__latest_sample.values, arr, sizeof(__latest_sample.values)) == 0) {
+			seq = __atomic_load_n(&__latest_sample.seq, __ATOMIC_RELAXED);
+			__atomic_store_n(&__latest_sample.seq, seq + 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+
+			__atomic_store_n(&__latest_sample.id, id, __ATOMIC_RELAXED);
+
+			__atomic_store_n(&__latest_sample.seq, seq + 2, __ATOMIC_RELEASE);
+		}
+	pthread_mutex_unlock(&__mtx_device_lock);
+}
+
+void device_request_sample(void) {
+	uint64_t one = 1;
+
+	pthread_once(&__sample_request_once, device_init_sample_request);
+
+	/* The counter coalesces requests; a failed write means one is pending */
+	if (__sample_request_fd != -1 && write(__sample_request_fd, &one, sizeof(one)) == -1 &&
+		errno != EAGAIN)
+		rpiwd_log(LOG_ERR, "error requesting a reading: %s", strerror(errno));
+}
+
+bool device_wait_sample_request(unsigned int milliseconds) {
+	struct pollfd pfd;
+	uint64_t count;
+
+	pthread_once(&__sample_request_once, device_init_sample_request);
+	if (__sample_request_fd == -1) {
+		rpiwd_sleep(milliseconds);
+		return false;
+	}
+
+	/* Like a sleep, signals cut this short */
+	pfd.fd = __sample_request_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, milliseconds) != 1)
+		return false;
+
+	if (read(__sample_request_fd, &count, sizeof(count)) == -1) {
+		if (errno != EAGAIN)
+			rpiwd_log(LOG_ERR, "error taking a reading request: %s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
 device *get_current_device(void) {
 	device *ptr = NULL;
 
@@ -98,3 +202,26 @@ void print_supported_device_names(void) {
 
 	printf("\n");
 }
+
+static void device_publish_sample(const float *arr, uint64_t taken_usec) {
+	unsigned int seq = __atomic_load_n(&__latest_sample.seq, __ATOMIC_RELAXED);
+
+	/* Odd while the sample is being written */
+	__atomic_store_n(&__latest_sample.seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (int i = 0; i < DEVICE_SAMPLE_VALUES; i++)
+		__atomic_store(&__latest_sample.values[i], (float *)&arr[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&__latest_sample.taken_usec, taken_usec, __ATOMIC_RELAXED);
+	__atomic_store_n(&__latest_sample.taken_at, taken_usec ? time(NULL) : 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&__latest_sample.id, -1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&__latest_sample.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void device_init_sample_request(void) {
+	/* Without it, the query loop just sleeps between readings */
+	__sample_request_fd = eventfd(0, EFD_NONBLOCK);
+	if (__sample_request_fd == -1)
+		rpiwd_log(LOG_ERR, "error creating reading request eventfd: %s", strerror(errno));
+}
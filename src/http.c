@@ -16,256 +16,362 @@
 
 #include "http.h"
 
-void http_cmd_param_free(http_cmd_param *ptr) {
-	free(ptr->name);
-	free(ptr->value);
-}
-
-void http_cmd_free(http_cmd *ptr) {
-	/* Free each parameter */
-	for (int i = 0; i < ptr->length; i++)
-		http_cmd_param_free(&ptr->params[i]);
+size_t make_response_header(char *buf, size_t size, int code, const char *framing,
+		const char *content_type, const char *etag, bool keep_alive) {
+	char date_buffer[26]; /* See ctime(2) */
+	char cache_buffer[HTTP_CACHE_HEADERS_LENGTH];
+	time_t current_time;
+	int length;
 
-	/* Free array and pointer */
-	if (ptr->params)
-		free(ptr->params);
+	/* Generate date and properly concatenate the result string */
+	current_time = time(NULL);
+	ctime_r(&current_time, date_buffer);
+	date_buffer[strlen(date_buffer) - 1] = '\0';
 
-	free(ptr);
-}
+	/* Responses with a validator may be kept, as long as they are revalidated */
+	if (etag && *etag)
+		snprintf(cache_buffer, sizeof(cache_buffer), HTTP_CACHE_CONTROL_ETAG, etag);
+	else
+		strcpy(cache_buffer, HTTP_CACHE_CONTROL_NO_STORE);
 
-int http_cmd_param_count(http_cmd *cmd, const char *name) {
-	int count = 0;
+	/* Print the headers; the body is sent from its own buffer */
+	length = snprintf(buf, size, HTTP_RESPONSE_TEMPLATE,
+			http_code_str(code),								/* Response string */
+			date_buffer,										/* Date */
+			RPIWEATHERD_FULL_SERVER_ID,							/* Server ID */
+			cache_buffer,										/* Cache-control */
+			content_type ? content_type : HTTP_CONTENT_TYPE_HTML,	/* Content-Type */
+			keep_alive ? HTTP_CONNECTION_KEEP_ALIVE :
+				HTTP_CONNECTION_CLOSE,							/* Connection */
+			framing												/* Content-Length, if any */
+		   );
 
-	for (int i = 0; i < cmd->length; i++)
-		if (strcmp(cmd->params[i].name, name) == 0)
-			count++;
+	return length < 0 || (size_t)length >= size ? 0 : (size_t)length;
+}
 
-	return count;
+ssize_t send_response(rpiwd_conn *conn, int code, char *data) {
+	return queue_response(conn, code, data, data ? strlen(data) : 0, "");
 }
 
-int break_request(const char *url, char *http_proto, char *args, char *commandstr) {
-	int scanflag;
-	char all_line[HTTP_COMMAND_MAX_SIZE] = { 0 };
-	char *saveptr, *ptr;
+ssize_t send_response_data(rpiwd_conn *conn, int code, char *data, size_t length) {
+	return queue_response(conn, code, data, length, "");
+}
 
-	/* Create local copy for strtok_r */
-	strcpy(all_line, url);
+static ssize_t queue_response(rpiwd_conn *conn, int code, char *data, size_t data_length,
+		const char *extra_headers) {
+	size_t header_length, compressed_length;
+	char framing[HTTP_RESPONSE_HEADER_SIZE / 4] = "", *compressed;
+	const char *encoding = "";
+	char *header;
+
+	/* Compress the body if the client takes it and it is worth it */
+	if (should_compress(conn, data_length)) {
+		compressed = gzip_compress(data, data_length,
+				get_current_config()->compression_level, &compressed_length);
+		if (compressed) {
+			free(data);
+			data = compressed;
+			data_length = compressed_length;
+			encoding = HTTP_CONTENT_ENCODING_GZIP;
+		}
+	}
 
-	/* Break once - get request type */
-	ptr = strtok_r(all_line, " ", &saveptr);
-	if (!ptr)
-		return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+	header = malloc(HTTP_RESPONSE_HEADER_SIZE);
+	if (!header) {
+		free(data);
+		return -1;
+	}
 
-	/* Break twice - get command */
-	ptr = strtok_r(NULL, " /?", &saveptr);
-	if (ptr)
-		commandstr = strcpy(commandstr, ptr);
+	/* Print content length if needed */
+	if (data_length)
+		snprintf(framing, sizeof(framing), "%sContent-Length: %zu\r\n%s",
+				extra_headers, data_length, encoding);
 	else
-		return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
-
-	/* Check if the command has any arguments.
-	 * We can determine this is the args or http_proto
-	 * by comparing it to the server's supported protocols */
-	ptr = strtok_r(NULL, " ", &saveptr);
-	if (!ptr)
-		return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
-	else {
-		if (strcmp(ptr, "HTTP/1.0") == 0 || strcmp(ptr, "HTTP/1.1") == 0) {
-			http_proto = strcpy(http_proto, ptr);
-			return HTTP_PARSER_ERROR_SUCCESS;
-		}
-		else
-			args = strcpy(args, ptr);
+		snprintf(framing, sizeof(framing), "%s", extra_headers);
+
+	/* Errors are never cached */
+	header_length = make_response_header(header, HTTP_RESPONSE_HEADER_SIZE, code,
+			framing, code == HTTP_CODE_OK ? conn->content_type : NULL,
+			code == HTTP_CODE_OK || code == HTTP_CODE_NOT_MODIFIED ? conn->etag : NULL,
+			conn->keep_alive);
+	if (header_length == 0) {
+		free(header);
+		free(data);
+		return -1;
 	}
 
-	/* Check protocol */
-	ptr = strtok_r(NULL, " ", &saveptr);
-	if (!ptr)
-		return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
-	else
-		http_proto = strcpy(http_proto, ptr);
+	/* Queue headers and body as separate chunks; they go out together in one
+	 * sendmsg() call, so the body never has to be copied behind the headers.
+	 * The connection owns both buffers from here on, so data has to come
+	 * from malloc() (parson's serializer does). */
+	if (conn_queue_output(conn, header, header_length) == -1) {
+		free(data);
+		return -1;
+	}
 
-	return HTTP_PARSER_ERROR_SUCCESS;
+	if (data_length == 0)
+		free(data);
+	else if (conn_queue_output(conn, data, data_length) == -1)
+		return -1;
+
+	return header_length + data_length;
 }
 
-http_cmd *parse_http_request(const char *request, int *response) {
-	char *line, *part, *saveptr;
-	char http_proto[HTTP_PROTO_MAX_SIZE] = { 0 }, 
-		 args[HTTP_ARGS_MAX_SIZE] = { 0 },
-		 commandstr[HTTP_COMMAND_MAX_SIZE] = { 0 };
-	http_cmd *cmd = NULL;
-	int actual_count = 0, bflag = 0, i;
-	size_t cmd_iter = 0;
-
-	/* Get first line, which is the request line itself. */
-	line = rpiwd_getline(request, "\r\n");
-	if (!line)
-		return NULL; /* Bad request / bad request format*/
-
-	/* Parse the entire line */
-	bflag = break_request(line, http_proto, args, commandstr);
-	if (bflag < 0) {
-		*response = bflag;
-		return NULL; /* Bad request */
-	}
+ssize_t send_chunked_response_start(rpiwd_conn *conn, int code, bool compress) {
+	size_t header_length;
+	char framing[HTTP_RESPONSE_HEADER_SIZE / 4];
+	char *header = malloc(HTTP_RESPONSE_HEADER_SIZE);
+	if (!header)
+		return -1;
 
-	/* Check protocol */
-	if (strcmp(http_proto, "HTTP/1.1") != 0 && strcmp(http_proto, "HTTP/1.0") != 0) {
-		*response = HTTP_PARSER_ERROR_WRONG_PROTOCOL;
-		return NULL; /* Wrong protocol */
-	}
+	/* Chunks are compressed as one gzip stream */
+	if (compress && should_compress(conn, SIZE_MAX))
+		conn->gzip_stream = gzip_stream_open(get_current_config()->compression_level);
 
-	/* Allocate cmd */
-	cmd = malloc(sizeof(http_cmd));
-	if (!cmd) {
-		*response = HTTP_PARSER_ERROR_NO_MEMORY;
-		return NULL;
+	snprintf(framing, sizeof(framing), "%s%s", HTTP_TRANSFER_ENCODING_CHUNKED,
+			conn->gzip_stream ? HTTP_CONTENT_ENCODING_GZIP : "");
+
+	header_length = make_response_header(header, HTTP_RESPONSE_HEADER_SIZE, code,
+			framing, conn->content_type, code == HTTP_CODE_OK ? conn->etag : NULL,
+			conn->keep_alive);
+	if (header_length == 0) {
+		free(header);
+		return -1;
 	}
 
-	/* Copy command */
-	cmd->cmdname = strdup(commandstr);
-	if (!cmd->cmdname) {
-		*response = HTTP_PARSER_ERROR_NO_MEMORY;
-		return NULL;
+	if (conn_queue_output(conn, header, header_length) == -1)
+		return -1;
+
+	return header_length;
+}
+
+ssize_t send_response_chunk(rpiwd_conn *conn, char *data, size_t data_length) {
+	size_t compressed_length;
+	char *compressed;
+
+	if (conn->gzip_stream) {
+		compressed = gzip_stream_write(conn->gzip_stream, data, data_length, false,
+				&compressed_length);
+		free(data);
+		if (!compressed)
+			return -1;
+
+		data = compressed;
+		data_length = compressed_length;
 	}
 
-	/* Now parse all arguments. First determine count.
-	 * Note that if there are more AND symbols then actual arguments,
-	 * this will be corrected later using a realloc(). */
-	for (i = 0; args[i]; args[i] == '&' ? actual_count++ : 0, i++);
+	return queue_chunk(conn, data, data_length);
+}
+
+ssize_t end_chunked_response(rpiwd_conn *conn) {
+	size_t trailer_length;
+	char *last_chunk, *trailer;
 
-	/* Allocate params array */
-	cmd->params = malloc(sizeof(http_cmd_param) * (actual_count + 1));
-	if (!cmd->params) {
-		*response = HTTP_PARSER_ERROR_NO_MEMORY;
-		free(cmd);
-		return NULL;
+	/* Flush the compressor and write the gzip trailer */
+	if (conn->gzip_stream) {
+		trailer = gzip_stream_write(conn->gzip_stream, "", 0, true, &trailer_length);
+		gzip_stream_close(conn->gzip_stream);
+		conn->gzip_stream = NULL;
+
+		if (!trailer || queue_chunk(conn, trailer, trailer_length) == -1)
+			return -1;
 	}
 
-	/* If actual_count == 0, might be a single parameter, or no parameters at all. */
-	if (actual_count == 0) {
-		cmd->params[0] = parse_http_param(args);
+	last_chunk = strdup(HTTP_LAST_CHUNK);
+	if (!last_chunk)
+		return -1;
+
+	if (conn_queue_output(conn, last_chunk, strlen(HTTP_LAST_CHUNK)) == -1)
+		return -1;
 
-		/* If name is something, then there is a single parameter */
-		if (cmd->params[0].name)
-			cmd->length = 1;
-		else {
-			/* No parameters for this command */
-			cmd->length = 0;
-		}
+	return strlen(HTTP_LAST_CHUNK);
+}
+
+static ssize_t queue_chunk(rpiwd_conn *conn, char *data, size_t length) {
+	size_t size_length;
+	char *size_line, *terminator;
+
+	/* An empty chunk would end the response */
+	if (length == 0) {
+		free(data);
+		return 0;
 	}
-	else {
-		/* Now actually parse arguments */
-		part = strtok_r(args, "&", &saveptr);
-		do {
-			cmd->params[cmd_iter] = parse_http_param(part);
-			cmd_iter++;
-		} while ((part = strtok_r(NULL, "&", &saveptr)) != NULL);
-
-		/* Check if re-allocation is needed (e.g. More & than actual args).
-		 * Also remember to reserve an extra entry for the NULL entry */
-		if ((cmd_iter - 1) != actual_count) {
-			cmd->length = cmd_iter - 1;
-			cmd->params = realloc(cmd->params, sizeof(http_cmd_param) * cmd->length);
-			if (!cmd->params) {
-				*response = HTTP_PARSER_ERROR_NO_MEMORY;
-				http_cmd_free(cmd);
-				return NULL;
-			}
-		}
-		else
-			cmd->length = cmd_iter;
+
+	/* "<size in hex>\r\n<data>\r\n"; the data is queued as is */
+	size_line = malloc(HTTP_CHUNK_SIZE_LINE_LENGTH);
+	terminator = strdup("\r\n");
+	if (!size_line || !terminator) {
+		free(size_line);
+		free(terminator);
+		free(data);
+		return -1;
 	}
 
-	/* Check for duplicate arguments in parametrs */
-	for (i = 0; i < cmd->length; i++) {
-		if (http_cmd_param_count(cmd, cmd->params[i].name) > 1) {
-			http_cmd_free(cmd);
-			cmd = NULL;
-			*response = HTTP_PARSER_ERROR_DUPLICATE_PARAMS;
+	size_length = snprintf(size_line, HTTP_CHUNK_SIZE_LINE_LENGTH, "%zx\r\n", length);
+	if (conn_queue_output(conn, size_line, size_length) == -1) {
+		free(terminator);
+		free(data);
+		return -1;
+	}
 
-			break;
-		}
+	if (conn_queue_output(conn, data, length) == -1) {
+		free(terminator);
+		return -1;
 	}
 
-	return cmd;
+	if (conn_queue_output(conn, terminator, 2) == -1)
+		return -1;
+
+	return size_length + length + 2;
 }
 
-http_cmd_param parse_http_param(const char *paramstr) {
-	http_cmd_param param;
-	char *part, *saveptr;
-	char local[strlen(paramstr) + 1];
+static bool should_compress(rpiwd_conn *conn, size_t length) {
+	rpiwd_config *config = get_current_config();
 
-	strcpy(local, paramstr);
+	return conn->accept_gzip && compression_available() && config->compression_level > 0 &&
+		length >= (size_t)config->compression_min_size;
+}
 
-	/* Split by the '=' sign, if any. */
-	part = strtok_r(local, "=", &saveptr);
-	if (part)
-		param.name = strdup(part);
-	else
-		param.name = NULL;
+bool set_response_etag(rpiwd_conn *conn, uint64_t version, uint64_t digest) {
+	snprintf(conn->etag, CONN_ETAG_LENGTH, HTTP_ETAG_FORMAT,
+			(unsigned long long)version, (unsigned long long)digest);
 
-	part = strtok_r(NULL, "=", &saveptr);
-	if (part)
-		param.value = strdup(part);
-	else
-		param.value = NULL;
+	/* Does the client have this one already? */
+	return conn->if_none_match &&
+		http_etag_matches(conn->if_none_match, conn->if_none_match_length, conn->etag);
+}
 
-	return param;
+ssize_t send_not_modified_response(rpiwd_conn *conn) {
+	/* Only the headers; the client already has the body */
+	return queue_response(conn, HTTP_CODE_NOT_MODIFIED, NULL, 0, "");
 }
 
-char *make_response(int code, const char *data) {
-	char resp_string[HTTP_RESPONSE_HEADER_SIZE / 2], 
-		 content_length[HTTP_RESPONSE_HEADER_SIZE / 2],
-		 date_buffer[26]; /* See ctime(2) */
-	size_t datalen = data ? strlen(data): 0;
-	time_t current_time;
-	char *response = calloc(sizeof(char), HTTP_RESPONSE_HEADER_SIZE + datalen);
-	if (!response)
-		return NULL;
+ssize_t send_event_stream_start(rpiwd_conn *conn) {
+	/* No length and no chunks; the stream ends when the connection does */
+	conn->content_type = HTTP_CONTENT_TYPE_EVENT_STREAM;
+	conn->keep_alive = false;
 
-	/* Check response code and build response accordingly */
-	sprintf(resp_string, http_code_str(code));
+	return queue_response(conn, HTTP_CODE_OK, NULL, 0, "");
+}
 
-	/* Print content length if needed */
-	sprintf(content_length, datalen ? "Content-Length: %d\r\n" : "", 
-			datalen ? datalen : 0);
+ssize_t send_event(rpiwd_conn *conn, const char *event, size_t length) {
+	/* Every subscriber frees its own copy */
+	char *data = malloc(length);
+	if (!data)
+		return -1;
 
-	/* Generate date and properly concatenate the result string */
-	current_time = time(NULL);
-	ctime_r(&current_time, date_buffer);
-	date_buffer[strlen(date_buffer) - 1] = '\0';
+	memcpy(data, event, length);
+	if (conn_queue_output(conn, data, length) == -1)
+		return -1;
 
-	/* Print the actual content of the response */
-	sprintf(response, HTTP_RESPONSE_TEMPLATE,
-			resp_string,										/* Response string */
-			date_buffer,										/* Date */
-			RPIWEATHERD_FULL_SERVER_ID,							/* Server ID */
-			content_length ? content_length : "",				/* Content-Length */
-			data ? data : ""									/* Data if needed */
-		   );
+	return length;
+}
+
+char *make_event(unsigned long long id, const char *data) {
+	size_t length = snprintf(NULL, 0, HTTP_EVENT_FORMAT, id, data) + 1;
+	char *event = malloc(length);
+
+	/* The ID is the sample's row; after a reconnect, a client can fetch
+	 * whatever it missed */
+	if (event)
+		snprintf(event, length, HTTP_EVENT_FORMAT, id, data);
 
-	return response;
+	return event;
 }
 
-ssize_t send_response(int sockfd, int code, const char *data) {
-	ssize_t flag;
-	char *response = make_response(code, data);
-	if (!response)
+ssize_t send_websocket_accept(rpiwd_conn *conn, const char *key, size_t length) {
+	char accept[WEBSOCKET_ACCEPT_LENGTH];
+	char *header = malloc(HTTP_RESPONSE_HEADER_SIZE);
+	int header_length;
+
+	if (!header)
+		return -1;
+
+	/* Not a regular response: no body, and the connection stays open for
+	 * frames in both directions */
+	websocket_accept_key(key, length, accept);
+	header_length = snprintf(header, HTTP_RESPONSE_HEADER_SIZE, HTTP_WEBSOCKET_ACCEPT_TEMPLATE,
+			RPIWEATHERD_FULL_SERVER_ID, accept);
+	if (header_length < 0 || header_length >= HTTP_RESPONSE_HEADER_SIZE) {
+		free(header);
+		return -1;
+	}
+
+	if (conn_queue_output(conn, header, header_length) == -1)
 		return -1;
 
-	/* Respond to client */
-	flag = write(sockfd, response, strlen(response));
+	return header_length;
+}
 
-	/* Free response string */
-	free(response);
+ssize_t send_upgrade_required_response(rpiwd_conn *conn, int errcode, const char *err) {
+	char *serialized = make_error_body(errcode, err);
+	if (!serialized)
+		return -1;
 
-	return flag;
+	/* Tells the client which WebSocket version to retry with */
+	return queue_response(conn, HTTP_CODE_UPGRADE_REQUIRED, serialized, strlen(serialized),
+			HTTP_WEBSOCKET_VERSION);
 }
 
-ssize_t send_http_error_response(int sockfd, int httpcode, int errcode, const char *err) {
-	ssize_t flag;
-	char *serialized = NULL, *response = NULL;
+ssize_t send_websocket_message(rpiwd_conn *conn, int opcode, char *data, size_t length) {
+	char *header = malloc(WEBSOCKET_MAX_HEADER_SIZE);
+	size_t header_length;
+
+	if (!header) {
+		free(data);
+		return -1;
+	}
+
+	/* Like a response, the frame header and the payload are queued
+	 * separately; the payload is not copied */
+	header_length = websocket_frame_header(header, opcode, length);
+	if (conn_queue_output(conn, header, header_length) == -1) {
+		free(data);
+		return -1;
+	}
+
+	if (length == 0)
+		free(data);
+	else if (conn_queue_output(conn, data, length) == -1)
+		return -1;
+
+	return header_length + length;
+}
+
+ssize_t send_websocket_close(rpiwd_conn *conn, uint16_t status) {
+	char *payload = malloc(2);
+	if (!payload)
+		return -1;
+
+	payload[0] = status >> 8;
+	payload[1] = status & 0xff;
+
+	return send_websocket_message(conn, WEBSOCKET_OPCODE_CLOSE, payload, 2);
+}
+
+ssize_t send_http_error_response(rpiwd_conn *conn, int httpcode, int errcode,
+		const char *err) {
+	char *serialized = make_error_body(errcode, err);
+	if (!serialized)
+		return -1;
+
+	/* Make HTTP response and queue it; the connection frees the body */
+	return send_response(conn, httpcode, serialized);
+}
+
+ssize_t send_retry_later_response(rpiwd_conn *conn, int httpcode, int errcode,
+		const char *err, unsigned int retry_after) {
+	char retry_header[HTTP_RETRY_AFTER_LENGTH];
+	char *serialized = make_error_body(errcode, err);
+	if (!serialized)
+		return -1;
+
+	snprintf(retry_header, sizeof(retry_header), HTTP_RETRY_AFTER, retry_after);
+	return queue_response(conn, httpcode, serialized, strlen(serialized), retry_header);
+}
+
+static char *make_error_body(int errcode, const char *err) {
+	char *serialized = NULL;
 	JSON_Value *rootval = json_value_init_object();
 	JSON_Object *mainobject = json_value_get_object(rootval);
 
@@ -275,63 +381,62 @@ ssize_t send_http_error_response(int sockfd, int httpcode, int errcode, const ch
 	json_object_set_string(mainobject, "errmsg", err);
 
 	serialized = json_serialize_to_string(rootval);
-	if (!serialized) {
-		json_value_free(rootval);
-		return -1;
-	}
-
-	/* Make HTTP response */
-	response = make_response(httpcode, serialized);
-
-	/* Respond to client */
-	flag = write(sockfd, response, strlen(response));
 
 	/* Free all buffers */
-	json_free_serialized_string(serialized);
 	json_value_free(rootval);
-	free(response);
 
-	return flag;
+	return serialized;
 }
 
-http_cmd *read_and_parse_response(int sockfd, int *response, int *is_eof) {
-	ssize_t flag = 0;
-	char buffer[RESPONSE_BUFFER_SIZE];
+http_cmd *parse_buffered_request(rpiwd_conn *conn, http_cmd *cmd, int *response) {
+	int flag;
 
-	/* Read from socket */
-	flag = read(sockfd, buffer, RESPONSE_BUFFER_SIZE);
-	if (flag == -1)
+	/* Continue parsing from where the last read left off */
+	flag = http_parser_execute(&conn->parser, conn->inbuf, conn->inlen);
+	if (flag == HTTP_PARSER_REQUEST_INCOMPLETE) {
+		/* The limits keep a request within the buffer, so this is a body
+		 * that does not fit behind its headers */
+		if (conn->inlen == CONN_INPUT_BUFFER_SIZE)
+			flag = HTTP_PARSER_ERROR_REQUEST_TOO_LONG;
+
+		*response = flag;
 		return NULL;
-	else if (flag == 0) { /* Socket EOF */
-		*is_eof = 1;
+	}
+	else if (flag != HTTP_PARSER_ERROR_SUCCESS) {
+		*response = flag;
 		return NULL;
 	}
 
+	/* Remember where this request ends; pipelined requests may follow it */
+	conn->request_length = conn->parser.request_length;
+
 	/* Parse */
-	return parse_http_request(buffer, response);
+	return parse_http_request(conn->inbuf, &conn->parser, cmd, response);
 }
 
-void end_response(int sockfd, http_cmd *cmd) {
-	/* Close socket */
-	close(sockfd);
-
-	/* Remove command */
-	if (cmd)
-		http_cmd_free(cmd);
+void end_response(rpiwd_conn *conn) {
+	/* Close the connection once the response is out, unless it is persistent */
+	conn->close_after_write = !conn->keep_alive;
 }
 
 const char *http_code_str(int code) {
 	switch (code) {
+		case HTTP_CODE_SWITCHING_PROTOCOLS: /* 101 Switching Protocols */
+			return "101 Switching Protocols";
 		case HTTP_CODE_OK: /* 200 OK */
 			return "200 OK";
 		case HTTP_CODE_NO_CONTENT: /* 204 No Content */
 			return "204 No Content";
+		case HTTP_CODE_NOT_MODIFIED: /* 304 Not Modified */
+			return "304 Not Modified";
 		case HTTP_CODE_REQUEST_BAD_REQUEST: /* 400 Bad Request */
 			return "400 Bad Request";
 		case HTTP_CODE_FORBIDDEN: /* 403 Forbidden */
 			return "403 Forbidden";
 		case HTTP_CODE_NOT_FOUND: /* 404 Not Found */
 			return "404 Not Found";
+		case HTTP_CODE_UPGRADE_REQUIRED: /* 426 Upgrade Required */
+			return "426 Upgrade Required";
 		case HTTP_CODE_TOO_MANY_REQUESTS: /* 429 Too Many Requests */
 			return "429 Too Many Requests";
 		case HTTP_CODE_REQUEST_TIMEOUT: /* 408 Request Timeout */
@@ -340,8 +445,12 @@ const char *http_code_str(int code) {
 			return "413 Payload Too Large";
 		case HTTP_CODE_URI_TOO_LONG: /* 414 URI Too Long */
 			return "414 URI Too Long";
+		case HTTP_CODE_HEADERS_TOO_LARGE: /* 431 Request Header Fields Too Large */
+			return "431 Request Header Fields Too Large";
 		case HTTP_CODE_INTERNAL_SERVER_ERROR: /* 500 Internal Server Error */
 			return "500 Internal Server Error";
+		case HTTP_CODE_SERVICE_UNAVAILABLE: /* 503 Service Unavailable */
+			return "503 Service Unavailable";
 		case HTTP_CODE_VERSION_NOT_SUPPORTED: /* 505 HTTP Version Not Supported */
 			return "505 HTTP Version Not Supported";
 		case HTTP_CODE_INSUFFICIENT_STORAGE: /* 507 Insufficient Storage */
@@ -359,7 +468,7 @@ const char *http_parser_strerror(int errcode) {
 		case HTTP_PARSER_ERROR_UNKNOWN_PARAM:
 			return "Unknown parameter";
 		case HTTP_PARSER_ERROR_REQUEST_TOO_LONG:
-			return "HTTP request line is too long";
+			return "HTTP request is too long";
 		case HTTP_PARSER_ERROR_PARAMS_REQUIRED:
 			return "HTTP command requires parameters";
 		case HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT:
@@ -368,8 +477,34 @@ const char *http_parser_strerror(int errcode) {
 			return "rpiweatherd only supports HTTP/1.0 or HTTP/1.1";
 		case HTTP_PARSER_ERROR_DUPLICATE_PARAMS:
 			return "Duplicate parameters in HTTP query string";
+		case HTTP_PARSER_ERROR_TOO_MANY_PARAMS:
+			return "Too many parameters in HTTP query string";
+		case HTTP_PARSER_ERROR_URI_TOO_LONG:
+			return "HTTP request URI is too long";
+		case HTTP_PARSER_ERROR_HEADERS_TOO_LARGE:
+			return "HTTP request headers are too large";
+		case HTTP_PARSER_ERROR_BODY_TOO_LARGE:
+			return "HTTP request body is too large";
 	}
 
 	return "Unknown error";
 }
 
+int http_parser_http_code(int errcode) {
+	switch (errcode) {
+		case HTTP_PARSER_ERROR_URI_TOO_LONG:
+			return HTTP_CODE_URI_TOO_LONG;
+		case HTTP_PARSER_ERROR_REQUEST_TOO_LONG:
+		case HTTP_PARSER_ERROR_HEADERS_TOO_LARGE:
+			return HTTP_CODE_HEADERS_TOO_LARGE;
+		case HTTP_PARSER_ERROR_BODY_TOO_LARGE:
+			return HTTP_CODE_PAYLOAD_TOO_LARGE;
+		case HTTP_PARSER_ERROR_WRONG_PROTOCOL:
+			return HTTP_CODE_VERSION_NOT_SUPPORTED;
+		case HTTP_PARSER_ERROR_NO_MEMORY:
+			return HTTP_CODE_INTERNAL_SERVER_ERROR;
+	}
+
+	return HTTP_CODE_REQUEST_BAD_REQUEST;
+}
+
@@ -0,0 +1,585 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpparser.h"
+
+/* Internal helpers */
+static int http_parser_header_id(const char *name, size_t length);
+static int http_parser_header_value(http_parser *parser, const char *value, size_t length);
+static bool http_parser_token_equals(const char *token, size_t length, const char *str);
+static uint64_t http_param_bit(const char *name, size_t length);
+static int http_hex_digit(char c);
+static bool http_parser_coding_accepted(const char *coding, size_t length);
+static bool http_parser_media_type_accepted(const char *type, size_t length);
+static bool http_parser_weight_accepted(const char *params, const char *end);
+
+/* Init */
+void http_parser_init(http_parser *parser) {
+	memset(parser, 0, sizeof(http_parser));
+	parser->state = HTTP_PARSER_STATE_METHOD;
+}
+
+/* Parsing */
+int http_parser_execute(http_parser *parser, const char *buf, size_t length) {
+	size_t i;
+	unsigned char c;
+	int flag;
+
+	/* Only look at bytes that arrived since the last call */
+	for (i = parser->offset; i < length && parser->state < HTTP_PARSER_STATE_BODY; i++) {
+		c = (unsigned char)buf[i];
+
+		switch (parser->state) {
+			case HTTP_PARSER_STATE_METHOD:
+				if (c == ' ') {
+					parser->method_length = i - parser->method_start;
+					if (parser->method_length == 0)
+						return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+					parser->target_start = i + 1;
+					parser->state = HTTP_PARSER_STATE_TARGET;
+				}
+				else if (c < 'A' || c > 'Z' || i - parser->method_start >= HTTP_METHOD_MAX_LENGTH)
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+				break;
+
+			case HTTP_PARSER_STATE_TARGET:
+				if (c == ' ') {
+					parser->target_length = i - parser->target_start;
+					if (parser->target_length == 0)
+						return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+					parser->version_start = i + 1;
+					parser->state = HTTP_PARSER_STATE_VERSION;
+				}
+				else if (c < 0x20 || c == 0x7f)
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+				else if (i - parser->target_start >= HTTP_URI_MAX_LENGTH)
+					return HTTP_PARSER_ERROR_URI_TOO_LONG;
+				break;
+
+			case HTTP_PARSER_STATE_VERSION:
+				if (c == '\r' || c == '\n') {
+					parser->version_length = i - parser->version_start;
+					if (parser->version_length == 0)
+						return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+					/* Headers start after the line break */
+					parser->headers_start = c == '\r' ? i + 2 : i + 1;
+					parser->state = c == '\r' ? HTTP_PARSER_STATE_LINE_LF :
+						HTTP_PARSER_STATE_HEADER_START;
+				}
+				else if (c == ' ' || i - parser->version_start >= HTTP_VERSION_MAX_LENGTH)
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+				break;
+
+			case HTTP_PARSER_STATE_LINE_LF:
+				if (c != '\n')
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+				parser->state = HTTP_PARSER_STATE_HEADER_START;
+				break;
+
+			case HTTP_PARSER_STATE_HEADER_START:
+				if (c == '\r')
+					parser->state = HTTP_PARSER_STATE_END_LF;
+				else if (c == '\n')
+					parser->state = HTTP_PARSER_STATE_BODY;
+				else if (c == ' ' || c == '\t' || c == ':') /* No obsolete line folding */
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+				else {
+					parser->mark = i;
+					parser->state = HTTP_PARSER_STATE_HEADER_NAME;
+				}
+				break;
+
+			case HTTP_PARSER_STATE_HEADER_NAME:
+				if (c == ':') {
+					parser->header = http_parser_header_id(buf + parser->mark, i - parser->mark);
+					parser->state = HTTP_PARSER_STATE_VALUE_START;
+				}
+				else if (c <= 0x20 || c == 0x7f)
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+				break;
+
+			case HTTP_PARSER_STATE_VALUE_START:
+				/* Skip leading whitespace */
+				if (c == ' ' || c == '\t')
+					break;
+
+				parser->mark = i;
+				parser->state = HTTP_PARSER_STATE_VALUE;
+
+				/* Fall through */
+			case HTTP_PARSER_STATE_VALUE:
+				/* Values are opaque; skip to the end of the line without
+				 * going through the state machine for every byte */
+				while (c != '\r' && c != '\n' && i + 1 < length)
+					c = (unsigned char)buf[++i];
+
+				if (c == '\r' || c == '\n') {
+					flag = http_parser_header_value(parser, buf + parser->mark, i - parser->mark);
+					if (flag != HTTP_PARSER_ERROR_SUCCESS)
+						return flag;
+
+					parser->state = c == '\r' ? HTTP_PARSER_STATE_LINE_LF :
+						HTTP_PARSER_STATE_HEADER_START;
+				}
+				break;
+
+			case HTTP_PARSER_STATE_END_LF:
+				if (c != '\n')
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+				parser->state = HTTP_PARSER_STATE_BODY;
+				break;
+		}
+
+		/* Enforce the header section limit */
+		if (parser->state >= HTTP_PARSER_STATE_HEADER_START &&
+			parser->state < HTTP_PARSER_STATE_BODY &&
+			i + 1 - parser->headers_start > HTTP_HEADERS_MAX_SIZE)
+			return HTTP_PARSER_ERROR_HEADERS_TOO_LARGE;
+
+		/* Headers are done; the body (if any) starts after this byte */
+		if (parser->state == HTTP_PARSER_STATE_BODY)
+			parser->body_start = i + 1;
+	}
+
+	parser->offset = i;
+
+	/* Bodies are not used by any command, but have to be skipped so that a
+	 * pipelined request after this one is found. */
+	if (parser->state == HTTP_PARSER_STATE_BODY) {
+		if (length - parser->body_start < parser->content_length) {
+			parser->offset = length;
+			return HTTP_PARSER_REQUEST_INCOMPLETE;
+		}
+
+		parser->request_length = parser->body_start + parser->content_length;
+		parser->offset = parser->request_length;
+		parser->state = HTTP_PARSER_STATE_DONE;
+	}
+
+	return parser->state == HTTP_PARSER_STATE_DONE ? HTTP_PARSER_ERROR_SUCCESS :
+		HTTP_PARSER_REQUEST_INCOMPLETE;
+}
+
+bool http_parser_keep_alive(const http_parser *parser, const char *buf) {
+	/* HTTP/1.1 connections are persistent unless stated otherwise */
+	if (http_parser_token_equals(buf + parser->version_start, parser->version_length,
+				"HTTP/1.1"))
+		return !parser->connection_close;
+
+	return parser->connection_keep_alive && !parser->connection_close;
+}
+
+http_cmd *parse_http_request(char *buf, const http_parser *parser, http_cmd *cmd,
+		int *response) {
+	char *target = buf + parser->target_start, *end = target + parser->target_length,
+		 *query;
+	const char *version = buf + parser->version_start;
+
+	/* Check protocol */
+	if (parser->version_length != strlen("HTTP/1.1") ||
+		(strncmp(version, "HTTP/1.1", parser->version_length) != 0 &&
+		 strncmp(version, "HTTP/1.0", parser->version_length) != 0)) {
+		*response = HTTP_PARSER_ERROR_WRONG_PROTOCOL;
+		return NULL; /* Wrong protocol */
+	}
+
+	/* The target looks like "/command?args" */
+	if (*target != '/') {
+		*response = HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+		return NULL;
+	}
+
+	while (target < end && *target == '/')
+		target++;
+
+	query = memchr(target, '?', end - target);
+	if ((query ? query : end) == target) {
+		*response = HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+		return NULL; /* No command */
+	}
+
+	/* Has to be checked before the request line is cut up below */
+	cmd->keep_alive = http_parser_keep_alive(parser, buf);
+	cmd->is_http11 = strncmp(version, "HTTP/1.1", parser->version_length) == 0;
+	cmd->accept_gzip = parser->accept_gzip;
+	cmd->accept_cbor = parser->accept_cbor;
+	cmd->if_none_match = parser->if_none_match_length ? buf + parser->if_none_match_start :
+		NULL;
+	cmd->if_none_match_length = parser->if_none_match_length;
+
+	/* A WebSocket handshake needs all of these (RFC 6455, section 4.2.1) */
+	cmd->websocket_key = NULL;
+	cmd->websocket_key_length = 0;
+	if (cmd->is_http11 && parser->connection_upgrade && parser->upgrade_websocket &&
+		parser->websocket_key_length > 0) {
+		cmd->websocket_key = buf + parser->websocket_key_start;
+		cmd->websocket_key_length = parser->websocket_key_length;
+	}
+
+	cmd->websocket_version = parser->websocket_version;
+
+	/* Terminate the command and the last argument in place. The byte after
+	 * the target is the space before the version. */
+	*end = '\0';
+	if (query)
+		*query = '\0';
+
+	cmd->cmdname = target;
+	cmd->cmdname_length = (query ? query : end) - target;
+
+	/* Body, e.g. a form; not NUL-terminated, since a pipelined request may
+	 * follow it */
+	cmd->body = parser->content_length ? buf + parser->body_start : NULL;
+	cmd->body_length = parser->content_length;
+
+	*response = http_parse_query(query ? query + 1 : end, end, cmd);
+	if (*response != HTTP_PARSER_ERROR_SUCCESS)
+		return NULL;
+
+	return cmd;
+}
+
+int http_parse_query(char *query, char *end, http_cmd *cmd) {
+	http_cmd_param *param;
+	uint64_t seen = 0, bit;
+	char *part, *next, *equals;
+
+	cmd->length = 0;
+
+	/* Split arguments on '&' and '=' without copying them */
+	for (part = query; part < end; part = next + 1) {
+		next = memchr(part, '&', end - part);
+		if (!next)
+			next = end;
+
+		*next = '\0';
+
+		/* Skip empty arguments, such as in "a=1&&b=2" */
+		if (next == part)
+			continue;
+
+		if (cmd->length == HTTP_MAX_PARAMS)
+			return HTTP_PARSER_ERROR_TOO_MANY_PARAMS;
+
+		param = &cmd->params[cmd->length++];
+		param->name = part;
+		param->value = NULL;
+		param->value_length = 0;
+
+		equals = memchr(part, '=', next - part);
+		if (equals) {
+			*equals = '\0';
+			if (equals + 1 < next) {
+				param->value = equals + 1;
+				param->value_length = next - equals - 1;
+			}
+		}
+
+		param->name_length = (equals ? equals : next) - part;
+		if (param->name_length == 0)
+			return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+		/* Check for duplicates. Names are only compared when their bits
+		 * collide, which for the handful of known names almost never happens. */
+		bit = http_param_bit(param->name, param->name_length);
+		if (seen & bit) {
+			for (http_cmd_param *other = cmd->params; other < param; other++) {
+				if (other->name_length == param->name_length &&
+					memcmp(other->name, param->name, param->name_length) == 0)
+					return HTTP_PARSER_ERROR_DUPLICATE_PARAMS;
+			}
+		}
+
+		seen |= bit;
+	}
+
+	return HTTP_PARSER_ERROR_SUCCESS;
+}
+
+size_t http_url_decode(char *str, size_t length) {
+	size_t in, out;
+	int high, low;
+
+	/* Decoding only ever shortens the string, so it is done in place */
+	for (in = out = 0; in < length; in++, out++) {
+		if (str[in] == '+')
+			str[out] = ' ';
+		else if (str[in] == '%' && in + 2 < length &&
+				 (high = http_hex_digit(str[in + 1])) != -1 &&
+				 (low = http_hex_digit(str[in + 2])) != -1) {
+			str[out] = (char)(high << 4 | low);
+			in += 2;
+		}
+		else
+			str[out] = str[in];
+	}
+
+	str[out] = '\0';
+	return out;
+}
+
+/* Conditional requests */
+bool http_etag_matches(const char *list, size_t length, const char *etag) {
+	size_t start, end, stop, etag_length;
+
+	if (!list)
+		return false;
+
+	/* Comparison is weak: "W/" prefixes do not matter */
+	if (strncmp(etag, "W/", 2) == 0)
+		etag += 2;
+
+	etag_length = strlen(etag);
+
+	/* Comma-separated list of entity tags, or "*" for any */
+	for (start = 0; start < length; start = end + 1) {
+		end = start;
+		while (end < length && list[end] != ',')
+			end++;
+
+		while (start < end && (list[start] == ' ' || list[start] == '\t'))
+			start++;
+
+		if (end - start == 1 && list[start] == '*')
+			return true;
+
+		if (end - start > 2 && strncmp(list + start, "W/", 2) == 0)
+			start += 2;
+
+		/* Trailing whitespace before the comma */
+		for (stop = end; stop > start && (list[stop - 1] == ' ' || list[stop - 1] == '\t');
+				stop--);
+
+		if (stop - start == etag_length && memcmp(list + start, etag, etag_length) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/* Internal helpers */
+static int http_parser_header_id(const char *name, size_t length) {
+	if (http_parser_token_equals(name, length, HTTP_HEADER_CONNECTION))
+		return HTTP_PARSER_HEADER_CONNECTION;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_CONTENT_LENGTH))
+		return HTTP_PARSER_HEADER_CONTENT_LEN;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_TRANSFER_ENCODING))
+		return HTTP_PARSER_HEADER_TRANSFER_ENC;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_ACCEPT_ENCODING))
+		return HTTP_PARSER_HEADER_ACCEPT_ENC;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_ACCEPT))
+		return HTTP_PARSER_HEADER_ACCEPT;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_IF_NONE_MATCH))
+		return HTTP_PARSER_HEADER_IF_NONE_MATCH;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_UPGRADE))
+		return HTTP_PARSER_HEADER_UPGRADE;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_WEBSOCKET_KEY))
+		return HTTP_PARSER_HEADER_WS_KEY;
+	else if (http_parser_token_equals(name, length, HTTP_HEADER_WEBSOCKET_VERSION))
+		return HTTP_PARSER_HEADER_WS_VERSION;
+
+	return HTTP_PARSER_HEADER_OTHER;
+}
+
+static int http_parser_header_value(http_parser *parser, const char *value, size_t length) {
+	size_t start, end, content_length = 0;
+
+	/* Trim trailing whitespace */
+	while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+		length--;
+
+	switch (parser->header) {
+		case HTTP_PARSER_HEADER_CONNECTION:
+			/* Comma-separated list of options */
+			for (start = 0; start < length; start = end + 1) {
+				end = start;
+				while (end < length && value[end] != ',')
+					end++;
+
+				while (start < end && (value[start] == ' ' || value[start] == '\t'))
+					start++;
+
+				if (http_parser_token_equals(value + start, end - start,
+							HTTP_CONNECTION_CLOSE))
+					parser->connection_close = true;
+				else if (http_parser_token_equals(value + start, end - start,
+							HTTP_CONNECTION_KEEP_ALIVE))
+					parser->connection_keep_alive = true;
+				else if (http_parser_token_equals(value + start, end - start,
+							HTTP_CONNECTION_UPGRADE))
+					parser->connection_upgrade = true;
+			}
+			break;
+
+		case HTTP_PARSER_HEADER_CONTENT_LEN:
+			/* Digits only; a second Content-Length is a smuggling attempt */
+			if (length == 0 || parser->has_content_length)
+				return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+			for (size_t i = 0; i < length; i++) {
+				if (value[i] < '0' || value[i] > '9')
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+				content_length = content_length * 10 + (value[i] - '0');
+				if (content_length > HTTP_BODY_MAX_SIZE)
+					return HTTP_PARSER_ERROR_BODY_TOO_LARGE;
+			}
+
+			parser->has_content_length = true;
+			parser->content_length = content_length;
+			break;
+
+		case HTTP_PARSER_HEADER_ACCEPT_ENC:
+			/* Comma-separated list of codings, each with an optional weight */
+			for (start = 0; start < length; start = end + 1) {
+				end = start;
+				while (end < length && value[end] != ',')
+					end++;
+
+				while (start < end && (value[start] == ' ' || value[start] == '\t'))
+					start++;
+
+				if (http_parser_coding_accepted(value + start, end - start))
+					parser->accept_gzip = true;
+			}
+			break;
+
+		case HTTP_PARSER_HEADER_ACCEPT:
+			/* Same list format. JSON is the default; wildcards do not ask
+			 * for anything else. */
+			for (start = 0; start < length; start = end + 1) {
+				end = start;
+				while (end < length && value[end] != ',')
+					end++;
+
+				while (start < end && (value[start] == ' ' || value[start] == '\t'))
+					start++;
+
+				if (http_parser_media_type_accepted(value + start, end - start))
+					parser->accept_cbor = true;
+			}
+			break;
+
+		case HTTP_PARSER_HEADER_IF_NONE_MATCH:
+			/* Only kept; it is compared once the response is known */
+			parser->if_none_match_start = parser->mark;
+			parser->if_none_match_length = length;
+			break;
+
+		case HTTP_PARSER_HEADER_UPGRADE:
+			/* The only protocol the server switches to */
+			parser->upgrade_websocket = http_parser_token_equals(value, length,
+					HTTP_UPGRADE_WEBSOCKET);
+			break;
+
+		case HTTP_PARSER_HEADER_WS_KEY:
+			parser->websocket_key_start = parser->mark;
+			parser->websocket_key_length = length;
+			break;
+
+		case HTTP_PARSER_HEADER_WS_VERSION:
+			parser->websocket_version = 0;
+			if (length == 0 || length > 3)
+				return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+			for (size_t i = 0; i < length; i++) {
+				if (value[i] < '0' || value[i] > '9')
+					return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+
+				parser->websocket_version = parser->websocket_version * 10 + (value[i] - '0');
+			}
+			break;
+
+		case HTTP_PARSER_HEADER_TRANSFER_ENC:
+			/* Chunked request bodies are not supported */
+			return HTTP_PARSER_ERROR_BAD_REQUEST_FORMAT;
+	}
+
+	return HTTP_PARSER_ERROR_SUCCESS;
+}
+
+static bool http_parser_token_equals(const char *token, size_t length, const char *str) {
+	return strlen(str) == length && strncasecmp(token, str, length) == 0;
+}
+
+static uint64_t http_param_bit(const char *name, size_t length) {
+	uint32_t hash = 2166136261u; /* FNV-1a */
+
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+	return (uint64_t)1 << (hash & 63);
+}
+
+static bool http_parser_coding_accepted(const char *coding, size_t length) {
+	const char *params = memchr(coding, ';', length);
+	size_t name_length = params ? (size_t)(params - coding) : length;
+
+	while (name_length > 0 && (coding[name_length - 1] == ' ' || coding[name_length - 1] == '\t'))
+		name_length--;
+
+	if (!http_parser_token_equals(coding, name_length, HTTP_CONTENT_CODING_GZIP) &&
+		!http_parser_token_equals(coding, name_length, HTTP_CONTENT_CODING_X_GZIP) &&
+		!http_parser_token_equals(coding, name_length, HTTP_CONTENT_CODING_ANY))
+		return false;
+
+	return http_parser_weight_accepted(params, coding + length);
+}
+
+static bool http_parser_media_type_accepted(const char *type, size_t length) {
+	const char *params = memchr(type, ';', length);
+	size_t name_length = params ? (size_t)(params - type) : length;
+
+	while (name_length > 0 && (type[name_length - 1] == ' ' || type[name_length - 1] == '\t'))
+		name_length--;
+
+	return http_parser_token_equals(type, name_length, HTTP_MEDIA_TYPE_CBOR) &&
+		http_parser_weight_accepted(params, type + length);
+}
+
+static bool http_parser_weight_accepted(const char *params, const char *end) {
+	const char *q;
+
+	if (!params)
+		return true;
+
+	/* "q=0" (or 0.0, 0.00...) means "not acceptable" */
+	for (q = params + 1; q < end && (*q == ' ' || *q == '\t'); q++);
+	if (q + 1 >= end || (*q != 'q' && *q != 'Q') || q[1] != '=')
+		return true;
+
+	for (q += 2; q < end; q++)
+		if (*q != '0' && *q != '.' && *q != ' ' && *q != '\t')
+			return true;
+
+	return false;
+}
+
+static int http_hex_digit(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
@@ -17,309 +17,2582 @@
 #include "listener.h"
 
 static pthread_t __listener_thread_id;
-static int __num_workers;
-static mqd_t __worker_mqueue;
-static pthread_t *__workers;
+static pthread_t __pool_thread_id;
+static bool __has_listener_thread;
+static bool __has_pool_thread;
+static int __pool_capacity;
+static int __pool_min;
+static int __pool_size;
+static int __pool_idle_intervals;
+static uint64_t __pool_wait_usec;
+static unsigned int __pool_depth;
+static int __next_worker;
+static int __listener_sockfd = -1;
+static int __unix_sockfd = -1;
+static char __unix_socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static int __comm_port;
+static bool __reuseport;
+static rpiwd_worker *__workers;
+
+/* Event stream publishing. Samples come from the DB thread, which must not
+ * look at a worker that is going away. */
+static pthread_mutex_t __stream_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t __stream_evictions;
 
 /* Host table mutex */
 static pthread_mutex_t host_table_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 /* =================================================================================== */
 
-/* Command callback table */
+/* Command callback table, and the names to look commands and parameters up by */
+#define CMD_CALLBACK_ENTRY(name, callback, bucket)  { name, callback, bucket },
+#define CMD_CALLBACK_NAME(name, callback, bucket)   name,
+#define FETCH_PARAM_NAME(id, name)                  name,
+
 static cmd_callback CMD_CALLBACK_TABLE[] = {
-	{ "fetch", fetch_command_callback },
-	{ "current", current_command_callback },
-	{ "statistics", statistics_command_callback },
-	{ "config", config_command_callback },
-	{ NULL, NULL }
+	LISTENER_COMMANDS(CMD_CALLBACK_ENTRY)
+	{ NULL, NULL, RATELIMIT_BUCKET_NONE }
 };
 
+static const char *const CMD_CALLBACK_NAMES[] = { LISTENER_COMMANDS(CMD_CALLBACK_NAME) };
+static const char *const FETCH_PARAM_NAMES[] = { FETCH_PARAMS(FETCH_PARAM_NAME) };
+
+static rpiwd_perfect_hash __command_hash, __fetch_param_hash;
+static pthread_once_t __dispatch_tables_once = PTHREAD_ONCE_INIT;
+
 /* =================================================================================== */
 
 /* Init/quit */
-void init_listener_loop(int num_worker_threads, int comm_port) {
-	/* Initialize main worker thread */
-	int result = pthread_create(&__listener_thread_id, NULL, main_listener_loop,
-			(void *)comm_port);
+void init_listener_loop(int num_worker_threads, int min_worker_threads,
+		int max_worker_threads, int comm_port, bool reuseport, const char *unix_socket) {
+	rpiwd_worker *workers;
+	int result, i;
+
+	/* Set worker pool bounds globally */
+	if (max_worker_threads > MAX_WORKER_THREADS) {
+        rpiwd_log(LOG_WARNING, "max_worker_threads is bigger then %d; using max instead.",
+				MAX_WORKER_THREADS);
+		max_worker_threads = MAX_WORKER_THREADS;
+	}
+
+	if (num_worker_threads > max_worker_threads)
+		num_worker_threads = max_worker_threads;
+
+	if (min_worker_threads > num_worker_threads)
+		min_worker_threads = num_worker_threads;
+
+	__pool_capacity = max_worker_threads;
+	__pool_min = min_worker_threads;
+	__pool_size = 0;
+	__pool_idle_intervals = 0;
+	__pool_wait_usec = 0;
+	__pool_depth = 0;
+	__next_worker = 0;
+	__comm_port = comm_port;
+	__reuseport = reuseport;
+	__has_listener_thread = __has_pool_thread = false;
+
+	/* Responses are built in the arena of their connection (see
+	 * worker_complete_request()); parson asks the calling thread for it */
+	json_set_allocation_functions(arena_current_malloc, arena_current_free);
+
+	/* Command lookup tables */
+	pthread_once(&__dispatch_tables_once, init_dispatch_tables);
+
+	/* New samples go out to event stream subscribers */
+	dbhandler_set_write_hook(listener_publish_sample);
+
+#ifndef SO_REUSEPORT
+	if (__reuseport) {
+        rpiwd_log(LOG_WARNING, "SO_REUSEPORT is not supported; using a single acceptor.");
+		__reuseport = false;
+	}
+#endif /* SO_REUSEPORT */
+
+	/* Initialize worker thread array; one slot for every worker the pool may grow to */
+	workers = calloc(__pool_capacity, sizeof(rpiwd_worker));
+	if (!workers) {
+        rpiwd_log(LOG_ERR, "Unable to allocate worker thread descriptor array: %s",
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_mutex_lock(&__stream_mtx);
+	__workers = workers;
+	pthread_mutex_unlock(&__stream_mtx);
+
+	/* Initialize the initial set of worker threads.
+	 * In SO_REUSEPORT mode every worker binds and accepts on its own socket. */
+	for (i = 0; i < num_worker_threads; i++) {
+		if (init_worker(&__workers[i], i, __reuseport ? comm_port : -1) == -1)
+			exit(EXIT_FAILURE);
+
+		__pool_size++;
+	}
+
+	/* Local clients may skip TCP altogether. Sockets kept over a reload are
+	 * still open. */
+	if (unix_socket && __unix_sockfd == -1) {
+		__unix_sockfd = get_unix_socket(unix_socket);
+		if (__unix_sockfd == -1) {
+            rpiwd_log(LOG_ERR, "Could not bind UNIX socket %s: %s", unix_socket,
+					strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (__reuseport && __unix_sockfd == -1) {
+		/* Without an acceptor thread, a separate thread manages the pool */
+		if (__pool_capacity > __pool_size) {
+			result = pthread_create(&__pool_thread_id, NULL, pool_manager_loop, NULL);
+			if (result != 0) {
+                rpiwd_log(LOG_ERR, "Unable to create pool manager thread: %s.",
+						strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+
+			__has_pool_thread = true;
+		}
+
+		return;
+	}
+
+	/* Prepare main listener socket. In SO_REUSEPORT mode the workers accept
+	 * TCP connections themselves, and this thread only takes local ones. */
+	if (!__reuseport && __listener_sockfd == -1) {
+		__listener_sockfd = get_bound_socket(comm_port, false);
+		if (__listener_sockfd == -1) {
+            rpiwd_log(LOG_ERR, "Could not get bound socket: %s", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Initialize main listener thread */
+	result = pthread_create(&__listener_thread_id, NULL, main_listener_loop, NULL);
 
 	if (result != 0) {
         rpiwd_log(LOG_ERR, "Unable to create main listener thread: %s.", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 
-	/* Set worker thread count globally */
-	if (num_worker_threads > MAX_WORKER_THREADS) {
-        rpiwd_log(LOG_WARNING, "num_worker_threads is bigger then %d; using max instead.",
-				MAX_WORKER_THREADS);
-		num_worker_threads = MAX_WORKER_THREADS;
+	__has_listener_thread = true;
+}
+
+void reload_listener_loop(int num_worker_threads, int min_worker_threads,
+		int max_worker_threads, int comm_port, bool reuseport, const char *unix_socket) {
+	const char *current_unix_socket = __unix_sockfd != -1 ? __unix_socket_path : NULL;
+	bool same_unix_socket = unix_socket && current_unix_socket ?
+		strcmp(unix_socket, current_unix_socket) == 0 : unix_socket == current_unix_socket;
+
+	/* Clamped as on startup, so the comparison below sees the same values */
+	if (max_worker_threads > MAX_WORKER_THREADS)
+		max_worker_threads = MAX_WORKER_THREADS;
+
+	if (num_worker_threads > max_worker_threads)
+		num_worker_threads = max_worker_threads;
+
+	if (min_worker_threads > num_worker_threads)
+		min_worker_threads = num_worker_threads;
+
+	/* Everything else is read from the configuration as it is needed, and the
+	 * pool adjusts to a new lower bound by itself */
+	if (comm_port == __comm_port && reuseport == __reuseport &&
+		max_worker_threads == __pool_capacity && same_unix_socket) {
+		__atomic_store_n(&__pool_min, min_worker_threads, __ATOMIC_RELAXED);
+		return;
+	}
+
+	/* Stop accepting, but keep the sockets that stay the same. Clients that
+	 * connect meanwhile wait in the backlog instead of being refused. */
+	listener_stop_threads();
+	pool_drain_workers(LISTENER_DRAIN_TIMEOUT);
+
+	pthread_mutex_lock(&__stream_mtx);
+	free(__workers);
+	__workers = NULL;
+	pthread_mutex_unlock(&__stream_mtx);
+
+	if (__listener_sockfd != -1 && (comm_port != __comm_port || reuseport)) {
+		close(__listener_sockfd);
+		__listener_sockfd = -1;
 	}
 
-	__num_workers = num_worker_threads;
+	if (!same_unix_socket)
+		listener_close_unix_socket();
+
+    rpiwd_log(LOG_INFO, "listener settings changed; restarting the listener.");
+	init_listener_loop(num_worker_threads, min_worker_threads, max_worker_threads,
+			comm_port, reuseport, unix_socket);
 }
 
 void quit_listener_loop(void) {
-	int flag = 0;
+	void *retval;
 
-	/* Cancel main listener thread.
-	 * That thread's cleanup routine will make sure to cancel all worker threads. */
-	flag = pthread_cancel(__listener_thread_id);
-	pthread_join(__listener_thread_id, NULL);
+	dbhandler_set_write_hook(NULL);
+	listener_stop_threads();
 
-	/* Check return flag */
-	if (flag == -1)
-        rpiwd_log(LOG_ERR, "listener thread terminated with an error.");
+	/* Cancel all worker threads, including those that are retiring or already done */
+	for (int i = 0; i < __pool_capacity; i++) {
+		if (__atomic_load_n(&__workers[i].state, __ATOMIC_ACQUIRE) == WORKER_STATE_FREE)
+			continue;
+
+		pthread_cancel(__workers[i].thread_id);
+		pthread_join(__workers[i].thread_id, &retval);
+	}
 
 	/* Free descriptor array pointer */
+	pthread_mutex_lock(&__stream_mtx);
 	free(__workers);
+	__workers = NULL;
+	pthread_mutex_unlock(&__stream_mtx);
+
+	/* Close listener sockets */
+	if (__listener_sockfd != -1)
+		close(__listener_sockfd);
+
+	__listener_sockfd = -1;
+	listener_close_unix_socket();
 }
 
-/* Main listener loop callback passed to pthread_create() */
-void *main_listener_loop(void *comm_port) {
+void listener_stop_threads(void) {
+	int flag = 0;
+
+	/* Cancel main listener thread, if there is one */
+	if (__has_listener_thread) {
+		flag = pthread_cancel(__listener_thread_id);
+		pthread_join(__listener_thread_id, NULL);
+
+		/* Check return flag */
+		if (flag == -1)
+            rpiwd_log(LOG_ERR, "listener thread terminated with an error.");
+	}
+	else if (__has_pool_thread) {
+		pthread_cancel(__pool_thread_id);
+		pthread_join(__pool_thread_id, NULL);
+	}
+
+	__has_listener_thread = __has_pool_thread = false;
+}
+
+void listener_publish_sample(const entry *ent) {
+	stream_sample *sample;
+	rpiwd_mqmsg msgbuff;
+	rpiwd_worker *worker;
 	int oldstate;
-	int i, flag;
-	void *retval;
-	int sockfd, clientsock;
-	socklen_t addrlen;
-	struct mq_attr attr;
-	struct sockaddr_storage claddr;
-	struct timeval tv = { .tv_sec = DEFAULT_SOCKET_TIMEOUT, .tv_usec = 0 };
-	char host[RPIWD_MAXHOST];
+
+	/* The latest reading is a row now; current values say which */
+	device_sample_written((float [DEVICE_SAMPLE_VALUES]){ ent->temperature, ent->humidity },
+			ent->id);
+
+	sample = stream_sample_alloc(ent, get_unit_string());
+	if (!sample)
+		return;
+
+	/* Hand the sample to every worker with subscribers. The lock must not be
+	 * left behind by a cancelled DB thread. */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	pthread_mutex_lock(&__stream_mtx);
+
+	/* The row is in; either a worker parking a long poll sees it, or this
+	 * sees the worker's subscriber (see worker_park_request()) */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (int i = 0; __workers && i < __pool_capacity; i++) {
+		worker = &__workers[i];
+		if (__atomic_load_n(&worker->subscribers, __ATOMIC_ACQUIRE) == 0)
+			continue;
+
+		rpiwd_mqmsg_init(&msgbuff);
+		msgbuff.mtype = DB_MSGTYPE_SAMPLE;
+		msgbuff.sockfd = DB_MSG_NO_SOCKFD;
+		msgbuff.data = sample;
+
+		/* A worker this far behind misses the sample; its subscribers can
+		 * tell by the gap in IDs */
+		__atomic_add_fetch(&sample->refcount, 1, __ATOMIC_RELAXED);
+		if (!rpiwd_msgring_try_push(&worker->completions, &msgbuff)) {
+			__atomic_sub_fetch(&sample->refcount, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		rpiwd_msgring_notify(&worker->completions);
+	}
+
+	pthread_mutex_unlock(&__stream_mtx);
+	pthread_setcancelstate(oldstate, NULL);
+
+	stream_sample_release(sample);
+}
+
+void listener_publish_reading(void) {
 	rpiwd_mqmsg msgbuff;
+	rpiwd_worker *worker;
 
-	/* Initialize worker thread array */
-	__workers = malloc(sizeof(pthread_t) * __num_workers);
-	if (!__workers) {
-        rpiwd_log(LOG_ERR, "Unable to allocate worker thread descriptor array: %s",
-				strerror(errno));
-		return (void *) -1;
+	pthread_mutex_lock(&__stream_mtx);
+
+	/* The reading is the latest one now; either a worker parking a request
+	 * sees it, or this sees the worker's subscriber */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	for (int i = 0; __workers && i < __pool_capacity; i++) {
+		worker = &__workers[i];
+		if (__atomic_load_n(&worker->subscribers, __ATOMIC_ACQUIRE) == 0)
+			continue;
+
+		rpiwd_mqmsg_init(&msgbuff);
+		msgbuff.mtype = DB_MSGTYPE_READING;
+		msgbuff.sockfd = DB_MSG_NO_SOCKFD;
+
+		/* A worker this far behind answers its requests once they time out;
+		 * the reading is still there then */
+		if (rpiwd_msgring_try_push(&worker->completions, &msgbuff))
+			rpiwd_msgring_notify(&worker->completions);
 	}
 
-	/* Initialize the message queue used by the workers */
-	attr.mq_flags = attr.mq_curmsgs = 0;
-	attr.mq_maxmsg = LISTENER_MQUEUE_MAX_MESSAGES;
-	attr.mq_msgsize = LISTENER_MAX_MESSAGE_SIZE;
-	__worker_mqueue = mq_open(RPIWD_WORKER_QUEUE_NAME, O_CREAT | O_RDWR, 0666, &attr);
-	if (__worker_mqueue == (mqd_t) -1) {
-        rpiwd_log(LOG_ERR, "error creating worker thread queue: %s", strerror(errno));
-		return (void * )-1;
+	pthread_mutex_unlock(&__stream_mtx);
+}
+
+stream_sample *stream_sample_alloc(const entry *ent, const char *unitstr) {
+	const char *record_date = ent->record_date ? ent->record_date : "",
+		  *location = ent->location ? ent->location : "",
+		  *device_name = ent->device_name ? ent->device_name : "";
+	size_t date_length = strlen(record_date) + 1, location_length = strlen(location) + 1,
+		   device_length = strlen(device_name) + 1;
+	stream_sample *sample;
+	char *strings;
+	strbuf buf;
+
+	/* The sample and its strings in one block */
+	sample = malloc(sizeof(stream_sample) + date_length + location_length + device_length);
+	if (!sample)
+		return NULL;
+
+	strings = (char *)(sample + 1);
+	sample->ent = *ent;
+	sample->celsius = ent->temperature;
+	sample->ent.record_date = memcpy(strings, record_date, date_length);
+	sample->ent.location = memcpy(strings + date_length, location, location_length);
+	sample->ent.device_name = memcpy(strings + date_length + location_length, device_name,
+			device_length);
+	memcpy(sample->unitstr, unitstr, sizeof(sample->unitstr));
+	sample->refcount = 1;
+
+	/* Samples are stored in Celsius; subscribers get the configured unit */
+	if (unitstr[RPIWD_MEASURE_TEMPERATURE] != RPIWD_TEMPERATURE_CELSIUS)
+		RPIWD_CELSIUS_TO_FARENHEIT(sample->ent.temperature);
+
+	/* The event data is the same document a fetch of this one sample returns */
+	if (strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY) == -1) {
+		free(sample);
+		return NULL;
 	}
 
-	/* Initialize each one of the worker threads */
-	for (i = 0; i < __num_workers; i++) {
-		flag = pthread_create(&__workers[i], NULL, worker_listener_loop, NULL);
-		if (flag != 0) {
-            rpiwd_log(LOG_ERR, "error creating worker thread: %s", strerror(errno));
-			return (void *) -2;
-		}
+	if (entrylist_json_stream_begin(&buf, sample->unitstr) == -1 ||
+		entry_json_stream_append(&buf, &sample->ent, true) == -1 ||
+		entrylist_json_stream_end(&buf, 1) == -1) {
+		strbuf_free(&buf);
+		free(sample);
+		return NULL;
+	}
+
+	sample->event = make_event((unsigned long long)sample->ent.id, buf.data);
+	strbuf_free(&buf);
+	if (!sample->event) {
+		free(sample);
+		return NULL;
+	}
+
+	return sample;
+}
+
+void stream_sample_release(stream_sample *sample) {
+	if (__atomic_sub_fetch(&sample->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	free(sample->event);
+	free(sample);
+}
+
+char *stream_samples_to_json(stream_sample **samples, size_t count,
+		const websocket_filter *filter, size_t *length) {
+	size_t matched = 0;
+	strbuf buf;
+	int flag;
+
+	if (strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY) == -1)
+		return NULL;
+
+	/* The data is what a fetch of these samples returns */
+	flag = strbuf_append(&buf, STREAM_SAMPLES_PREFIX, strlen(STREAM_SAMPLES_PREFIX));
+	flag = flag == -1 ? -1 : entrylist_json_stream_begin(&buf, samples[0]->unitstr);
+
+	for (size_t i = 0; i < count && flag != -1; i++) {
+		if (filter && !websocket_filter_matches(filter, &samples[i]->ent))
+			continue;
+
+		flag = entry_json_stream_append(&buf, &samples[i]->ent, matched++ == 0);
+	}
+
+	flag = flag == -1 ? -1 : entrylist_json_stream_end(&buf, matched);
+	flag = flag == -1 ? -1 : strbuf_append(&buf, "}", 1);
+
+	/* Nothing to send */
+	if (flag == -1 || matched == 0) {
+		strbuf_free(&buf);
+		return NULL;
 	}
 
+	*length = buf.length;
+	return strbuf_release(&buf);
+}
+
+void listener_close_unix_socket(void) {
+	if (__unix_sockfd == -1)
+		return;
+
+	close(__unix_sockfd);
+	unlink(__unix_socket_path);
+
+	__unix_sockfd = -1;
+}
+
+/* Main listener loop callback passed to pthread_create() */
+void *main_listener_loop(void *unused) {
+	int oldstate, flag;
+	struct pollfd pfd[2];
+	uint64_t last_tick = rpiwd_monotonic_usec(), now, elapsed;
+
 	/* Set thread cancelability */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &oldstate);
 
-	/* Prepare main listener socket */
-	sockfd = get_bound_socket((int)comm_port);
-	if (sockfd == -1) {
-        rpiwd_log(LOG_ERR, "Could not get bound socket: %s", strerror(errno));
-		return (void *) -1;
+	/* Listen. The sockets outlive this thread, as they may be kept over a
+	 * reload; quit_listener_loop() closes them. poll() skips whichever
+	 * socket is not in use (-1). */
+	if (__listener_sockfd != -1)
+		listen(__listener_sockfd, SOMAXCONN);
+
+	pfd[0].fd = __listener_sockfd;
+	pfd[1].fd = __unix_sockfd;
+	pfd[0].events = pfd[1].events = POLLIN;
+
+	/* Main listener loop */
+	for (;;) {
+		/* Wait for a connection, but wake up once per interval to manage the
+		 * worker pool. This thread is the only one that changes the pool. */
+		elapsed = rpiwd_monotonic_usec() - last_tick;
+		flag = poll(pfd, 2, elapsed >= POOL_MANAGER_INTERVAL * 1000 ? 0 :
+				(POOL_MANAGER_INTERVAL * 1000 - elapsed + 999) / 1000);
+
+		now = rpiwd_monotonic_usec();
+		if (now - last_tick >= POOL_MANAGER_INTERVAL * 1000) {
+			pool_manager_tick(!__reuseport); /* See pool_manager_loop() */
+			last_tick = now;
+		}
+
+		if (flag <= 0) {
+			if (flag == -1 && errno != EINTR)
+                rpiwd_log(LOG_ERR, "error polling listener socket: %s", strerror(errno));
+
+			continue;
+		}
+
+		for (int i = 0; i < 2; i++)
+			if (pfd[i].revents & POLLIN)
+				listener_accept_connection(pfd[i].fd);
+	}
+
+	return (void *) 0;
+}
+
+void listener_accept_connection(int sockfd) {
+	int clientsock;
+	socklen_t addrlen;
+	struct sockaddr_storage claddr;
+	struct epoll_event ev;
+	rpiwd_conn *conn;
+	rpiwd_worker *worker;
+
+	/* Accept connection and pass it immediately to the next worker thread. */
+	addrlen = sizeof(struct sockaddr_storage);
+	clientsock = accept(sockfd, (struct sockaddr *)&claddr, &addrlen);
+	if (clientsock == -1) {
+        rpiwd_log(LOG_ERR, "error accepting connection: %s", strerror(errno));
+		return;
 	}
 
-	/* Register cleanup handler */
-	pthread_cleanup_push(listener_loop_cleanup_routine, (void *)sockfd);
+	/* Workers never block on a client, so the socket must be non-blocking */
+	if (conn_set_nonblocking(clientsock) == -1) {
+		rpiwd_log(LOG_ERR, "error setting socket flags: %s", strerror(errno));
+		close(clientsock);
+		return;
+	}
 
-	/* Listen */
-	listen(sockfd, SOMAXCONN);
+	conn = conn_alloc(clientsock);
+	if (!conn) {
+		rpiwd_log(LOG_ERR, "Unable to allocate connection: %s", strerror(errno));
+		close(clientsock);
+		return;
+	}
 
-	/* Main listener loop */
+	/* Requests are rate limited by the client's address; all local clients
+	 * share one */
+	ratelimit_key_from_sockaddr(&conn->peer, (struct sockaddr *)&claddr);
+
+	/* Register the socket directly in the worker's epoll set (round-robin).
+	 * A freshly connected socket is always writable, so the worker is
+	 * guaranteed an initial event and adopts the connection from there. */
+	worker = pool_next_worker();
+
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+	ev.data.ptr = conn;
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, clientsock, &ev) == -1) {
+		rpiwd_log(LOG_ERR, "error registering connection: %s", strerror(errno));
+		close(clientsock);
+		conn_free(conn);
+	}
+}
+
+/* Worker pool management */
+void pool_manager_tick(bool can_shrink) {
+	uint64_t wait_usec = 0, wait_samples = 0, events = 0, avg_wait;
+	unsigned int depth = 0, worker_depth;
+	rpiwd_worker *worker;
+
+	/* Join workers that finished retiring */
+	pool_reap_workers();
+
+	/* Collect (and reset) the load counters of the last interval */
+	for (int i = 0; i < __pool_capacity; i++) {
+		worker = &__workers[i];
+		if (__atomic_load_n(&worker->state, __ATOMIC_ACQUIRE) != WORKER_STATE_RUNNING)
+			continue;
+
+		wait_usec += __atomic_exchange_n(&worker->wait_usec, 0, __ATOMIC_RELAXED);
+		wait_samples += __atomic_exchange_n(&worker->wait_samples, 0, __ATOMIC_RELAXED);
+		events += __atomic_exchange_n(&worker->events, 0, __ATOMIC_RELAXED);
+
+		worker_depth = __atomic_exchange_n(&worker->max_depth, 0, __ATOMIC_RELAXED);
+		if (worker_depth > depth)
+			depth = worker_depth;
+	}
+
+	avg_wait = wait_samples > 0 ? wait_usec / wait_samples : 0;
+	__atomic_store_n(&__pool_wait_usec, avg_wait, __ATOMIC_RELAXED);
+	__atomic_store_n(&__pool_depth, depth, __ATOMIC_RELAXED);
+
+	/* Grow as soon as events wait too long or pile up... */
+	if (avg_wait >= POOL_GROW_WAIT_THRESHOLD || depth >= POOL_GROW_DEPTH_THRESHOLD) {
+		__pool_idle_intervals = 0;
+
+		if (__pool_size < __pool_capacity && pool_grow() == 1)
+            rpiwd_log(LOG_INFO, "worker pool grown to %d (wait %lluus, depth %u)",
+					__pool_size, (unsigned long long)avg_wait, depth);
+	}
+	/* ...but shrink only after being idle for a while */
+	else if (can_shrink && events < (uint64_t)POOL_IDLE_EVENTS_PER_WORKER * __pool_size) {
+		if (++__pool_idle_intervals >= POOL_SHRINK_IDLE_INTERVALS) {
+			__pool_idle_intervals = 0;
+
+			if (__pool_size > __atomic_load_n(&__pool_min, __ATOMIC_RELAXED)) {
+				pool_retire_worker();
+                rpiwd_log(LOG_INFO, "worker pool shrunk to %d", __pool_size);
+			}
+		}
+	}
+	else
+		__pool_idle_intervals = 0;
+}
+
+void *pool_manager_loop(void *unused) {
+	int oldstate;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &oldstate);
+
+	/* Closing a SO_REUSEPORT socket drops the connections in its backlog,
+	 * so in that mode the pool only ever grows. */
 	for (;;) {
-		/* Accept connection and pass it immediately to a currently
-		 * available worker thread. */
-		addrlen = sizeof(struct sockaddr_storage);
-		clientsock = accept(sockfd, (struct sockaddr *)&claddr, &addrlen);
-		if (clientsock == -1) {
-            rpiwd_log(LOG_ERR, "error accepting connection: %s", strerror(errno));
+		rpiwd_sleep(POOL_MANAGER_INTERVAL); /* Cancellation point */
+		pool_manager_tick(false);
+	}
+
+	return (void *) 0;
+}
+
+int pool_grow(void) {
+	int expected;
+
+	/* Take back a worker that is still draining its connections, if any */
+	for (int i = 0; i < __pool_capacity; i++) {
+		expected = WORKER_STATE_RETIRING;
+		if (__atomic_compare_exchange_n(&__workers[i].state, &expected,
+					WORKER_STATE_RUNNING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_add_fetch(&__pool_size, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	}
+
+	/* Otherwise start a new worker in a free slot */
+	for (int i = 0; i < __pool_capacity; i++) {
+		if (__atomic_load_n(&__workers[i].state, __ATOMIC_ACQUIRE) != WORKER_STATE_FREE)
 			continue;
+
+		if (init_worker(&__workers[i], i, __reuseport ? __comm_port : -1) == -1)
+			return -1;
+
+		__atomic_add_fetch(&__pool_size, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	return -1;
+}
+
+void pool_retire_worker(void) {
+	int expected;
+
+	/* Retire the last running worker. It stops getting new connections right away
+	 * and exits on its own once its connections are gone. */
+	for (int i = __pool_capacity - 1; i >= 0; i--) {
+		expected = WORKER_STATE_RUNNING;
+		if (__atomic_compare_exchange_n(&__workers[i].state, &expected,
+					WORKER_STATE_RETIRING, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_sub_fetch(&__pool_size, 1, __ATOMIC_RELAXED);
+			return;
 		}
+	}
+}
+
+void pool_drain_workers(int timeout_ms) {
+	uint64_t deadline = rpiwd_monotonic_usec() + timeout_ms * 1000ULL;
+	int expected, remaining;
+
+	/* Retire every worker. Each one answers the requests it has and leaves
+	 * once its connections are gone. */
+	for (int i = 0; i < __pool_capacity; i++) {
+		expected = WORKER_STATE_RUNNING;
+		__atomic_compare_exchange_n(&__workers[i].state, &expected, WORKER_STATE_RETIRING,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	}
+
+	__atomic_store_n(&__pool_size, 0, __ATOMIC_RELAXED);
+
+	for (;;) {
+		pool_reap_workers();
 
-		/* Set socket timeout */
-		setsockopt(clientsock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, 
-				sizeof(struct timeval));
+		remaining = 0;
+		for (int i = 0; i < __pool_capacity; i++)
+			if (__atomic_load_n(&__workers[i].state, __ATOMIC_ACQUIRE) != WORKER_STATE_FREE)
+				remaining++;
 
-        /* Build message */
-        rpiwd_mqmsg_init(&msgbuff);
-        msgbuff.sockfd = clientsock;
-        msgbuff.receiver_mq = __worker_mqueue;
+		if (remaining == 0 || rpiwd_monotonic_usec() >= deadline)
+			break;
 
-		/* Send to workers queue */
-		mq_send(__worker_mqueue, (const char *)&msgbuff, sizeof(rpiwd_mqmsg), 0);
+		rpiwd_sleep(LISTENER_DRAIN_POLL_INTERVAL);
 	}
 
-	/* Cleanup */
-	pthread_cleanup_pop(0);
+	if (remaining == 0)
+		return;
+
+	/* Cut short whatever is left. Workers are not cancelled: requests they
+	 * have in the DB thread are answered into their queues, so each one
+	 * closes its connections and leaves once those answers are in. */
+    rpiwd_log(LOG_WARNING, "%d workers still busy after %d ms; closing their connections.",
+			remaining, timeout_ms);
+
+	for (int i = 0; i < __pool_capacity; i++)
+		__atomic_store_n(&__workers[i].close_all, true, __ATOMIC_RELEASE);
+
+	do {
+		rpiwd_sleep(LISTENER_DRAIN_POLL_INTERVAL);
+		pool_reap_workers();
+
+		remaining = 0;
+		for (int i = 0; i < __pool_capacity; i++)
+			if (__atomic_load_n(&__workers[i].state, __ATOMIC_ACQUIRE) != WORKER_STATE_FREE)
+				remaining++;
+	} while (remaining > 0);
 }
 
-void listener_loop_cleanup_routine(void *arg) {
-	int sockfd = (int)arg;
-	void *retval;
+void pool_reap_workers(void) {
+	for (int i = 0; i < __pool_capacity; i++) {
+		if (__atomic_load_n(&__workers[i].state, __ATOMIC_ACQUIRE) != WORKER_STATE_EXITED)
+			continue;
 
-	/* Cancel all worker threads */
-	for (int i = 0; i < __num_workers; i++) {
-		pthread_cancel(__workers[i]);
-		pthread_join(__workers[i], &retval);
+		pthread_join(__workers[i].thread_id, NULL);
+		__atomic_store_n(&__workers[i].state, WORKER_STATE_FREE, __ATOMIC_RELEASE);
 	}
+}
+
+rpiwd_worker *pool_next_worker(void) {
+	rpiwd_worker *worker;
 
-	/* Close main listener socket */
-	close(sockfd);
+	/* Round-robin over running workers; there is always at least one */
+	for (int i = 0; i < __pool_capacity; i++) {
+		worker = &__workers[__next_worker];
+		__next_worker = (__next_worker + 1) % __pool_capacity;
+
+		if (__atomic_load_n(&worker->state, __ATOMIC_ACQUIRE) == WORKER_STATE_RUNNING)
+			return worker;
+	}
 
-	/* Quit listener queue */
-	quit_listener_mq();
+	return &__workers[0];
 }
 
-void quit_listener_mq(void) {
-	/* Cleanup */
-	mq_close(__worker_mqueue);
-	mq_unlink(RPIWD_WORKER_QUEUE_NAME);
+int pool_size(void) {
+	return __atomic_load_n(&__pool_size, __ATOMIC_RELAXED);
 }
 
-void *worker_listener_loop(void *arg) {
-	rpiwd_mqmsg msgbuff;
-	http_cmd *cmd;
-	ssize_t flag = 0;
-	int cmd_status = 0, response = HTTP_PARSER_ERROR_SUCCESS, is_eof = 0;
-	JSON_Value *jval = NULL;
+uint64_t pool_queue_wait(void) {
+	return __atomic_load_n(&__pool_wait_usec, __ATOMIC_RELAXED);
+}
 
-	while ((flag = mq_receive(__worker_mqueue, (char *)&msgbuff, MQ_MAXMSGSIZE,
-					NULL)) != -1) {
-		/* Check if request is completed */
-		if (!msgbuff.is_completed) {
-			/* Read and parse HTTP request */
-			cmd = read_and_parse_response(msgbuff.sockfd, &response, &is_eof);
-			if (!cmd) {
-				if (!is_eof) {
-					/* Check response code */
-					send_http_error_response(msgbuff.sockfd, 
-							HTTP_CODE_REQUEST_BAD_REQUEST,
-							HTTP_CODE_REQUEST_BAD_REQUEST,
-							http_parser_strerror(response));
-				}
+unsigned int pool_queue_depth(void) {
+	return __atomic_load_n(&__pool_depth, __ATOMIC_RELAXED);
+}
 
-				/* Finish response */
-				end_response(msgbuff.sockfd, cmd);
+unsigned int pool_subscribers(void) {
+	unsigned int count = 0;
 
-				continue;
-			}
+	/* Only called by workers, so the array stays put */
+	for (int i = 0; i < __pool_capacity; i++)
+		count += __atomic_load_n(&__workers[i].subscribers, __ATOMIC_RELAXED);
 
-			/* Check if the command is any "special" browser stuff.
-			 * Might be a request for a favico.ico, text/html (Midori does this),
-			 * etc. */
-			if (strcmp(cmd->cmdname, "favicon.ico") == 0 || 
-				strcmp(cmd->cmdname, "text-html") == 0) {
-				/* Send 204 No Content */
-				send_response(msgbuff.sockfd, HTTP_CODE_NO_CONTENT, NULL);
+	return count;
+}
 
-				/* Finish response */
-				end_response(msgbuff.sockfd, cmd);
+uint64_t pool_stream_evictions(void) {
+	return __atomic_load_n(&__stream_evictions, __ATOMIC_RELAXED);
+}
 
-				continue;
-            }
+/* Worker init/quit */
+int init_worker(rpiwd_worker *worker, int id, int comm_port) {
+	struct epoll_event ev;
+	int flag;
+
+	worker->id = id;
+	worker->listener_sockfd = -1;
+	worker->connections = worker->graveyard = NULL;
+	worker->cancels = NULL;
+	__atomic_store_n(&worker->subscribers, 0, __ATOMIC_RELAXED);
+	worker->inflight = 0;
+	__atomic_store_n(&worker->close_all, false, __ATOMIC_RELAXED);
+	worker->wait_usec = worker->wait_samples = worker->events = 0;
+	worker->max_depth = 0;
+	timerwheel_init(&worker->timers, rpiwd_monotonic_usec() / 1000);
+
+	/* Create the worker's epoll instance */
+	worker->epfd = epoll_create1(0);
+	if (worker->epfd == -1) {
+        rpiwd_log(LOG_ERR, "error creating worker epoll instance: %s", strerror(errno));
+		return -1;
+	}
 
-			/* Dispatch command callback */
-			cmd_status = dispatch_command(cmd, &msgbuff);
-			if (cmd_status != CALLBACK_RETCODE_SUCCESS) {
-				flag = send_http_error_response(msgbuff.sockfd, 
-						HTTP_CODE_REQUEST_BAD_REQUEST,
-						cmd_status,
-						command_callback_strerror(cmd_status));
-				
-				/* Free all */
-				end_response(msgbuff.sockfd, cmd);
+	/* Initialize the queue used to hand completed requests back to the worker.
+	 * Its eventfd is non-blocking and watched by epoll; it is registered with a
+	 * NULL pointer to tell it apart from connections. */
+	if (rpiwd_msgring_init(&worker->completions, LISTENER_QUEUE_CAPACITY, true) == -1) {
+        rpiwd_log(LOG_ERR, "error creating worker thread queue: %s", strerror(errno));
+		return -1;
+	}
 
-				continue;
-			}
-			
-			/* Send to DB thread to finish processing (if needed) */
-			if (msgbuff.mtype == DB_MSGTYPE_FETCH || msgbuff.mtype == DB_MSGTYPE_STATS)
-				mq_send(__db_mqd, (const char *)&msgbuff, sizeof(rpiwd_mqmsg), 0);
-			else
-				mq_send(__worker_mqueue, (const char *)&msgbuff, sizeof(rpiwd_mqmsg), 0);
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->completions.eventfd, &ev) == -1) {
+        rpiwd_log(LOG_ERR, "error registering worker queue: %s", strerror(errno));
+		return -1;
+	}
 
-			if (cmd)
-				http_cmd_free(cmd);
+	/* In SO_REUSEPORT mode the worker accepts its own connections; the kernel
+	 * spreads incoming connections across all sockets bound to the port.
+	 * The listener socket is registered with the worker itself as its pointer. */
+	if (comm_port != -1) {
+		worker->listener_sockfd = get_bound_socket(comm_port, true);
+		if (worker->listener_sockfd == -1) {
+            rpiwd_log(LOG_ERR, "Could not get bound socket: %s", strerror(errno));
+			return -1;
 		}
-		else {
-			/* Check response type, and get value accordingly */
-			switch (msgbuff.mtype) {
-				case DB_MSGTYPE_FETCH:
-                    jval = entrylist_to_json_value((entrylist **)&msgbuff.data,
-                                                   msgbuff.unitstr);
-					break;
-				case DB_MSGTYPE_CURRENT:
-                    jval = entry_to_json_value((entry *)msgbuff.data, msgbuff.unitstr);
-					break;
-				case DB_MSGTYPE_STATS:
-				case DB_MSGTYPE_CONFIG:
-					jval = key_value_list_to_json_value((key_value_list **)&msgbuff.data);
-					break;
-			}
 
-			/* If something was received, generate appropriate 
-			 * HTTP response and send to client */
-            if (jval) {
-				/* Serialize and send */
-				char *serialized = json_serialize_to_string(jval);
-
-				/* Send it */
-				flag = send_response(msgbuff.sockfd, HTTP_CODE_OK, serialized);
-				close(msgbuff.sockfd);
-						
-				/* Free buffers */
-				if (msgbuff.fselectq)
-					free(msgbuff.fselectq);
-	
-				if (msgbuff.fcountq)
-					free(msgbuff.fcountq);
-	
-				/* Free JSON values/buffers */
-				json_free_serialized_string(serialized);
-				json_value_free(jval);
-	
-				/* Free data */
-				switch (msgbuff.mtype) {
-					case DB_MSGTYPE_FETCH:
-						entrylist_free((entrylist *)msgbuff.data);
-						break;
-					case DB_MSGTYPE_CURRENT:
-						entry_ptr_free((entry *)msgbuff.data);
-						break;
-					case DB_MSGTYPE_STATS:
-					case DB_MSGTYPE_CONFIG:
-						key_value_list_free((key_value_list *)msgbuff.data);
-						break;
-				}
-			}
-			else {
-				/* Some error has occurred... */
-				send_http_error_response(msgbuff.sockfd,
-						HTTP_CODE_REQUEST_BAD_REQUEST,
-						msgbuff.retcode,
-						dbhandler_strerror(msgbuff.retcode));
-
-				/* Finish response */
-				close(msgbuff.sockfd);
-						
-                continue;
-			}
+		if (conn_set_nonblocking(worker->listener_sockfd) == -1 ||
+			listen(worker->listener_sockfd, SOMAXCONN) == -1) {
+            rpiwd_log(LOG_ERR, "error listening on socket: %s", strerror(errno));
+			return -1;
 		}
-    }
 
-	return (void *) 0;
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.ptr = worker;
+		if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->listener_sockfd, &ev) == -1) {
+            rpiwd_log(LOG_ERR, "error registering listener socket: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	/* Start the worker thread */
+	__atomic_store_n(&worker->state, WORKER_STATE_RUNNING, __ATOMIC_RELEASE);
+	flag = pthread_create(&worker->thread_id, NULL, worker_listener_loop, worker);
+	if (flag != 0) {
+		__atomic_store_n(&worker->state, WORKER_STATE_FREE, __ATOMIC_RELEASE);
+        rpiwd_log(LOG_ERR, "error creating worker thread: %s", strerror(errno));
+		return -1;
+	}
+
+	return 1;
+}
+
+void worker_cleanup_routine(void *arg) {
+	rpiwd_worker *worker = (rpiwd_worker *)arg;
+	rpiwd_mqmsg msgbuff;
+	rpiwd_conn *conn;
+
+	/* Close all open connections */
+	while ((conn = worker->connections) != NULL)
+		worker_close_connection(worker, conn);
+
+	worker_free_closed(worker);
+
+	/* Last try; if the DB thread is gone, its cleanup finalized them */
+	worker_send_cancels(worker);
+
+	/* Without subscribers, no more samples are sent here. Wait out a
+	 * publisher that is still at it, then drop what it sent. */
+	pthread_mutex_lock(&__stream_mtx);
+	pthread_mutex_unlock(&__stream_mtx);
+
+	while (rpiwd_msgring_try_pop(&worker->completions, &msgbuff))
+		if (msgbuff.mtype == DB_MSGTYPE_SAMPLE)
+			worker_free_message(&msgbuff);
+
+	/* Close own listener socket (SO_REUSEPORT mode) */
+	if (worker->listener_sockfd != -1)
+		close(worker->listener_sockfd);
+
+	/* Close epoll instance and queue */
+	close(worker->epfd);
+	rpiwd_msgring_destroy(&worker->completions);
+}
+
+void *worker_listener_loop(void *arg) {
+	rpiwd_worker *worker = (rpiwd_worker *)arg;
+	struct epoll_event events[LISTENER_MAX_EVENTS];
+	int nevents, oldstate, expected;
+	bool was_retiring;
+	rpiwd_conn *conn;
+	uint64_t round_usec;
+
+	/* Set thread cancelability; epoll_wait() is the cancellation point */
+	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &oldstate);
+	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &oldstate);
+	pthread_cleanup_push(worker_cleanup_routine, worker);
+
+	for (;;) {
+		/* Connections handed over before retirement are registered by now */
+		was_retiring = __atomic_load_n(&worker->state, __ATOMIC_ACQUIRE) ==
+			WORKER_STATE_RETIRING;
+
+		/* Wake up every tick while deadlines or cancels are pending */
+		nevents = epoll_wait(worker->epfd, events, LISTENER_MAX_EVENTS,
+				worker->timers.count || worker->cancels ? TIMERWHEEL_TICK_MS :
+				LISTENER_IDLE_INTERVAL);
+		if (nevents == -1) {
+			if (errno == EINTR)
+				continue;
+
+            rpiwd_log(LOG_ERR, "worker %d: epoll_wait: %s", worker->id, strerror(errno));
+			break;
+		}
+
+		/* Account for the load on this worker */
+		round_usec = rpiwd_monotonic_usec();
+		if (nevents > 0) {
+			__atomic_add_fetch(&worker->events, nevents, __ATOMIC_RELAXED);
+			if ((unsigned int)nevents > __atomic_load_n(&worker->max_depth, __ATOMIC_RELAXED))
+				__atomic_store_n(&worker->max_depth, nevents, __ATOMIC_RELAXED);
+		}
+
+		/* Handle all ready descriptors */
+		for (int i = 0; i < nevents; i++) {
+			if (!events[i].data.ptr)
+				worker_handle_completions(worker);
+			else if (events[i].data.ptr == worker)
+				worker_accept_connections(worker);
+			else {
+				/* New connections have been waiting since they were accepted */
+				conn = (rpiwd_conn *)events[i].data.ptr;
+				worker_record_wait(worker,
+						conn->is_adopted ? round_usec : conn->accepted_usec,
+						rpiwd_monotonic_usec());
+
+				worker_handle_event(worker, conn, events[i].events);
+			}
+		}
+
+		/* Drop connections that ran out of time */
+		timerwheel_advance(&worker->timers, rpiwd_monotonic_usec() / 1000,
+				worker_expire_connection, worker);
+
+		/* A retiring worker hangs up on idle clients rather than waiting for
+		 * them to time out, and on all of them once the drain is over */
+		if (was_retiring && __atomic_load_n(&worker->close_all, __ATOMIC_ACQUIRE))
+			worker_close_all(worker);
+		else if (was_retiring)
+			worker_close_idle(worker);
+
+		/* Connections closed during this round are safe to free now */
+		worker_free_closed(worker);
+
+		/* Cursors the DB thread did not have room to hear about */
+		if (worker->cancels)
+			worker_send_cancels(worker);
+
+		/* A retiring worker leaves once it is completely idle */
+		if (was_retiring && nevents == 0 && !worker->connections && worker->inflight == 0 &&
+			!worker->cancels) {
+			expected = WORKER_STATE_RETIRING;
+			if (__atomic_compare_exchange_n(&worker->state, &expected, WORKER_STATE_EXITED,
+						false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				break;
+		}
+	}
+
+	/* Cleanup */
+	pthread_cleanup_pop(1);
+
+	return (void *) 0;
+}
+
+void worker_handle_event(rpiwd_worker *worker, rpiwd_conn *conn, uint32_t events) {
+	/* Connection might have been closed earlier in this round */
+	if (conn->is_closed)
+		return;
+
+	/* First event for this connection; take ownership of it */
+	if (!conn->is_adopted)
+		worker_adopt_connection(worker, conn);
+
+	/* Check for errors */
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		worker_close_connection(worker, conn);
+		return;
+	}
+
+	/* Socket became writable again */
+	if ((events & EPOLLOUT) && conn_has_pending_output(conn)) {
+		worker_flush_connection(worker, conn);
+		if (conn->is_closed)
+			return;
+	}
+
+	/* New request data */
+	if ((events & EPOLLIN) && conn->state == CONN_STATE_READING)
+		worker_handle_request(worker, conn);
+	else if ((events & EPOLLIN) && conn->state == CONN_STATE_STREAMING)
+		worker_discard_input(worker, conn);
+	else if ((events & EPOLLIN) && conn->state == CONN_STATE_WEBSOCKET)
+		worker_handle_websocket(worker, conn);
+	else if ((events & EPOLLIN) && conn->state == CONN_STATE_PARKED)
+		worker_watch_parked(worker, conn);
+}
+
+void worker_accept_connections(rpiwd_worker *worker) {
+	struct sockaddr_storage claddr;
+	socklen_t addrlen = sizeof(struct sockaddr_storage);
+	struct epoll_event ev;
+	rpiwd_conn *conn;
+	int clientsock;
+
+	/* Listener socket is edge-triggered; accept until the backlog is empty */
+	while ((clientsock = accept(worker->listener_sockfd, (struct sockaddr *)&claddr,
+					&addrlen)) != -1) {
+		addrlen = sizeof(struct sockaddr_storage);
+
+		if (conn_set_nonblocking(clientsock) == -1) {
+			rpiwd_log(LOG_ERR, "error setting socket flags: %s", strerror(errno));
+			close(clientsock);
+			continue;
+		}
+
+		conn = conn_alloc(clientsock);
+		if (!conn) {
+			rpiwd_log(LOG_ERR, "Unable to allocate connection: %s", strerror(errno));
+			close(clientsock);
+			continue;
+		}
+
+		ratelimit_key_from_sockaddr(&conn->peer, (struct sockaddr *)&claddr);
+
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+		ev.data.ptr = conn;
+		if (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, clientsock, &ev) == -1) {
+			rpiwd_log(LOG_ERR, "error registering connection: %s", strerror(errno));
+			close(clientsock);
+			conn_free(conn);
+			continue;
+		}
+
+		worker_adopt_connection(worker, conn);
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        rpiwd_log(LOG_ERR, "error accepting connection: %s", strerror(errno));
+}
+
+void worker_adopt_connection(rpiwd_worker *worker, rpiwd_conn *conn) {
+	/* The client has as long to send its first request as for any other */
+	worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+			get_current_config()->header_timeout * 1000ULL);
+
+	conn->is_adopted = true;
+	conn->prev = NULL;
+	conn->next = worker->connections;
+	if (worker->connections)
+		worker->connections->prev = conn;
+
+	worker->connections = conn;
+}
+
+void worker_handle_request(rpiwd_worker *worker, rpiwd_conn *conn) {
+	rpiwd_mqmsg msgbuff;
+	http_cmd cmdbuff, *cmd;
+	int cmd_status = 0, response = HTTP_PARSER_ERROR_SUCCESS, is_eof = 0;
+
+	/* Answer requests in the order they were sent. Requests that have to visit
+	 * the DB thread stop this loop; the rest of the pipeline is picked up once
+	 * that request was answered. */
+	while (conn->state == CONN_STATE_READING && !conn->is_closed) {
+		/* Read whatever the socket has for us.
+		 * A read error leaves the connection as unusable as EOF does. */
+		if (conn_read(conn, &is_eof) == -1) {
+			worker_close_connection(worker, conn);
+			return;
+		}
+
+		/* A request starts with its first bytes. Charge the client for it
+		 * before spending any time on it. */
+		if (!conn->is_admitted && conn->inlen > 0) {
+			if (!worker_admit_request(worker, conn))
+				return;
+
+			worker_start_request(worker, conn);
+		}
+
+		/* Parse HTTP request */
+		cmd = parse_buffered_request(conn, &cmdbuff, &response);
+		if (!cmd) {
+			/* Client went away before sending a complete request */
+			if (is_eof) {
+				worker_close_connection(worker, conn);
+				return;
+			}
+
+			/* Wait for the rest of the request */
+			if (response == HTTP_PARSER_REQUEST_INCOMPLETE)
+				return;
+
+			/* Malformed requests end the connection */
+			conn->keep_alive = false;
+			send_http_error_response(conn,
+					http_parser_http_code(response),
+					http_parser_http_code(response),
+					http_parser_strerror(response));
+
+			/* Finish response */
+			end_response(conn);
+			worker_finish_response(worker, conn);
+
+			return;
+		}
+
+		/* Headers are in; the rest is up to the request deadline */
+		worker_set_deadline(worker, conn, conn->request_deadline_ms);
+
+		/* Keep the connection open if the client asked for it, unless it
+		 * already used up its request quota. */
+		conn->keep_alive = cmd->keep_alive && !is_eof &&
+			get_current_config()->keepalive_timeout > 0 &&
+			conn->requests_served + 1 < get_current_config()->keepalive_max_requests;
+		conn->accept_gzip = cmd->accept_gzip;
+		conn->if_none_match = cmd->if_none_match;
+		conn->if_none_match_length = cmd->if_none_match_length;
+
+		/* Check if the command is any "special" browser stuff.
+		 * Might be a request for a favico.ico, text/html (Midori does this),
+		 * etc. */
+		if (strcmp(cmd->cmdname, "favicon.ico") == 0 ||
+			strcmp(cmd->cmdname, "text-html") == 0) {
+			/* Send 204 No Content */
+			send_response(conn, HTTP_CODE_NO_CONTENT, NULL);
+
+			/* Finish response */
+			end_response(conn);
+			worker_finish_response(worker, conn);
+
+			continue;
+		}
+
+		/* Some commands are more expensive and have limits of their own */
+		if (!worker_admit_command(worker, conn, cmd))
+			continue;
+
+		/* Build message */
+		rpiwd_mqmsg_init(&msgbuff);
+		msgbuff.conn = conn;
+		msgbuff.arena = &conn->arena;
+		msgbuff.sockfd = conn->sockfd;
+		msgbuff.receiver = &worker->completions;
+		msgbuff.format = cmd->accept_cbor ? RPIWD_FORMAT_CBOR : RPIWD_FORMAT_JSON;
+
+		/* Dispatch command callback */
+		cmd_status = take_format_param(cmd, &msgbuff.format);
+		if (cmd_status == CALLBACK_RETCODE_SUCCESS)
+			cmd_status = dispatch_command(cmd, &msgbuff);
+
+		/* Waiting for a reading is done like a long poll. Only requests that
+		 * wait ask for one; batch parts cannot, and fail instead. */
+		if (cmd_status == CALLBACK_RETCODE_SAMPLE_PENDING) {
+			device_request_sample();
+			cmd_status = CALLBACK_RETCODE_SUCCESS;
+		}
+
+		/* HTTP/1.1 clients get fetch results streamed as they are read */
+		if (msgbuff.mtype == DB_MSGTYPE_FETCH && cmd->is_http11)
+			msgbuff.mtype = DB_MSGTYPE_FETCH_STREAM;
+
+		/* CSV is only written row by row, so nothing else can answer in it */
+		if (cmd_status == CALLBACK_RETCODE_SUCCESS && msgbuff.format == RPIWD_FORMAT_CSV &&
+			msgbuff.mtype != DB_MSGTYPE_FETCH_STREAM)
+			cmd_status = CALLBACK_RETCODE_PARAM_ERROR;
+
+		if (cmd_status == CALLBACK_RETCODE_UPGRADE_REQUIRED) {
+			send_upgrade_required_response(conn, cmd_status,
+					command_callback_strerror(cmd_status));
+
+			/* Free all */
+			worker_free_message(&msgbuff);
+			end_response(conn);
+			worker_finish_response(worker, conn);
+
+			continue;
+		}
+		else if (cmd_status != CALLBACK_RETCODE_SUCCESS) {
+			send_http_error_response(conn,
+					HTTP_CODE_REQUEST_BAD_REQUEST,
+					cmd_status,
+					command_callback_strerror(cmd_status));
+
+			/* Free all */
+			worker_free_message(&msgbuff);
+			end_response(conn);
+			worker_finish_response(worker, conn);
+
+			continue;
+		}
+
+		/* Long polls with nothing new to answer wait for the next sample */
+		if (msgbuff.wait_ms > 0 && !worker_has_newer_data(&msgbuff))
+			worker_park_request(worker, conn, &msgbuff);
+		else
+			worker_submit_request(worker, conn, &msgbuff);
+	}
+}
+
+bool worker_admit_request(rpiwd_worker *worker, rpiwd_conn *conn) {
+	rpiwd_config *config = get_current_config();
+	unsigned int retry_after;
+
+	conn->is_admitted = ratelimit_admit(&conn->peer, RATELIMIT_BUCKET_REQUESTS,
+			config->rate_limit_requests, config->rate_limit_burst,
+			rpiwd_monotonic_usec(), &retry_after);
+	if (conn->is_admitted)
+		return true;
+
+	/* Nothing was parsed, so there is no telling where this request ends.
+	 * Answer and close the connection, throwing away what was sent. */
+	conn->keep_alive = false;
+	conn_consume_input(conn, conn->inlen);
+	worker_reject_request(worker, conn, HTTP_CODE_TOO_MANY_REQUESTS,
+			CALLBACK_RETCODE_RATE_LIMITED,
+			command_callback_strerror(CALLBACK_RETCODE_RATE_LIMITED), retry_after);
+
+	return false;
+}
+
+bool worker_admit_command(rpiwd_worker *worker, rpiwd_conn *conn, http_cmd *cmd) {
+	int bucket = command_ratelimit_bucket(cmd->cmdname, cmd->cmdname_length);
+	unsigned int retry_after;
+
+	if (bucket == RATELIMIT_BUCKET_NONE || ratelimit_admit(&conn->peer, bucket,
+				get_current_config()->rate_limit_current, LISTENER_COMMAND_BURST,
+				rpiwd_monotonic_usec(), &retry_after))
+		return true;
+
+	/* The request was parsed, so the connection can stay open */
+	worker_reject_request(worker, conn, HTTP_CODE_TOO_MANY_REQUESTS,
+			CALLBACK_RETCODE_RATE_LIMITED,
+			command_callback_strerror(CALLBACK_RETCODE_RATE_LIMITED), retry_after);
+	return false;
+}
+
+void worker_shed_request(rpiwd_worker *worker, rpiwd_conn *conn) {
+	int deadline = get_current_config()->db_read_deadline;
+
+	/* By the time the deadline has passed again, the backlog should be gone */
+	worker_reject_request(worker, conn, HTTP_CODE_SERVICE_UNAVAILABLE,
+			DBHANDLER_ERROR_OVERLOADED, dbhandler_strerror(DBHANDLER_ERROR_OVERLOADED),
+			deadline > 1000 ? (deadline + 999) / 1000 : 1);
+}
+
+void worker_submit_request(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff) {
+	int flag;
+
+	/* The client may already have this result */
+	if ((msgbuff->mtype == DB_MSGTYPE_FETCH || msgbuff->mtype == DB_MSGTYPE_FETCH_STREAM) &&
+		worker_revalidate_fetch(worker, conn, msgbuff))
+		return;
+
+	/* A wait on the current values that no new sample answered */
+	if (msgbuff->mtype == DB_MSGTYPE_CURRENT && !msgbuff->data &&
+		(flag = current_latest_sample(msgbuff)) != CALLBACK_RETCODE_SUCCESS) {
+		send_http_error_response(conn,
+				HTTP_CODE_REQUEST_BAD_REQUEST,
+				flag,
+				command_callback_strerror(flag));
+
+		/* Free all */
+		worker_free_message(msgbuff);
+		end_response(conn);
+		worker_finish_response(worker, conn);
+
+		return;
+	}
+
+	/* Send to DB thread to finish processing (if needed).
+	 * The reply comes back through this worker's queue. */
+	if (msgbuff->mtype == DB_MSGTYPE_FETCH || msgbuff->mtype == DB_MSGTYPE_STATS ||
+		msgbuff->mtype == DB_MSGTYPE_FETCH_STREAM ||
+		(msgbuff->mtype == DB_MSGTYPE_BATCH && batch_needs_db(msgbuff->data))) {
+		/* Never wait for the DB thread; if it is swamped, say so */
+		if (!dbhandler_try_send(msgbuff)) {
+			worker_free_message(msgbuff);
+			worker_shed_request(worker, conn);
+
+			return;
+		}
+
+		conn->state = CONN_STATE_PROCESSING;
+		worker->inflight++;
+	}
+	else
+		worker_complete_request(worker, msgbuff);
+}
+
+bool worker_revalidate_fetch(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff) {
+	uint64_t digest;
+
+	/* A fetch result only changes when rows are added. Its validator is the
+	 * newest row and the query itself (units included), so it is known
+	 * without running the query. */
+	digest = rpiwd_hash64(msgbuff->fselectq, strlen(msgbuff->fselectq), RPIWD_HASH64_SEED);
+	digest = rpiwd_hash64(msgbuff->unitstr, sizeof(msgbuff->unitstr), digest);
+	digest = rpiwd_hash64(&msgbuff->format, sizeof(msgbuff->format), digest);
+
+	if (!set_response_etag(conn, dbhandler_data_version(), digest))
+		return false;
+
+	worker_free_message(msgbuff);
+	worker_not_modified(worker, conn);
+
+	return true;
+}
+
+void worker_not_modified(rpiwd_worker *worker, rpiwd_conn *conn) {
+	send_not_modified_response(conn);
+
+	/* Finish response */
+	end_response(conn);
+	worker_finish_response(worker, conn);
+}
+
+void worker_reject_request(rpiwd_worker *worker, rpiwd_conn *conn, int httpcode,
+		int errcode, const char *err, unsigned int retry_after) {
+	send_retry_later_response(conn, httpcode, errcode, err, retry_after);
+
+	/* Finish response */
+	end_response(conn);
+	worker_finish_response(worker, conn);
+}
+
+void worker_handle_completions(rpiwd_worker *worker) {
+	stream_sample *batch[STREAM_BATCH_SIZE];
+	size_t batched = 0;
+	bool has_reading = false;
+	rpiwd_mqmsg msgbuff;
+	rpiwd_conn *conn;
+
+	/* The eventfd is edge-triggered: reset it first, then drain the queue
+	 * completely. Anything sent after this point triggers a new event. */
+	rpiwd_msgring_wait(&worker->completions);
+
+	while (rpiwd_msgring_try_pop(&worker->completions, &msgbuff)) {
+		/* Not an answer, but a sample to pass on. Event streams get it right
+		 * away; WebSocket subscribers get the samples that arrived together
+		 * in one frame. */
+		if (msgbuff.mtype == DB_MSGTYPE_SAMPLE) {
+			worker_publish_event(worker, ((stream_sample *)msgbuff.data)->event);
+
+			batch[batched++] = (stream_sample *)msgbuff.data;
+			if (batched == STREAM_BATCH_SIZE) {
+				worker_wake_parked(worker, batch, batched);
+				worker_publish_samples(worker, batch, batched);
+				batched = 0;
+			}
+
+			/* The query loop read the device for it */
+			has_reading = true;
+			continue;
+		}
+
+		/* A reading some request asked for */
+		if (msgbuff.mtype == DB_MSGTYPE_READING) {
+			has_reading = true;
+			continue;
+		}
+
+		worker->inflight--;
+
+		conn = msgbuff.conn;
+		worker_complete_request(worker, &msgbuff);
+
+		/* Continue with requests the client pipelined behind this one */
+		if (!conn->is_closed && conn->state == CONN_STATE_READING)
+			worker_handle_request(worker, conn);
+		else if (!conn->is_closed && conn->state == CONN_STATE_WEBSOCKET)
+			worker_handle_websocket(worker, conn);
+	}
+
+	/* Long polls first; publishing lets go of the samples */
+	if (batched > 0) {
+		worker_wake_parked(worker, batch, batched);
+		worker_publish_samples(worker, batch, batched);
+	}
+
+	if (has_reading)
+		worker_wake_readers(worker);
+}
+
+void worker_complete_request(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff) {
+	rpiwd_conn *conn = msgbuff->conn;
+	JSON_Value *jval = NULL;
+	char *serialized = NULL;
+	size_t length = 0;
+
+	/* The client might have disconnected while the request was processed */
+	if (conn->is_closed) {
+		if (msgbuff->cursor)
+			worker_cancel_fetch(worker, msgbuff->cursor);
+
+		worker_free_message(msgbuff);
+
+		conn->state = CONN_STATE_WRITING;
+		worker_close_connection(worker, conn);
+
+		return;
+	}
+
+	/* A fetch sent over a WebSocket */
+	if (conn->ws) {
+		worker_complete_websocket(worker, msgbuff);
+		return;
+	}
+
+	conn->state = CONN_STATE_WRITING;
+
+	/* The request outlived its deadline in the DB queue */
+	if (msgbuff->retcode == DBHANDLER_ERROR_OVERLOADED) {
+		worker_free_message(msgbuff);
+		worker_shed_request(worker, conn);
+
+		return;
+	}
+
+	/* Batches of a streamed fetch */
+	if (msgbuff->mtype == DB_MSGTYPE_FETCH_STREAM || msgbuff->mtype == DB_MSGTYPE_FETCH_NEXT) {
+		worker_complete_stream(worker, msgbuff);
+		return;
+	}
+
+	/* Event stream subscription */
+	if (msgbuff->mtype == DB_MSGTYPE_SUBSCRIBE) {
+		worker_subscribe(worker, msgbuff);
+		return;
+	}
+
+	/* Switch to WebSocket */
+	if (msgbuff->mtype == DB_MSGTYPE_WEBSOCKET) {
+		worker_upgrade_websocket(worker, msgbuff);
+		return;
+	}
+
+	/* CBOR is written straight from the results */
+	if (msgbuff->format == RPIWD_FORMAT_CBOR) {
+		serialized = message_to_cbor(msgbuff, &length);
+		conn->content_type = HTTP_CONTENT_TYPE_CBOR;
+	}
+	else {
+		/* The JSON document is built in the connection's arena. Only the
+		 * serialized string outlives it; the output queue frees that. */
+		arena_make_current(&conn->arena);
+
+		/* Check response type, and get value accordingly */
+		switch (msgbuff->mtype) {
+			case DB_MSGTYPE_FETCH:
+				jval = entrylist_to_json_value((entrylist **)&msgbuff->data,
+											   msgbuff->unitstr);
+				break;
+			case DB_MSGTYPE_CURRENT:
+				jval = entry_to_json_value((entry *)msgbuff->data, msgbuff->unitstr);
+				break;
+			case DB_MSGTYPE_STATS:
+			case DB_MSGTYPE_CONFIG:
+				jval = key_value_list_to_json_value((key_value_list **)&msgbuff->data);
+				break;
+			case DB_MSGTYPE_BATCH:
+				jval = batch_to_json_value((rpiwd_mqmsg_batch *)msgbuff->data);
+				break;
+		}
+
+		if (jval) {
+			serialized = json_serialize_to_heap(jval);
+			length = serialized ? strlen(serialized) : 0;
+			json_value_free(jval);
+		}
+
+		arena_make_current(NULL);
+	}
+
+	/* If something was received, generate appropriate
+	 * HTTP response and send to client */
+	if (jval || serialized) {
+		/* Statistics and configuration are small, so their validator is
+		 * simply a hash of the body. It saves the client the transfer. */
+		if (serialized && (msgbuff->mtype == DB_MSGTYPE_STATS ||
+				msgbuff->mtype == DB_MSGTYPE_CONFIG) &&
+				set_response_etag(conn, 0, rpiwd_hash64(serialized, length,
+						RPIWD_HASH64_SEED))) {
+			free(serialized);
+			worker_free_message(msgbuff);
+			worker_not_modified(worker, conn);
+
+			return;
+		}
+
+		send_response_data(conn, HTTP_CODE_OK, serialized, length);
+	}
+	else {
+		/* Some error has occurred... */
+		send_http_error_response(conn,
+				HTTP_CODE_REQUEST_BAD_REQUEST,
+				msgbuff->retcode,
+				dbhandler_strerror(msgbuff->retcode));
+	}
+
+	/* Finish response */
+	worker_free_message(msgbuff);
+	end_response(conn);
+	worker_finish_response(worker, conn);
+}
+
+char *message_to_cbor(rpiwd_mqmsg *msgbuff, size_t *length) {
+	strbuf buf;
+	int flag = -1;
+
+	if (!msgbuff->data || strbuf_init(&buf, STRBUF_DEFAULT_CAPACITY) == -1)
+		return NULL;
+
+	/* Same documents as the JSON ones above */
+	switch (msgbuff->mtype) {
+		case DB_MSGTYPE_FETCH:
+			flag = entrylist_to_cbor(&buf, (entrylist *)msgbuff->data, msgbuff->unitstr);
+			break;
+		case DB_MSGTYPE_CURRENT:
+			flag = entry_to_cbor(&buf, (entry *)msgbuff->data, msgbuff->unitstr);
+			break;
+		case DB_MSGTYPE_STATS:
+		case DB_MSGTYPE_CONFIG:
+			flag = key_value_list_to_cbor(&buf, (key_value_list *)msgbuff->data);
+			break;
+		case DB_MSGTYPE_BATCH:
+			flag = batch_to_cbor(&buf, (rpiwd_mqmsg_batch *)msgbuff->data);
+			break;
+	}
+
+	if (flag == -1) {
+		strbuf_free(&buf);
+		return NULL;
+	}
+
+	*length = buf.length;
+	return strbuf_release(&buf);
+}
+
+void worker_complete_stream(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff) {
+	rpiwd_conn *conn = msgbuff->conn;
+	char *batch = (char *)msgbuff->data;
+
+	msgbuff->data = NULL;
+	worker_free_message(msgbuff);
+
+	if (!batch) {
+		/* Nothing was sent yet, so there is still room for a proper error */
+		if (msgbuff->mtype == DB_MSGTYPE_FETCH_STREAM) {
+			send_http_error_response(conn,
+					HTTP_CODE_REQUEST_BAD_REQUEST,
+					msgbuff->retcode,
+					dbhandler_strerror(msgbuff->retcode));
+
+			end_response(conn);
+			worker_finish_response(worker, conn);
+		}
+		else {
+			/* Cut the response short; without the last chunk, the client
+			 * can tell it is incomplete */
+			worker_close_connection(worker, conn);
+		}
+
+		return;
+	}
+
+	/* A result that fits into one small batch is not worth compressing */
+	if (msgbuff->mtype == DB_MSGTYPE_FETCH_STREAM) {
+		if (msgbuff->format == RPIWD_FORMAT_CBOR)
+			conn->content_type = HTTP_CONTENT_TYPE_CBOR;
+		else if (msgbuff->format == RPIWD_FORMAT_CSV)
+			conn->content_type = HTTP_CONTENT_TYPE_CSV;
+
+		send_chunked_response_start(conn, HTTP_CODE_OK, msgbuff->cursor ||
+				msgbuff->length >= (size_t)get_current_config()->compression_min_size);
+	}
+
+	if (send_response_chunk(conn, batch, msgbuff->length) == -1) {
+		if (msgbuff->cursor)
+			worker_cancel_fetch(worker, msgbuff->cursor);
+
+		worker_close_connection(worker, conn);
+		return;
+	}
+
+	/* Last batch */
+	if (!msgbuff->cursor) {
+		end_chunked_response(conn);
+		end_response(conn);
+		worker_finish_response(worker, conn);
+
+		return;
+	}
+
+	/* Exports can take longer than any request should, so streams only have
+	 * to keep going: each batch gets as long as a whole request would */
+	if (get_current_config()->request_timeout > 0) {
+		conn->request_deadline_ms = rpiwd_monotonic_usec() / 1000 +
+			get_current_config()->request_timeout * 1000ULL;
+		worker_set_deadline(worker, conn, conn->request_deadline_ms);
+	}
+
+	/* Hold on to the cursor until the client took this batch; flushing asks
+	 * for the next one once the output queue is empty. */
+	conn->fetch_cursor = msgbuff->cursor;
+	worker_flush_connection(worker, conn);
+}
+
+void worker_request_next_batch(rpiwd_worker *worker, rpiwd_conn *conn) {
+	rpiwd_mqmsg msgbuff;
+
+	rpiwd_mqmsg_init(&msgbuff);
+	msgbuff.mtype = DB_MSGTYPE_FETCH_NEXT;
+	msgbuff.conn = conn;
+	msgbuff.sockfd = conn->sockfd;
+	msgbuff.receiver = &worker->completions;
+	msgbuff.cursor = conn->fetch_cursor;
+
+	conn->fetch_cursor = NULL;
+
+	/* The response is under way and can only be cut short */
+	if (!dbhandler_try_send(&msgbuff)) {
+		worker_cancel_fetch(worker, msgbuff.cursor);
+		worker_close_connection(worker, conn);
+
+		return;
+	}
+
+	conn->state = CONN_STATE_PROCESSING;
+	worker->inflight++;
+}
+
+void worker_cancel_fetch(rpiwd_worker *worker, void *cursor) {
+	db_fetch_cursor *fcur = (db_fetch_cursor *)cursor;
+
+	/* The DB thread is likely to be busy when the queue is full; keep the
+	 * cursor and tell it later */
+	if (request_cancel_fetch(fcur))
+		return;
+
+	fcur->next = worker->cancels;
+	worker->cancels = fcur;
+}
+
+void worker_send_cancels(rpiwd_worker *worker) {
+	db_fetch_cursor *fcur;
+
+	/* Once sent, the cursor is the DB thread's to free */
+	while ((fcur = worker->cancels) != NULL) {
+		worker->cancels = fcur->next;
+
+		if (!request_cancel_fetch(fcur)) {
+			worker->cancels = fcur;
+			break;
+		}
+	}
+}
+
+void worker_subscribe(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff) {
+	rpiwd_conn *conn = msgbuff->conn;
+
+	worker_free_message(msgbuff);
+
+	if (send_event_stream_start(conn) == -1) {
+		worker_close_connection(worker, conn);
+		return;
+	}
+
+	/* The request is done with. Whatever else the client sends is ignored. */
+	conn_consume_input(conn, conn->inlen);
+	conn->request_length = 0;
+	conn->requests_served++;
+	conn->state = CONN_STATE_STREAMING;
+	__atomic_add_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+
+	/* No deadline; heartbeats find subscribers that are gone */
+	conn->request_deadline_ms = 0;
+	worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+			STREAM_HEARTBEAT_INTERVAL);
+
+	worker_flush_connection(worker, conn);
+}
+
+void worker_publish_event(rpiwd_worker *worker, const char *event) {
+	size_t length = strlen(event);
+	rpiwd_conn *conn, *next;
+
+	for (conn = worker->connections; conn; conn = next) {
+		next = conn->next;
+
+		if (conn->state != CONN_STATE_STREAMING)
+			continue;
+
+		/* Events would pile up behind a subscriber that doesn't keep up.
+		 * Drop it; it can reconnect and fetch what it missed. */
+		if (conn->outq_length + length > STREAM_MAX_PENDING_OUTPUT) {
+			__atomic_add_fetch(&__stream_evictions, 1, __ATOMIC_RELAXED);
+			worker_close_connection(worker, conn);
+			continue;
+		}
+
+		if (send_event(conn, event, length) == -1) {
+			worker_close_connection(worker, conn);
+			continue;
+		}
+
+		worker_flush_connection(worker, conn);
+	}
+}
+
+void worker_publish_samples(rpiwd_worker *worker, stream_sample **samples, size_t count) {
+	char *shared = NULL, *message;
+	size_t shared_length = 0, length;
+	bool has_shared = false;
+	rpiwd_conn *conn, *next;
+
+	for (conn = worker->connections; conn; conn = next) {
+		next = conn->next;
+
+		if (!conn->ws || !conn->ws->subscribed)
+			continue;
+
+		/* Most subscribers take everything; they share one serialization */
+		if (websocket_filter_is_empty(&conn->ws->filter)) {
+			if (!has_shared) {
+				shared = stream_samples_to_json(samples, count, NULL, &shared_length);
+				has_shared = true;
+			}
+
+			length = shared_length;
+			message = shared ? malloc(length) : NULL;
+			if (message)
+				memcpy(message, shared, length);
+		}
+		else
+			message = stream_samples_to_json(samples, count, &conn->ws->filter, &length);
+
+		/* Nothing this subscriber asked for */
+		if (!message)
+			continue;
+
+		/* Same limit as for event streams */
+		if (conn->outq_length + length > STREAM_MAX_PENDING_OUTPUT) {
+			free(message);
+			__atomic_add_fetch(&__stream_evictions, 1, __ATOMIC_RELAXED);
+			worker_close_connection(worker, conn);
+			continue;
+		}
+
+		if (send_websocket_message(conn, WEBSOCKET_OPCODE_TEXT, message, length) == -1) {
+			worker_close_connection(worker, conn);
+			continue;
+		}
+
+		worker_flush_connection(worker, conn);
+	}
+
+	free(shared);
+
+	for (size_t i = 0; i < count; i++)
+		stream_sample_release(samples[i]);
+}
+
+void worker_discard_input(rpiwd_worker *worker, rpiwd_conn *conn) {
+	ssize_t flag;
+	int is_eof = 0;
+
+	/* Subscribers have nothing left to say, but reading tells when they
+	 * hang up */
+	do {
+		flag = conn_read(conn, &is_eof);
+		conn->inlen = 0;
+	} while (flag > 0 && !is_eof);
+
+	if (flag == -1 || is_eof)
+		worker_close_connection(worker, conn);
+}
+
+void worker_watch_parked(rpiwd_worker *worker, rpiwd_conn *conn) {
+	int is_eof = 0;
+
+	/* Whatever a parked client pipelines waits its turn in the buffer, but
+	 * a client that hangs up takes its long poll with it */
+	if (conn_read(conn, &is_eof) == -1 || is_eof)
+		worker_close_connection(worker, conn);
+}
+
+void worker_free_message(rpiwd_mqmsg *msgbuff) {
+	/* Queries and fetch results in the connection's arena are freed when
+	 * the response is finished */
+	if (!msgbuff->arena) {
+		free(msgbuff->fselectq);
+		free(msgbuff->fcountq);
+	}
+
+	/* Free data */
+	if (!msgbuff->data)
+		return;
+
+	switch (msgbuff->mtype) {
+		case DB_MSGTYPE_FETCH:
+			if (!msgbuff->arena)
+				entrylist_free((entrylist *)msgbuff->data);
+			break;
+		case DB_MSGTYPE_CURRENT:
+			entry_ptr_free((entry *)msgbuff->data);
+			break;
+		case DB_MSGTYPE_STATS:
+		case DB_MSGTYPE_CONFIG:
+			key_value_list_free((key_value_list *)msgbuff->data);
+			break;
+		case DB_MSGTYPE_FETCH_STREAM:
+		case DB_MSGTYPE_FETCH_NEXT:
+			free(msgbuff->data);
+			break;
+		case DB_MSGTYPE_SAMPLE:
+			stream_sample_release((stream_sample *)msgbuff->data);
+			break;
+		case DB_MSGTYPE_BATCH:
+			/* The batch itself is in the arena; its parts need not be */
+			for (size_t i = 0; i < ((rpiwd_mqmsg_batch *)msgbuff->data)->length; i++)
+				worker_free_message(&((rpiwd_mqmsg_batch *)msgbuff->data)->parts[i]);
+			break;
+	}
+}
+
+bool worker_has_newer_data(const rpiwd_mqmsg *msgbuff) {
+	return dbhandler_data_version() > msgbuff->newer_than_id &&
+		dbhandler_data_time() > msgbuff->newer_than_time;
+}
+
+bool worker_has_reading(const rpiwd_mqmsg *msgbuff) {
+	float values[DEVICE_SAMPLE_VALUES];
+	uint64_t taken_usec;
+	time_t taken_at;
+	int id;
+
+	return msgbuff->reading_after_usec > 0 &&
+		device_latest_sample(values, &taken_usec, &taken_at, &id) &&
+		taken_usec >= msgbuff->reading_after_usec;
+}
+
+void worker_park_request(rpiwd_worker *worker, rpiwd_conn *conn, rpiwd_mqmsg *msgbuff) {
+	rpiwd_mqmsg *parked;
+
+	/* The request waits in its arena, which stays until it is answered */
+	parked = arena_alloc(&conn->arena, sizeof(rpiwd_mqmsg));
+	if (!parked) {
+		worker_submit_request(worker, conn, msgbuff);
+		return;
+	}
+
+	*parked = *msgbuff;
+	conn->parked_request = parked;
+	conn->state = CONN_STATE_PARKED;
+
+	/* Parked requests take samples like subscribers do. A row written or a
+	 * reading taken before this was seen by publishers was not sent here;
+	 * look again. */
+	__atomic_add_fetch(&worker->subscribers, 1, __ATOMIC_SEQ_CST);
+	if (worker_has_newer_data(parked) || worker_has_reading(parked)) {
+		worker_resume_request(worker, conn, NULL);
+		return;
+	}
+
+	/* The wait replaces the request deadline; it starts over on resuming */
+	conn->request_deadline_ms = 0;
+	worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 + parked->wait_ms);
+}
+
+void worker_wake_parked(rpiwd_worker *worker, stream_sample **samples, size_t count) {
+	const stream_sample *newest = samples[count - 1];
+	rpiwd_conn *conn, *next;
+
+	for (conn = worker->connections; conn; conn = next) {
+		next = conn->next;
+
+		if (conn->state != CONN_STATE_PARKED || !worker_has_newer_data(conn->parked_request))
+			continue;
+
+		/* Samples arrive in the order they were written. A request on the
+		 * current values is answered with the newest one. */
+		worker_resume_request(worker, conn,
+				(uint64_t)newest->ent.id > conn->parked_request->newer_than_id ? newest : NULL);
+
+		/* Continue with requests the client pipelined behind this one */
+		if (!conn->is_closed && conn->state == CONN_STATE_READING)
+			worker_handle_request(worker, conn);
+	}
+}
+
+void worker_wake_readers(rpiwd_worker *worker) {
+	rpiwd_conn *conn, *next;
+
+	for (conn = worker->connections; conn; conn = next) {
+		next = conn->next;
+
+		if (conn->state != CONN_STATE_PARKED || !worker_has_reading(conn->parked_request))
+			continue;
+
+		/* Answered with the latest reading, as any current values are */
+		worker_resume_request(worker, conn, NULL);
+
+		/* Continue with requests the client pipelined behind this one */
+		if (!conn->is_closed && conn->state == CONN_STATE_READING)
+			worker_handle_request(worker, conn);
+	}
+}
+
+void worker_resume_request(rpiwd_worker *worker, rpiwd_conn *conn, const stream_sample *sample) {
+	rpiwd_config *config = get_current_config();
+	rpiwd_mqmsg *msgbuff = conn->parked_request;
+	entry *ent;
+
+	conn->parked_request = NULL;
+	conn->state = CONN_STATE_WRITING;
+	__atomic_sub_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+
+	/* Answering gets as long as any other request */
+	conn->request_deadline_ms = config->request_timeout > 0 ?
+		rpiwd_monotonic_usec() / 1000 + config->request_timeout * 1000ULL : 0;
+	worker_set_deadline(worker, conn, conn->request_deadline_ms);
+
+	/* The current values are the sample, rather than another device query */
+	if (msgbuff->mtype == DB_MSGTYPE_CURRENT && sample && (ent = entry_alloc()) != NULL) {
+		ent->id = sample->ent.id;
+		ent->record_date = strdup(sample->ent.record_date);
+		ent->temperature = sample->celsius;
+		ent->humidity = sample->ent.humidity;
+		ent->location = strdup(sample->ent.location);
+		ent->device_name = strdup(sample->ent.device_name);
+
+		if (!ent->record_date || !ent->location || !ent->device_name) {
+			entry_ptr_free(ent);
+			send_http_error_response(conn,
+					HTTP_CODE_INTERNAL_SERVER_ERROR,
+					CALLBACK_RETCODE_MEMORY_ERROR,
+					command_callback_strerror(CALLBACK_RETCODE_MEMORY_ERROR));
+
+			/* Free all */
+			worker_free_message(msgbuff);
+			end_response(conn);
+			worker_finish_response(worker, conn);
+
+			return;
+		}
+
+		if (msgbuff->unitstr[RPIWD_MEASURE_TEMPERATURE] != RPIWD_TEMPERATURE_CELSIUS)
+			RPIWD_CELSIUS_TO_FARENHEIT(ent->temperature);
+
+		msgbuff->data = ent;
+	}
+
+	worker_submit_request(worker, conn, msgbuff);
+}
+
+void worker_upgrade_websocket(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff) {
+	rpiwd_conn *conn = msgbuff->conn;
+
+	/* The key lives in the arena, which goes with the request */
+	conn->ws = websocket_alloc();
+	if (!conn->ws || send_websocket_accept(conn, (char *)msgbuff->data,
+				WEBSOCKET_KEY_LENGTH) == -1) {
+		worker_free_message(msgbuff);
+		worker_close_connection(worker, conn);
+		return;
+	}
+
+	worker_free_message(msgbuff);
+
+	/* Frames the client sent right behind the handshake stay in the buffer */
+	conn_consume_input(conn, conn->request_length);
+	conn->request_length = 0;
+	conn->requests_served++;
+	conn->state = CONN_STATE_WEBSOCKET;
+
+	/* No deadline; pings find clients that are gone */
+	conn->request_deadline_ms = 0;
+	worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+			STREAM_HEARTBEAT_INTERVAL);
+
+	worker_flush_connection(worker, conn);
+	if (!conn->is_closed)
+		worker_handle_websocket(worker, conn);
+}
+
+void worker_handle_websocket(rpiwd_worker *worker, rpiwd_conn *conn) {
+	websocket_frame frame;
+	int flag, is_eof = 0;
+	uint16_t status;
+	char *payload;
+
+	/* Like requests, messages are handled in order. A fetch stops this loop
+	 * until its result was sent. */
+	while (conn->state == CONN_STATE_WEBSOCKET && !conn->is_closed) {
+		if (conn_read(conn, &is_eof) == -1) {
+			worker_close_connection(worker, conn);
+			return;
+		}
+
+		/* Frames are limited to much less than the input buffer, so a
+		 * frame that is incomplete will fit once the rest arrives */
+		flag = websocket_parse_frame(conn->inbuf, conn->inlen, &frame);
+		if (flag == WEBSOCKET_FRAME_INCOMPLETE) {
+			if (is_eof)
+				worker_close_connection(worker, conn);
+
+			return;
+		}
+		else if (flag != WEBSOCKET_FRAME_COMPLETE) {
+			worker_close_websocket(worker, conn, websocket_close_status(flag));
+			return;
+		}
+
+		/* Control frames may come between the fragments of a message,
+		 * and are not part of it */
+		switch (frame.opcode) {
+			case WEBSOCKET_OPCODE_CLOSE:
+				/* Answer with the client's status, and hang up */
+				status = frame.length >= 2 ? (uint16_t)((uint8_t)frame.payload[0] << 8 |
+						(uint8_t)frame.payload[1]) : WEBSOCKET_CLOSE_NORMAL;
+				worker_close_websocket(worker, conn, status);
+				return;
+
+			case WEBSOCKET_OPCODE_PING:
+				payload = malloc(frame.length + 1);
+				if (!payload) {
+					worker_close_connection(worker, conn);
+					return;
+				}
+
+				memcpy(payload, frame.payload, frame.length);
+				send_websocket_message(conn, WEBSOCKET_OPCODE_PONG, payload, frame.length);
+				flag = WEBSOCKET_FRAME_INCOMPLETE;
+				break;
+
+			case WEBSOCKET_OPCODE_PONG:
+				flag = WEBSOCKET_FRAME_INCOMPLETE;
+				break;
+
+			default:
+				/* Copies the payload out of the input buffer */
+				flag = websocket_add_fragment(conn->ws, &frame);
+				break;
+		}
+
+		conn_consume_input(conn, frame.frame_length);
+
+		if (flag == WEBSOCKET_FRAME_COMPLETE)
+			worker_websocket_message(worker, conn);
+		else if (flag != WEBSOCKET_FRAME_INCOMPLETE) {
+			worker_close_websocket(worker, conn, websocket_close_status(flag));
+			return;
+		}
+		else
+			worker_flush_connection(worker, conn);
+	}
+}
+
+void worker_websocket_message(rpiwd_worker *worker, rpiwd_conn *conn) {
+	rpiwd_config *config = get_current_config();
+	rpiwd_websocket *ws = conn->ws;
+	const char *op = NULL, *type = "error";
+	unsigned int retry_after;
+	JSON_Value *root = NULL;
+	JSON_Object *obj = NULL;
+	int status;
+
+	/* Every message counts as a request */
+	if (!ratelimit_admit(&conn->peer, RATELIMIT_BUCKET_REQUESTS, config->rate_limit_requests,
+				config->rate_limit_burst, rpiwd_monotonic_usec(), &retry_after)) {
+		ws->has_request_id = false;
+		worker_websocket_reply(worker, conn, type, CALLBACK_RETCODE_RATE_LIMITED,
+				command_callback_strerror(CALLBACK_RETCODE_RATE_LIMITED));
+		return;
+	}
+
+	/* The message is parsed in the connection's arena, like a request */
+	arena_make_current(&conn->arena);
+
+	root = json_parse_string(ws->message);
+	obj = json_value_get_object(root);
+	if (obj)
+		op = json_object_get_string(obj, "op");
+
+	/* Replies carry the ID the client gave its message, if any */
+	ws->has_request_id = obj && json_object_has_value_of_type(obj, "id", JSONNumber);
+	ws->request_id = ws->has_request_id ? json_object_get_number(obj, "id") : 0;
+
+	if (!op)
+		status = CALLBACK_RETCODE_BAD_MESSAGE;
+	else if (strcmp(op, "subscribe") == 0) {
+		status = worker_websocket_subscribe(worker, conn, obj);
+		type = "subscribed";
+	}
+	else if (strcmp(op, "unsubscribe") == 0) {
+		worker_websocket_unsubscribe(worker, conn);
+		status = CALLBACK_RETCODE_SUCCESS;
+		type = "unsubscribed";
+	}
+	else if (strcmp(op, "fetch") == 0)
+		status = worker_websocket_fetch(worker, conn, obj);
+	else
+		status = CALLBACK_RETCODE_UNKNOWN_COMMAND;
+
+	/* Nothing is allocated from here on, even if a fetch already handed
+	 * the arena to the DB thread */
+	json_value_free(root);
+	arena_make_current(NULL);
+
+	/* The fetch is answered once its result is in */
+	if (conn->state == CONN_STATE_PROCESSING)
+		return;
+
+	if (status != CALLBACK_RETCODE_SUCCESS)
+		type = "error";
+
+	worker_websocket_reply(worker, conn, type, status, status == DBHANDLER_ERROR_OVERLOADED ?
+			dbhandler_strerror(status) : command_callback_strerror(status));
+}
+
+int worker_websocket_subscribe(rpiwd_worker *worker, rpiwd_conn *conn, JSON_Object *obj) {
+	rpiwd_websocket *ws = conn->ws;
+	websocket_filter filter;
+	const char *name, *str;
+	JSON_Value *value;
+	float *bound;
+	char *dest;
+
+	/* {"op":"subscribe", "location":..., "device_name":...,
+	 *  "min_temperature":..., "max_temperature":..., "min_humidity":...,
+	 *  "max_humidity":...}; all optional. Temperatures are in the unit
+	 * samples are published in. */
+	websocket_filter_reset(&filter);
+
+	for (size_t i = 0; i < json_object_get_count(obj); i++) {
+		name = json_object_get_name(obj, i);
+		value = json_object_get_value_at(obj, i);
+		dest = NULL;
+		bound = NULL;
+
+		if (strcmp(name, "op") == 0 || strcmp(name, "id") == 0)
+			continue;
+		else if (strcmp(name, "location") == 0)
+			dest = filter.location;
+		else if (strcmp(name, "device_name") == 0)
+			dest = filter.device_name;
+		else if (strcmp(name, "min_temperature") == 0)
+			bound = &filter.min_temperature;
+		else if (strcmp(name, "max_temperature") == 0)
+			bound = &filter.max_temperature;
+		else if (strcmp(name, "min_humidity") == 0)
+			bound = &filter.min_humidity;
+		else if (strcmp(name, "max_humidity") == 0)
+			bound = &filter.max_humidity;
+		else
+			return CALLBACK_RETCODE_UNKNOWN_PARAM;
+
+		if (dest) {
+			str = json_value_get_string(value);
+			if (!str || strlen(str) >= WEBSOCKET_FILTER_NAME_LENGTH)
+				return CALLBACK_RETCODE_PARAM_ERROR;
+
+			strcpy(dest, str);
+		}
+		else {
+			if (json_value_get_type(value) != JSONNumber)
+				return CALLBACK_RETCODE_PARAM_ERROR;
+
+			*bound = json_value_get_number(value);
+		}
+	}
+
+	/* Subscribing again replaces the filter */
+	ws->filter = filter;
+	if (!ws->subscribed) {
+		ws->subscribed = true;
+		__atomic_add_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+	}
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+void worker_websocket_unsubscribe(rpiwd_worker *worker, rpiwd_conn *conn) {
+	if (!conn->ws->subscribed)
+		return;
+
+	conn->ws->subscribed = false;
+	__atomic_sub_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+}
+
+int worker_websocket_fetch(rpiwd_worker *worker, rpiwd_conn *conn, JSON_Object *obj) {
+	char number[STREAM_NUMBER_BUFFER_LENGTH];
+	rpiwd_mqmsg msgbuff;
+	http_cmd_param *param;
+	http_cmd cmd;
+	JSON_Value *value;
+	const char *name;
+	int status;
+
+	/* {"op":"fetch", "select":10, ...}; the parameters of /fetch, as strings
+	 * or numbers. They become a query string the fetch callback can parse. */
+	memset(&cmd, 0, sizeof(http_cmd));
+	for (size_t i = 0; i < json_object_get_count(obj); i++) {
+		name = json_object_get_name(obj, i);
+		value = json_object_get_value_at(obj, i);
+
+		if (strcmp(name, "op") == 0 || strcmp(name, "id") == 0)
+			continue;
+
+		if (cmd.length == HTTP_MAX_PARAMS)
+			return CALLBACK_RETCODE_TOO_MANY_PARAMS;
+
+		param = &cmd.params[cmd.length++];
+		param->name = arena_strdup(&conn->arena, name);
+
+		if (json_value_get_type(value) == JSONString)
+			param->value = arena_strdup(&conn->arena, json_value_get_string(value));
+		else if (json_value_get_type(value) == JSONNumber) {
+			snprintf(number, sizeof(number), "%.0f", json_value_get_number(value));
+			param->value = arena_strdup(&conn->arena, number);
+		}
+		else
+			return CALLBACK_RETCODE_PARAM_ERROR;
+
+		if (!param->name || !param->value)
+			return CALLBACK_RETCODE_MEMORY_ERROR;
+
+		param->name_length = strlen(param->name);
+		param->value_length = strlen(param->value);
+	}
+
+	rpiwd_mqmsg_init(&msgbuff);
+	msgbuff.conn = conn;
+	msgbuff.arena = &conn->arena;
+	msgbuff.sockfd = conn->sockfd;
+	msgbuff.receiver = &worker->completions;
+
+	status = fetch_command_callback(&cmd, &msgbuff);
+	if (status != CALLBACK_RETCODE_SUCCESS) {
+		worker_free_message(&msgbuff);
+		return status;
+	}
+
+	/* Subscriptions are how WebSocket clients wait for new samples */
+	if (msgbuff.wait_ms > 0) {
+		worker_free_message(&msgbuff);
+		return CALLBACK_RETCODE_PARAM_ERROR;
+	}
+
+	/* Always the whole result at once; it becomes a single message */
+	if (!dbhandler_try_send(&msgbuff)) {
+		worker_free_message(&msgbuff);
+		return DBHANDLER_ERROR_OVERLOADED;
+	}
+
+	conn->state = CONN_STATE_PROCESSING;
+	worker->inflight++;
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+void worker_complete_websocket(rpiwd_worker *worker, rpiwd_mqmsg *msgbuff) {
+	rpiwd_conn *conn = msgbuff->conn;
+	rpiwd_websocket *ws = conn->ws;
+	JSON_Value *jval = NULL, *root;
+	JSON_Object *obj;
+	char *serialized = NULL;
+	int errcode = msgbuff->retcode;
+
+	conn->state = CONN_STATE_WEBSOCKET;
+
+	/* {"type":"fetch", "id":..., "data":<what /fetch returns>} */
+	if (errcode != DBHANDLER_ERROR_OVERLOADED) {
+		arena_make_current(&conn->arena);
+
+		jval = entrylist_to_json_value((entrylist **)&msgbuff->data, msgbuff->unitstr);
+		if (jval) {
+			root = json_value_init_object();
+			obj = json_value_get_object(root);
+
+			json_object_set_string(obj, "type", "fetch");
+			if (ws->has_request_id)
+				json_object_set_number(obj, "id", ws->request_id);
+			json_object_set_value(obj, "data", jval);
+
+			serialized = json_serialize_to_heap(root);
+			json_value_free(root);
+		}
+
+		arena_make_current(NULL);
+	}
+
+	worker_free_message(msgbuff);
+
+	if (!jval) {
+		worker_websocket_reply(worker, conn, "error", errcode, dbhandler_strerror(errcode));
+		return;
+	}
+
+	/* A result that would not even fit into the output limit is refused
+	 * rather than queued */
+	if (serialized && strlen(serialized) > STREAM_MAX_PENDING_OUTPUT) {
+		free(serialized);
+		worker_websocket_reply(worker, conn, "error", CALLBACK_RETCODE_RESULT_TOO_LARGE,
+				command_callback_strerror(CALLBACK_RETCODE_RESULT_TOO_LARGE));
+		return;
+	}
+
+	arena_reset(&conn->arena);
+	worker_websocket_send(worker, conn, serialized);
+}
+
+void worker_websocket_reply(rpiwd_worker *worker, rpiwd_conn *conn, const char *type,
+		int errcode, const char *errmsg) {
+	rpiwd_websocket *ws = conn->ws;
+	JSON_Value *root;
+	JSON_Object *obj;
+	char *serialized;
+
+	arena_make_current(&conn->arena);
+
+	root = json_value_init_object();
+	obj = json_value_get_object(root);
+
+	json_object_set_string(obj, "type", type);
+	if (ws->has_request_id)
+		json_object_set_number(obj, "id", ws->request_id);
+	json_object_set_number(obj, "errcode", errcode);
+	json_object_set_string(obj, "errmsg", errmsg);
+
+	serialized = json_serialize_to_heap(root);
+	json_value_free(root);
+
+	arena_make_current(NULL);
+
+	/* The message is done with */
+	arena_reset(&conn->arena);
+	worker_websocket_send(worker, conn, serialized);
+}
+
+void worker_websocket_send(rpiwd_worker *worker, rpiwd_conn *conn, char *message) {
+	if (!message || send_websocket_message(conn, WEBSOCKET_OPCODE_TEXT, message,
+				strlen(message)) == -1) {
+		worker_close_connection(worker, conn);
+		return;
+	}
+
+	worker_flush_connection(worker, conn);
+}
+
+void worker_close_websocket(rpiwd_worker *worker, rpiwd_conn *conn, uint16_t status) {
+	/* Send a close frame and hang up once it is out. Nothing else is sent
+	 * or read after it. */
+	worker_websocket_unsubscribe(worker, conn);
+	send_websocket_close(conn, status);
+
+	conn->close_after_write = true;
+	conn->state = CONN_STATE_WRITING;
+
+	worker_flush_connection(worker, conn);
+}
+
+void worker_finish_response(rpiwd_worker *worker, rpiwd_conn *conn) {
+	/* Drop the answered request from the input buffer */
+	conn_consume_input(conn, conn->request_length);
+	conn->request_length = 0;
+	conn->requests_served++;
+
+	/* Persistent connections go back to reading the next request */
+	conn->state = conn->close_after_write ? CONN_STATE_WRITING : CONN_STATE_READING;
+
+	worker_flush_connection(worker, conn);
+}
+
+void worker_flush_connection(rpiwd_worker *worker, rpiwd_conn *conn) {
+	int flag = conn_flush(conn);
+
+	/* On CONN_FLUSH_PENDING, EPOLLOUT will bring us back here */
+	if (flag == CONN_FLUSH_ERROR || (flag == CONN_FLUSH_DONE && conn->close_after_write))
+		worker_close_connection(worker, conn);
+	else if (flag == CONN_FLUSH_DONE && conn->fetch_cursor)
+		worker_request_next_batch(worker, conn);
+	else if (flag == CONN_FLUSH_DONE && conn->state == CONN_STATE_READING &&
+			!conn->is_admitted) {
+		/* The response is out and the connection is idle until the next
+		 * request starts */
+		conn->request_deadline_ms = 0;
+		worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+				get_current_config()->keepalive_timeout * 1000ULL);
+	}
+}
+
+void worker_close_connection(rpiwd_worker *worker, rpiwd_conn *conn) {
+	timerwheel_cancel(&worker->timers, &conn->timer);
+
+	/* Close the socket; this also removes it from the epoll set */
+	if (!conn->is_closed) {
+		close(conn->sockfd);
+		conn->is_closed = true;
+	}
+
+	/* One subscriber less to publish to */
+	if (conn->state == CONN_STATE_STREAMING) {
+		__atomic_sub_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+		conn->state = CONN_STATE_WRITING;
+	}
+	else if (conn->ws) {
+		worker_websocket_unsubscribe(worker, conn);
+		if (conn->state == CONN_STATE_WEBSOCKET)
+			conn->state = CONN_STATE_WRITING;
+	}
+	else if (conn->state == CONN_STATE_PARKED) {
+		/* The parked request goes with the arena */
+		__atomic_sub_fetch(&worker->subscribers, 1, __ATOMIC_RELEASE);
+		conn->parked_request = NULL;
+		conn->state = CONN_STATE_WRITING;
+	}
+
+	/* A streamed fetch waiting for the client to catch up */
+	if (conn->fetch_cursor) {
+		worker_cancel_fetch(worker, conn->fetch_cursor);
+		conn->fetch_cursor = NULL;
+	}
+
+	/* Unlink from connection list */
+	if (conn->is_adopted) {
+		if (conn->prev)
+			conn->prev->next = conn->next;
+		else
+			worker->connections = conn->next;
+
+		if (conn->next)
+			conn->next->prev = conn->prev;
+
+		conn->is_adopted = false;
+	}
+
+	/* A request in the DB thread still points at this connection; it is freed
+	 * when that request comes back. Otherwise, free it at the end of the round. */
+	if (conn->state != CONN_STATE_PROCESSING) {
+		conn->next = worker->graveyard;
+		worker->graveyard = conn;
+	}
+}
+
+void worker_close_idle(rpiwd_worker *worker) {
+	rpiwd_conn *conn, *next;
+
+	/* Stop accepting connections of its own (SO_REUSEPORT mode) */
+	if (worker->listener_sockfd != -1) {
+		close(worker->listener_sockfd);
+		worker->listener_sockfd = -1;
+	}
+
+	/* Keep-alive connections between requests, and event stream
+	 * subscribers; those reconnect by themselves */
+	for (conn = worker->connections; conn; conn = next) {
+		next = conn->next;
+
+		if ((conn->state == CONN_STATE_READING && conn->inlen == 0 &&
+			!conn_has_pending_output(conn)) || conn->state == CONN_STATE_STREAMING)
+			worker_close_connection(worker, conn);
+		else if (conn->state == CONN_STATE_WEBSOCKET) {
+			/* WebSocket clients are told why */
+			send_websocket_close(conn, WEBSOCKET_CLOSE_GOING_AWAY);
+			conn_flush(conn);
+			worker_close_connection(worker, conn);
+		}
+		else if (conn->state == CONN_STATE_PARKED) {
+			/* Long polls are answered with what there is */
+			conn->keep_alive = false;
+			worker_resume_request(worker, conn, NULL);
+		}
+	}
+}
+
+void worker_close_all(rpiwd_worker *worker) {
+	rpiwd_conn *conn;
+
+	worker_close_idle(worker);
+
+	/* Requests in the DB thread are dropped when they come back */
+	while ((conn = worker->connections) != NULL) {
+		if (conn->ws && !conn->is_closed) {
+			send_websocket_close(conn, WEBSOCKET_CLOSE_GOING_AWAY);
+			conn_flush(conn);
+		}
+
+		worker_close_connection(worker, conn);
+	}
+}
+
+void worker_free_closed(rpiwd_worker *worker) {
+	rpiwd_conn *conn;
+
+	while ((conn = worker->graveyard) != NULL) {
+		worker->graveyard = conn->next;
+		conn_free(conn);
+	}
+}
+
+void worker_start_request(rpiwd_worker *worker, rpiwd_conn *conn) {
+	rpiwd_config *config = get_current_config();
+	uint64_t now = rpiwd_monotonic_usec() / 1000;
+
+	/* The whole request, including writing the response, must be done by
+	 * the request deadline; the headers have to be in much sooner */
+	conn->request_deadline_ms = config->request_timeout > 0 ?
+		now + config->request_timeout * 1000ULL : 0;
+	worker_set_deadline(worker, conn, now + config->header_timeout * 1000ULL);
+}
+
+void worker_set_deadline(rpiwd_worker *worker, rpiwd_conn *conn, uint64_t deadline_ms) {
+	/* No phase may outlast the request it belongs to */
+	if (conn->request_deadline_ms && (!deadline_ms || conn->request_deadline_ms < deadline_ms))
+		deadline_ms = conn->request_deadline_ms;
+
+	if (deadline_ms)
+		timerwheel_schedule(&worker->timers, &conn->timer, deadline_ms);
+	else
+		timerwheel_cancel(&worker->timers, &conn->timer);
+}
+
+void worker_expire_connection(rpiwd_timer *timer, void *arg) {
+	rpiwd_worker *worker = (rpiwd_worker *)arg;
+	rpiwd_conn *conn = (rpiwd_conn *)timer->data;
+
+	/* Subscribers get a heartbeat. One that did not even take everything
+	 * sent before the last one is stuck, and dropped. */
+	if (conn->state == CONN_STATE_STREAMING) {
+		if (conn_has_pending_output(conn)) {
+			__atomic_add_fetch(&__stream_evictions, 1, __ATOMIC_RELAXED);
+			worker_close_connection(worker, conn);
+		}
+		else if (send_event(conn, HTTP_EVENT_HEARTBEAT, strlen(HTTP_EVENT_HEARTBEAT)) == -1)
+			worker_close_connection(worker, conn);
+		else {
+			worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+					STREAM_HEARTBEAT_INTERVAL);
+			worker_flush_connection(worker, conn);
+		}
+
+		return;
+	}
+
+	/* WebSocket clients are pinged the same way; they answer by themselves */
+	if (conn->ws && conn->state != CONN_STATE_WRITING) {
+		if (conn_has_pending_output(conn)) {
+			__atomic_add_fetch(&__stream_evictions, 1, __ATOMIC_RELAXED);
+			worker_close_connection(worker, conn);
+		}
+		else if (send_websocket_message(conn, WEBSOCKET_OPCODE_PING, NULL, 0) == -1)
+			worker_close_connection(worker, conn);
+		else {
+			worker_set_deadline(worker, conn, rpiwd_monotonic_usec() / 1000 +
+					STREAM_HEARTBEAT_INTERVAL);
+			worker_flush_connection(worker, conn);
+		}
+
+		return;
+	}
+
+	/* Long polls that saw no newer data are answered with what there is */
+	if (conn->state == CONN_STATE_PARKED) {
+		worker_resume_request(worker, conn, NULL);
+
+		/* Continue with requests the client pipelined behind this one */
+		if (!conn->is_closed && conn->state == CONN_STATE_READING)
+			worker_handle_request(worker, conn);
+
+		return;
+	}
+
+	/* Tell clients that sent half a request why they are dropped. Once the
+	 * response is under way, there is nothing left to tell them. */
+	if (conn->state == CONN_STATE_READING && conn->inlen > 0 &&
+		!conn_has_pending_output(conn)) {
+		conn->keep_alive = false;
+		send_http_error_response(conn,
+				HTTP_CODE_REQUEST_TIMEOUT,
+				HTTP_CODE_REQUEST_TIMEOUT,
+				http_code_str(HTTP_CODE_REQUEST_TIMEOUT));
+		conn_flush(conn);
+	}
+
+	worker_close_connection(worker, conn);
+}
+
+void worker_record_wait(rpiwd_worker *worker, uint64_t since, uint64_t now) {
+	__atomic_add_fetch(&worker->wait_usec, now > since ? now - since : 0, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&worker->wait_samples, 1, __ATOMIC_RELAXED);
 }
 
-int get_bound_socket(int port) {
+int get_bound_socket(int port, bool reuseport) {
 	struct addrinfo hints = { 0 };
 	struct addrinfo *result, *rp;
-	int optval = 1, sockfd;
+	int optval = 1, sockfd = -1;
 	char str_port[STR_PORT_BUFFER_SIZE];
 
 	hints.ai_canonname = NULL;
@@ -343,23 +2616,79 @@ int get_bound_socket(int port) {
 		if (sockfd == -1)
 			continue;
 
-		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1)
-			return -1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1) {
+			close(sockfd);
+			sockfd = -1;
+			break;
+		}
+
+#ifdef SO_REUSEPORT
+		/* Let several sockets (one per worker) share the same port */
+		if (reuseport &&
+			setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1) {
+			close(sockfd);
+			sockfd = -1;
+			break;
+		}
+#endif /* SO_REUSEPORT */
 
 		if (bind(sockfd, rp->ai_addr, rp->ai_addrlen) == 0)
-			return sockfd;
-		else
-			return -1;
+			break;
 
 		/* On failure close socket */
 		close(sockfd);
+		sockfd = -1;
+		break;
 	}
 
 	freeaddrinfo(result);
 
-	/* Loop should eventually return; if it doesn't, this is reached.
-	 * Should return an error. */
-	return -1;
+	return sockfd;
+}
+
+int get_unix_socket(const char *path) {
+	struct sockaddr_un addr;
+	struct stat st;
+	int sockfd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* A socket file left behind by an earlier run would make bind() fail.
+	 * Anything else at that path is not ours to remove. */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EEXIST;
+			return -1;
+		}
+
+		if (unlink(path) == -1)
+			return -1;
+	}
+	else if (errno != ENOENT)
+		return -1;
+
+	sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sockfd == -1)
+		return -1;
+
+	/* Anyone on the machine may connect, just like over TCP */
+	if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+		chmod(path, 0666) == -1 ||
+		listen(sockfd, SOMAXCONN) == -1) {
+		close(sockfd);
+		return -1;
+	}
+
+	strcpy(__unix_socket_path, path);
+
+	return sockfd;
 }
 
 /* Command callbacks */
@@ -380,34 +2709,99 @@ const char *command_callback_strerror(int errcode) {
 		case CALLBACK_RETCODE_NO_PARAMS_NEEDED:
 			return "Parameters provided to command but the command does "\
 				   "not accept any arguments.";
+		case CALLBACK_RETCODE_MEMORY_ERROR:
+			return "Out of memory.";
+		case CALLBACK_RETCODE_DEVICE_ERROR:
+			return "No recent reading from the device; try again later.";
+		case CALLBACK_RETCODE_RATE_LIMITED:
+			return "Too many requests; try again later.";
+		case CALLBACK_RETCODE_UPGRADE_REQUIRED:
+			return "Command requires a WebSocket handshake (version "
+				STR(WEBSOCKET_VERSION) ").";
+		case CALLBACK_RETCODE_BAD_HANDSHAKE:
+			return "Malformed WebSocket handshake.";
+		case CALLBACK_RETCODE_BAD_MESSAGE:
+			return "Malformed WebSocket message; expected a JSON object with an \"op\".";
+		case CALLBACK_RETCODE_RESULT_TOO_LARGE:
+			return "Result is too large; narrow the query down.";
+		case CALLBACK_RETCODE_HTTP11_REQUIRED:
+			return "Command streams its response, which requires HTTP/1.1.";
 	}
 
 	return "Unknown command callback error.";
 }
 
-int dispatch_command(http_cmd *params, rpiwd_mqmsg *msgbuff) {
-	cmd_callback *ptr = &CMD_CALLBACK_TABLE[0];
+void init_dispatch_tables(void) {
+	/* Only fails if the tables outgrow the hash; nothing would work then */
+	if (perfect_hash_build(&__command_hash, CMD_CALLBACK_NAMES,
+				sizeof(CMD_CALLBACK_NAMES) / sizeof(CMD_CALLBACK_NAMES[0])) == -1 ||
+		perfect_hash_build(&__fetch_param_hash, FETCH_PARAM_NAMES, FETCH_PARAM_COUNT) == -1) {
+        rpiwd_log(LOG_ERR, "Unable to build command lookup tables.");
+		exit(EXIT_FAILURE);
+	}
+}
 
-	while (ptr->cmd_name)
-        if (strcmp(ptr->cmd_name, params->cmdname) != 0)
-            ptr++;
-        else break;
+cmd_callback *find_command(const char *cmd_name, size_t length) {
+	int index = perfect_hash_lookup(&__command_hash, cmd_name, length);
+
+	return index == PERFECT_HASH_NO_KEY ? NULL : &CMD_CALLBACK_TABLE[index];
+}
+
+int dispatch_command(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+	cmd_callback *ptr = find_command(params->cmdname, params->cmdname_length);
 
-    if (ptr->cmd_name)
+    if (ptr)
         return ptr->callback(params, msgbuff);
 	else
 		return CALLBACK_RETCODE_UNKNOWN_COMMAND;
 }
 
+int take_format_param(http_cmd *params, int *format) {
+	http_cmd_param *param;
+
+	/* Any command may be asked for an encoding; the callbacks never see it.
+	 * Those that only answer in one encoding (streams) ignore it. */
+	for (size_t i = 0; i < params->length; i++) {
+		param = &params->params[i];
+		if (strcmp(param->name, LISTENER_FORMAT_PARAM) != 0)
+			continue;
+
+		if (param->value && strcmp(param->value, LISTENER_FORMAT_JSON) == 0)
+			*format = RPIWD_FORMAT_JSON;
+		else if (param->value && strcmp(param->value, LISTENER_FORMAT_CBOR) == 0)
+			*format = RPIWD_FORMAT_CBOR;
+		else if (param->value && strcmp(param->value, LISTENER_FORMAT_CSV) == 0)
+			*format = RPIWD_FORMAT_CSV;
+		else
+			return CALLBACK_RETCODE_PARAM_ERROR;
+
+		/* Names are unique, so there is no other one to look for */
+		memmove(param, param + 1, (params->length - i - 1) * sizeof(http_cmd_param));
+		params->length--;
+
+		break;
+	}
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+int command_ratelimit_bucket(const char *cmd_name, size_t length) {
+	cmd_callback *ptr = find_command(cmd_name, length);
+
+	return ptr ? ptr->ratelimit_bucket : RATELIMIT_BUCKET_NONE;
+}
+
 int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	time_t from = 0, to = 0, on = 0, temp;
+	uint64_t since_id = 0;
 	http_cmd_param *ptr;
     char *retval;
-    int retflag = 0, select = 0;
-    bool rdtn_performed;
+    int retflag = 0, select = 0, param_id;
+    long wait = 0;
+    bool rdtn_performed, has_since_id = false;
 
 	/* Point at first argument, if any */
-	if (params->params)
+	if (params->length > 0)
 		ptr = &params->params[0];
 	else
 		return CALLBACK_RETCODE_PARAMS_MISSING;
@@ -422,7 +2816,9 @@ int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 			break;
         }
 
-        if (strcmp(ptr->name, "tempunit") == 0) {
+        param_id = perfect_hash_lookup(&__fetch_param_hash, ptr->name, ptr->name_length);
+
+        if (param_id == FETCH_PARAM_TEMPUNIT) {
             /* Should be one character */
             if (strlen(ptr->value) == 1)
                 ptr->value[0] = tolower(ptr->value[0]);
@@ -441,8 +2837,8 @@ int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
                 break;
             }
         }
-        else if (strcmp(ptr->name, "from") == 0 || strcmp(ptr->name, "to") == 0 ||
-                 strcmp(ptr->name, "on") == 0) {
+        else if (param_id == FETCH_PARAM_FROM || param_id == FETCH_PARAM_TO ||
+                 param_id == FETCH_PARAM_ON) {
             /* Get date input and normalize it */
             temp = normalize_date(ptr->value, &rdtn_performed);
             if (temp == 0 || temp == -1) {
@@ -450,19 +2846,28 @@ int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
                 break;
             }
 
-            /* Check parameter name again */
-            if (strcmp(ptr->name, "from") == 0)
+            if (param_id == FETCH_PARAM_FROM)
                 from = rdtn_performed ? DAY_START(temp) : temp;
-            else if (strcmp(ptr->name, "to") == 0)
+            else if (param_id == FETCH_PARAM_TO)
                 to = rdtn_performed ? DAY_END(temp) : temp;
-            else if (strcmp(ptr->name, "on") == 0)
+            else
                 on = temp;
         }
-        else if (strcmp(ptr->name, "select") == 0) {
+        else if (param_id == FETCH_PARAM_SELECT) {
             select = strtol(ptr->value, NULL, 10);
             if (errno == ERANGE || select < 0)
                 return CALLBACK_RETCODE_PARAM_ERROR;
         }
+        else if (param_id == FETCH_PARAM_SINCE_ID) {
+            if (parse_since_id_param(ptr->value, &since_id) == -1)
+                return CALLBACK_RETCODE_PARAM_ERROR;
+
+            has_since_id = true;
+        }
+        else if (param_id == FETCH_PARAM_WAIT) {
+            if ((wait = parse_wait_param(ptr->value)) == -1)
+                return CALLBACK_RETCODE_PARAM_ERROR;
+        }
         else {
             retflag = CALLBACK_RETCODE_UNKNOWN_PARAM;
             break;
@@ -473,6 +2878,11 @@ int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	if (retflag > 0)
 		return retflag;
 
+	/* A row ID selects rows by itself; none of the queries below take it
+	 * together with dates or a row count */
+	if (has_since_id && (from || to || on || select))
+		return CALLBACK_RETCODE_PARAM_ERROR;
+
 	/* Build SQL queries */
 	msgbuff->mtype = DB_MSGTYPE_FETCH;
 
@@ -480,61 +2890,190 @@ int fetch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
      * TODO: This is pretty ugly. Replace this in the future. */
     if (from && !to && !on && !select) {
 		/* Use "BY_DATE" queries */
-		msgbuff->fcountq = format_query(SQLCMD_COUNT_BY_DATE, '>', difftime(from, 0));
-		msgbuff->fselectq = format_query(SQLCMD_READ_BY_DATE, '>', difftime(from, 0));
+		msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_BY_DATE, '>', difftime(from, 0));
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE, '>', difftime(from, 0));
 	}
     else if (from && to && !select && !on) {
 		/* Use "BY_DATE_RANGE" queries */
-		msgbuff->fcountq = format_query(SQLCMD_COUNT_BY_DATE_RANGE, difftime(from, 0),
+		msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_BY_DATE_RANGE, difftime(from, 0),
 			   	difftime(to, 0));
-		msgbuff->fselectq = format_query(SQLCMD_READ_BY_DATE_RANGE, difftime(from, 0),
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE_RANGE, difftime(from, 0),
 			   	difftime(to, 0));
 	}
     else if (!from && to && !select && !on) {
 		/* Use "BY_DATE" queries */
-		msgbuff->fcountq = format_query(SQLCMD_COUNT_BY_DATE, '<', difftime(to, 0));
-		msgbuff->fselectq = format_query(SQLCMD_READ_BY_DATE, '<', difftime(to, 0));
+		msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_BY_DATE, '<', difftime(to, 0));
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE, '<', difftime(to, 0));
 	}
     else if (!from && !to && !select && on) {
 		/* Use "BY_DATE_RANGE" queries */
-		msgbuff->fcountq = format_query(SQLCMD_COUNT_BY_DATE_RANGE, 
+		msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_BY_DATE_RANGE, 
 				difftime(DAY_START(on), 0),
 			   	difftime(DAY_END(on), 0));
-		msgbuff->fselectq = format_query(SQLCMD_READ_BY_DATE_RANGE, 
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE_RANGE, 
 				difftime(DAY_START(on), 0),
 			   	difftime(DAY_END(on), 0));
 	}
     else if (!from && !to && !on && select > 0) {
-        msgbuff->fcountq = format_query(SQLCMD_COUNT_SELECT_N, select);
-        msgbuff->fselectq = format_query(SQLCMD_SELECT_N, select);
+        msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_SELECT_N, select);
+        msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_SELECT_N, select);
     }
+	else if (!from && !to && !on && !select && has_since_id) {
+		/* Use "SINCE_ID" queries */
+		msgbuff->fcountq = format_query(msgbuff->arena, SQLCMD_COUNT_SINCE_ID,
+				(unsigned long long)since_id);
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_SINCE_ID,
+				(unsigned long long)since_id);
+	}
 	else 
         return CALLBACK_RETCODE_PARAM_ERROR;
 
+	/* Long polls wait for rows the query would return, which only makes
+	 * sense for queries without an end */
+	if (wait > 0) {
+		if (to || on || select)
+			return CALLBACK_RETCODE_PARAM_ERROR;
+
+		msgbuff->wait_ms = wait * 1000;
+		msgbuff->newer_than_id = since_id;
+		msgbuff->newer_than_time = from;
+	}
+
 	return retflag;
 }
 
-/* TODO: This duplicates pretty much all of the code in the query loop
- * that's in rpiweatherd.c.
- * For future versions, combine these two into a single function in device.c */
-int current_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
-	float temp[2];
-    int qattempts = 0, qflag;
-    bool keep_native_unit;
+int export_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+	time_t from = 0, to = 0, temp;
+	http_cmd_param *ptr = params->params;
+	bool rdtn_performed;
+	int param_id;
 
-    /* Command should have one/no parameters. */
-    if (params->length == 1) {
-        http_cmd_param *param = &params->params[0];
+	/* Rows are written as they are read, with no cap on how many;
+	 * that takes a chunked response */
+	if (!params->is_http11)
+		return CALLBACK_RETCODE_HTTP11_REQUIRED;
 
-        /* Should be one character, so lower it if needed. */
-        if (strlen(param->value) == 1)
-            param->value[0] = tolower(param->value[0]);
-        else
+	/* Same parameters as fetch, down to a date range */
+	for (size_t i = 0; i < params->length; i++, ptr++) {
+		rdtn_performed = true;
+
+		if (!ptr->value)
+			return CALLBACK_RETCODE_PARAM_ERROR;
+
+		param_id = perfect_hash_lookup(&__fetch_param_hash, ptr->name, ptr->name_length);
+
+		if (param_id == FETCH_PARAM_TEMPUNIT) {
+			if (strlen(ptr->value) != 1)
+				return CALLBACK_RETCODE_PARAM_ERROR;
+
+			ptr->value[0] = tolower(ptr->value[0]);
+			if (ptr->value[0] != RPIWD_TEMPERATURE_CELSIUS &&
+				ptr->value[0] != RPIWD_TEMPERATURE_FARENHEIT)
+				return CALLBACK_RETCODE_PARAM_ERROR;
+
+			msgbuff->unitstr[RPIWD_MEASURE_TEMPERATURE] = ptr->value[0];
+		}
+		else if (param_id == FETCH_PARAM_FROM || param_id == FETCH_PARAM_TO) {
+			temp = normalize_date(ptr->value, &rdtn_performed);
+			if (temp == 0 || temp == -1)
+				return CALLBACK_RETCODE_PARAM_ERROR;
+
+			if (param_id == FETCH_PARAM_FROM)
+				from = rdtn_performed ? DAY_START(temp) : temp;
+			else
+				to = rdtn_performed ? DAY_END(temp) : temp;
+		}
+		else
+			return CALLBACK_RETCODE_UNKNOWN_PARAM;
+	}
+
+	/* Without a range, the whole history */
+	if (from && to)
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE_RANGE,
+				difftime(from, 0), difftime(to, 0));
+	else if (from)
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE, '>', difftime(from, 0));
+	else if (to)
+		msgbuff->fselectq = format_query(msgbuff->arena, SQLCMD_READ_BY_DATE, '<', difftime(to, 0));
+	else
+		msgbuff->fselectq = arena_strdup(msgbuff->arena, SQLCMD_READ_ALL_ROWS);
+
+	if (!msgbuff->fselectq)
+		return CALLBACK_RETCODE_MEMORY_ERROR;
+
+	/* Streamed from a cursor, so there is no count to take first */
+	msgbuff->mtype = DB_MSGTYPE_FETCH_STREAM;
+	msgbuff->format = RPIWD_FORMAT_CSV;
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+long parse_wait_param(const char *value) {
+	char *endptr;
+	long wait;
+
+	/* Whole seconds, up to a limit */
+	errno = 0;
+	wait = strtol(value, &endptr, 10);
+	if (errno == ERANGE || *endptr != '\0' || endptr == value ||
+		wait <= 0 || wait > LONGPOLL_MAX_WAIT)
+		return -1;
+
+	return wait;
+}
+
+int parse_max_age_param(const char *value) {
+	char *endptr;
+	long max_age;
+
+	/* Whole seconds; 0 always reads the device */
+	errno = 0;
+	max_age = strtol(value, &endptr, 10);
+	if (errno == ERANGE || *endptr != '\0' || endptr == value ||
+		max_age < 0 || max_age > INT_MAX / 1000)
+		return -1;
+
+	return max_age * 1000;
+}
+
+int parse_since_id_param(const char *value, uint64_t *since_id) {
+	char *endptr;
+
+	/* Row IDs start at 1; 0 is from the very first row */
+	errno = 0;
+	*since_id = strtoull(value, &endptr, 10);
+	if (errno == ERANGE || *endptr != '\0' || endptr == value || value[0] == '-')
+		return -1;
+
+	return 0;
+}
+
+int current_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+    uint64_t since_id = 0;
+    http_cmd_param *param;
+    bool has_since_id = false;
+    long wait = 0;
+    int param_id, flag;
+
+    /* Command takes 'tempunit' and 'maxage', and for long polls 'wait'
+     * and 'since_id' */
+    if (params->length > FETCH_PARAM_COUNT)
+        return CALLBACK_RETCODE_TOO_MANY_PARAMS;
+
+    for (int i = 0; i < params->length; i++) {
+        param = &params->params[i];
+        if (!param->value)
             return CALLBACK_RETCODE_PARAM_ERROR;
 
-        /* Only valid parameter is 'tempunit' */
-        if (strcmp(param->name, "tempunit") == 0) {
-            /* Check length and lower */
+        param_id = perfect_hash_lookup(&__fetch_param_hash, param->name, param->name_length);
+
+        if (param_id == FETCH_PARAM_TEMPUNIT) {
+            /* Should be one character, so lower it if needed. */
+            if (strlen(param->value) == 1)
+                param->value[0] = tolower(param->value[0]);
+            else
+                return CALLBACK_RETCODE_PARAM_ERROR;
+
             switch (param->value[0]) {
             case RPIWD_TEMPERATURE_FARENHEIT:
                 msgbuff->unitstr[RPIWD_MEASURE_TEMPERATURE] = RPIWD_TEMPERATURE_FARENHEIT;
@@ -546,32 +3085,86 @@ int current_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
                 return CALLBACK_RETCODE_PARAM_ERROR;
             }
         }
+        else if (param_id == FETCH_PARAM_WAIT) {
+            if ((wait = parse_wait_param(param->value)) == -1)
+                return CALLBACK_RETCODE_PARAM_ERROR;
+        }
+        else if (param_id == FETCH_PARAM_SINCE_ID) {
+            if (parse_since_id_param(param->value, &since_id) == -1)
+                return CALLBACK_RETCODE_PARAM_ERROR;
+
+            has_since_id = true;
+        }
+        else if (param_id == FETCH_PARAM_MAXAGE) {
+            if ((msgbuff->max_age_ms = parse_max_age_param(param->value)) == -1)
+                return CALLBACK_RETCODE_PARAM_ERROR;
+        }
         else
             return CALLBACK_RETCODE_UNKNOWN_PARAM;
     }
-    else if (params->length > 1)
-        return CALLBACK_RETCODE_TOO_MANY_PARAMS;
 
-	/* Query data */
-	do {
-        qflag = device_query_current(temp);
-        qattempts++;
-
-        /* Check if conversion is needed */
-        keep_native_unit = msgbuff->unitstr[RPIWD_MEASURE_TEMPERATURE] ==
-                           RPIWD_TEMPERATURE_CELSIUS;
-        if (qflag == RPIWD_DEVRETCODE_SUCCESS && !keep_native_unit)
-            RPIWD_CELSIUS_TO_FARENHEIT(temp[0]);
-	} while (qflag != RPIWD_DEVRETCODE_SUCCESS && qattempts < CONFIG_MAX_QUERY_ATTEMPTS);
-
-	/* Check whether query has been successful */
-	if (qflag != RPIWD_DEVRETCODE_SUCCESS)
+    /* A row ID is only of use to a long poll */
+    if (has_since_id && wait == 0)
+        return CALLBACK_RETCODE_PARAM_ERROR;
+
+    msgbuff->mtype = DB_MSGTYPE_CURRENT;
+    msgbuff->is_completed = 1;
+
+    /* Long polls are answered with the first sample after the given one
+     * (or after the newest one), and with the latest reading if none came */
+    if (wait > 0) {
+        msgbuff->wait_ms = wait * 1000;
+        msgbuff->newer_than_id = has_since_id ? since_id : dbhandler_data_version();
+
+        return CALLBACK_RETCODE_SUCCESS;
+    }
+
+    /* The latest reading, unless it is older than the client would have it */
+    if ((flag = current_latest_sample(msgbuff)) != CALLBACK_RETCODE_DEVICE_ERROR)
+        return flag;
+
+    /* Reading the device takes a while, so the worker does not do it. The
+     * request waits for the query loop to take a reading; no row will do,
+     * as it might hold an older one. */
+    msgbuff->wait_ms = CURRENT_SAMPLE_WAIT;
+    msgbuff->newer_than_id = UINT64_MAX;
+    msgbuff->reading_after_usec = rpiwd_monotonic_usec();
+
+    return CALLBACK_RETCODE_SAMPLE_PENDING;
+}
+
+int current_latest_sample(rpiwd_mqmsg *msgbuff) {
+	float temp[DEVICE_SAMPLE_VALUES];
+	char date_buffer[DATE_BUFFER_SIZE];
+	uint64_t taken_usec, now_usec, max_age_usec;
+	time_t taken_at;
+	struct tm tm;
+	int id;
+
+	/* By default, a reading may have missed a round of the query loop,
+	 * but not more; past that, the device is likely failing */
+	max_age_usec = msgbuff->max_age_ms >= 0 ? msgbuff->max_age_ms * 1000ULL :
+		CURRENT_DEFAULT_MAX_AGE_INTERVALS * 1000ULL *
+		rpiwd_units_to_milliseconds(get_current_config()->query_interval);
+
+	/* The query loop keeps the latest reading around. One taken since the
+	 * request asked for it is new enough, whatever the age. */
+	if (!device_latest_sample(temp, &taken_usec, &taken_at, &id))
 		return CALLBACK_RETCODE_DEVICE_ERROR;
 
+	now_usec = rpiwd_monotonic_usec();
+	if (now_usec > taken_usec + max_age_usec &&
+		!(msgbuff->reading_after_usec > 0 && taken_usec >= msgbuff->reading_after_usec))
+		return CALLBACK_RETCODE_DEVICE_ERROR;
+
+	/* Check if conversion is needed */
+	if (msgbuff->unitstr[RPIWD_MEASURE_TEMPERATURE] != RPIWD_TEMPERATURE_CELSIUS)
+		RPIWD_CELSIUS_TO_FARENHEIT(temp[0]);
+
 	/* Allocate an entry */
 	msgbuff->data = entry_alloc();
 	if (!(entry *)msgbuff->data)
-		return CALLBACK_RETCODE_DEVICE_ERROR;
+		return CALLBACK_RETCODE_MEMORY_ERROR;
 
 	entry *ent_ptr = (entry *)msgbuff->data;
 
@@ -579,14 +3172,22 @@ int current_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	msgbuff->mtype = DB_MSGTYPE_CURRENT;
 	msgbuff->is_completed = 1;
 
-	/* Put entry details */
-	ent_ptr->id = -1;
-	ent_ptr->record_date = NULL;
+	/* Put entry details; the date tells the client how old the reading is */
+	strftime(date_buffer, sizeof(date_buffer), DB_RECORD_DATE_FORMAT, gmtime_r(&taken_at, &tm));
+	ent_ptr->id = id;
+	ent_ptr->record_date = strdup(date_buffer);
 	ent_ptr->temperature = temp[0];
 	ent_ptr->humidity = temp[1];
 	ent_ptr->location = strdup(get_current_config()->measure_location);
 	ent_ptr->device_name = strdup(get_current_config()->device_name);
 
+	if (!ent_ptr->record_date || !ent_ptr->location || !ent_ptr->device_name) {
+		entry_ptr_free(ent_ptr);
+		msgbuff->data = NULL;
+
+		return CALLBACK_RETCODE_MEMORY_ERROR;
+	}
+
 	return CALLBACK_RETCODE_SUCCESS;
 }
 
@@ -630,20 +3231,323 @@ int statistics_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	sprintf(buffer, "%lu", statbuff.f_bsize * statbuff.f_bfree);
 	key_value_list_emplace(lptr, "freedisk", buffer);
 
+	/* Worker pool size and load over the last interval */
+	sprintf(buffer, "%d", pool_size());
+	key_value_list_emplace(lptr, "worker_threads", buffer);
+
+	sprintf(buffer, "%llu", (unsigned long long)pool_queue_wait());
+	key_value_list_emplace(lptr, "queue_wait_usec", buffer);
+
+	sprintf(buffer, "%u", pool_queue_depth());
+	key_value_list_emplace(lptr, "queue_depth", buffer);
+
+	/* Requests and samples dropped because the DB thread could not keep up */
+	sprintf(buffer, "%llu", (unsigned long long)dbhandler_shed_reads());
+	key_value_list_emplace(lptr, "shed_requests", buffer);
+
+	sprintf(buffer, "%llu", (unsigned long long)dbhandler_shed_writes());
+	key_value_list_emplace(lptr, "shed_samples", buffer);
+
+	/* Event stream clients, and those dropped for not keeping up */
+	sprintf(buffer, "%u", pool_subscribers());
+	key_value_list_emplace(lptr, "stream_subscribers", buffer);
+
+	sprintf(buffer, "%llu", (unsigned long long)pool_stream_evictions());
+	key_value_list_emplace(lptr, "stream_evictions", buffer);
+
 	/* The rest will be populated in the database thread, so prepare the queries... */
 	msgbuff->mtype = DB_MSGTYPE_STATS;
-	msgbuff->fselectq = strdup(SQLCMD_SELECT_STATS);
-	msgbuff->fcountq = strdup(SQLCMD_COUNT_INITIAL_STATS);
+	msgbuff->fselectq = arena_strdup(msgbuff->arena, SQLCMD_SELECT_STATS);
+	msgbuff->fcountq = arena_strdup(msgbuff->arena, SQLCMD_COUNT_INITIAL_STATS);
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+int stream_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+	if (params->length > 0)
+		return CALLBACK_RETCODE_NO_PARAMS_NEEDED;
+
+	/* Nothing to look up; the worker subscribes the client */
+	msgbuff->mtype = DB_MSGTYPE_SUBSCRIBE;
+	msgbuff->is_completed = 1;
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+int websocket_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+	char *key;
+
+	if (params->length > 0)
+		return CALLBACK_RETCODE_NO_PARAMS_NEEDED;
+
+	if (!params->websocket_key || params->websocket_version != WEBSOCKET_VERSION)
+		return CALLBACK_RETCODE_UPGRADE_REQUIRED;
+
+	if (params->websocket_key_length != WEBSOCKET_KEY_LENGTH)
+		return CALLBACK_RETCODE_BAD_HANDSHAKE;
+
+	/* The key points into the request; the worker answers before that is gone */
+	key = arena_alloc(msgbuff->arena, WEBSOCKET_KEY_LENGTH + 1);
+	if (!key)
+		return CALLBACK_RETCODE_MEMORY_ERROR;
+
+	memcpy(key, params->websocket_key, WEBSOCKET_KEY_LENGTH);
+	key[WEBSOCKET_KEY_LENGTH] = '\0';
+
+	msgbuff->mtype = DB_MSGTYPE_WEBSOCKET;
+	msgbuff->data = key;
+	msgbuff->is_completed = 1;
+
+	return CALLBACK_RETCODE_SUCCESS;
+}
+
+int batch_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
+	rpiwd_mqmsg_batch *batch;
+	rpiwd_mqmsg *part;
+	char *body;
+	int flag;
+
+	/* Parts keep their results in the arena until all of them are answered */
+	if (!msgbuff->arena)
+		return CALLBACK_RETCODE_MEMORY_ERROR;
+
+	/* Commands come in the query string, or as a form body for those that
+	 * would not fit there. The body is copied, since splitting it up writes
+	 * past its end, into whatever the client pipelined after it. */
+	if (params->length == 0 && params->body_length > 0) {
+		body = arena_alloc(msgbuff->arena, params->body_length + 1);
+		if (!body)
+			return CALLBACK_RETCODE_MEMORY_ERROR;
+
+		memcpy(body, params->body, params->body_length);
+		flag = http_parse_query(body, body + params->body_length, params);
+		if (flag != HTTP_PARSER_ERROR_SUCCESS)
+			return batch_query_error(flag);
+	}
+
+	if (params->length == 0)
+		return CALLBACK_RETCODE_PARAMS_MISSING;
+	else if (params->length > DB_MSG_BATCH_MAX_PARTS)
+		return CALLBACK_RETCODE_TOO_MANY_PARAMS;
+
+	batch = arena_alloc(msgbuff->arena, sizeof(rpiwd_mqmsg_batch));
+	if (!batch)
+		return CALLBACK_RETCODE_MEMORY_ERROR;
+
+	memset(batch, 0, sizeof(rpiwd_mqmsg_batch));
+
+	/* Every part is a command of its own. One that fails is answered with
+	 * its error, and does not fail the others. */
+	for (int i = 0; i < params->length; i++) {
+		part = &batch->parts[batch->length];
+		batch->names[batch->length++] = params->params[i].name;
+
+		rpiwd_mqmsg_init(part);
+		part->conn = msgbuff->conn;
+		part->arena = msgbuff->arena;
+		part->sockfd = msgbuff->sockfd;
+		part->receiver = msgbuff->receiver;
+
+		part->retcode = batch_dispatch_command(&params->params[i], part);
+		if (part->retcode != CALLBACK_RETCODE_SUCCESS) {
+			worker_free_message(part);
+			part->data = NULL;
+		}
+	}
+
+	msgbuff->mtype = DB_MSGTYPE_BATCH;
+	msgbuff->data = batch;
+	msgbuff->is_completed = 1;
 
 	return CALLBACK_RETCODE_SUCCESS;
 }
 
+int batch_dispatch_command(http_cmd_param *param, rpiwd_mqmsg *msgbuff) {
+	cmd_callback *ptr = find_command(param->name, param->name_length);
+	unsigned int retry_after;
+	http_cmd cmd;
+	int flag;
+
+	/* Only commands answered with a single document can be part of one */
+	if (!ptr || ptr->callback == batch_command_callback ||
+		ptr->callback == stream_command_callback ||
+		ptr->callback == websocket_command_callback ||
+		ptr->callback == export_command_callback)
+		return CALLBACK_RETCODE_UNKNOWN_COMMAND;
+
+	/* Commands with limits of their own pay for themselves in a batch too */
+	if (ptr->ratelimit_bucket != RATELIMIT_BUCKET_NONE &&
+		!ratelimit_admit(&msgbuff->conn->peer, ptr->ratelimit_bucket,
+				get_current_config()->rate_limit_current, LISTENER_COMMAND_BURST,
+				rpiwd_monotonic_usec(), &retry_after))
+		return CALLBACK_RETCODE_RATE_LIMITED;
+
+	/* The value is the command's own query string, URL-encoded */
+	memset(&cmd, 0, sizeof(http_cmd));
+	cmd.cmdname = param->name;
+	cmd.cmdname_length = param->name_length;
+
+	if (param->value) {
+		param->value_length = http_url_decode(param->value, param->value_length);
+
+		flag = http_parse_query(param->value, param->value + param->value_length, &cmd);
+		if (flag != HTTP_PARSER_ERROR_SUCCESS)
+			return batch_query_error(flag);
+	}
+
+	flag = ptr->callback(&cmd, msgbuff);
+
+	/* A long poll would hold up every other part, and so would waiting
+	 * for a fresh reading; without one, there are no current values */
+	if (flag == CALLBACK_RETCODE_SAMPLE_PENDING)
+		return CALLBACK_RETCODE_DEVICE_ERROR;
+	if (flag == CALLBACK_RETCODE_SUCCESS && msgbuff->wait_ms > 0)
+		return CALLBACK_RETCODE_PARAM_ERROR;
+
+	return flag;
+}
+
+int batch_query_error(int response) {
+	switch (response) {
+		case HTTP_PARSER_ERROR_TOO_MANY_PARAMS:
+			return CALLBACK_RETCODE_TOO_MANY_PARAMS;
+		case HTTP_PARSER_ERROR_DUPLICATE_PARAMS:
+			return CALLBACK_RETCODE_DUPLICATE_PARAMS;
+	}
+
+	return CALLBACK_RETCODE_PARAM_ERROR;
+}
+
+bool batch_needs_db(const rpiwd_mqmsg_batch *batch) {
+	for (size_t i = 0; i < batch->length; i++) {
+		if (batch->parts[i].retcode == CALLBACK_RETCODE_SUCCESS &&
+			(batch->parts[i].mtype == DB_MSGTYPE_FETCH ||
+			 batch->parts[i].mtype == DB_MSGTYPE_STATS))
+			return true;
+	}
+
+	return false;
+}
+
+JSON_Value *batch_to_json_value(rpiwd_mqmsg_batch *batch) {
+	JSON_Value *rootval = json_value_init_object(), *jval;
+	JSON_Object *mainobject = json_value_get_object(rootval), *errobject;
+	JSON_Object *results;
+	rpiwd_mqmsg *part;
+	int errcode;
+
+	/* {"length":N, ..., "results":{"<command>":<what it returns alone>}} */
+	json_object_set_number(mainobject, "length", batch->length);
+	json_object_set_number(mainobject, "errcode", 0);
+	json_object_set_string(mainobject, "errmsg", "");
+
+	json_object_set_value(mainobject, "results", json_value_init_object());
+	results = json_object_get_object(mainobject, "results");
+
+	for (size_t i = 0; i < batch->length; i++) {
+		part = &batch->parts[i];
+		jval = NULL;
+
+		if (part->retcode == CALLBACK_RETCODE_SUCCESS) {
+			switch (part->mtype) {
+				case DB_MSGTYPE_FETCH:
+					jval = entrylist_to_json_value((entrylist **)&part->data, part->unitstr);
+					break;
+				case DB_MSGTYPE_CURRENT:
+					jval = entry_to_json_value((entry *)part->data, part->unitstr);
+					break;
+				case DB_MSGTYPE_STATS:
+				case DB_MSGTYPE_CONFIG:
+					jval = key_value_list_to_json_value((key_value_list **)&part->data);
+					break;
+			}
+		}
+
+		/* Failed parts look like a failed request on its own would.
+		 * The worker's errors and the DB thread's do not overlap. */
+		if (!jval) {
+			errcode = part->retcode == CALLBACK_RETCODE_SUCCESS ?
+				DBHANDLER_ERROR_NO_MEMORY : part->retcode;
+
+			jval = json_value_init_object();
+			errobject = json_value_get_object(jval);
+
+			json_object_set_number(errobject, "length", 0);
+			json_object_set_number(errobject, "errcode", errcode);
+			json_object_set_string(errobject, "errmsg",
+					errcode <= CALLBACK_RETCODE_UNKNOWN_PARAM ?
+					command_callback_strerror(errcode) : dbhandler_strerror(errcode));
+		}
+
+		json_object_set_value(results, batch->names[i], jval);
+	}
+
+	return rootval;
+}
+
+int batch_to_cbor(strbuf *buf, rpiwd_mqmsg_batch *batch) {
+	rpiwd_mqmsg *part;
+	int errcode, flag;
+
+	/* Same document as batch_to_json_value() */
+	flag = strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 4);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, batch->length);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "results");
+	flag = flag == -1 ? -1 : strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, batch->length);
+
+	for (size_t i = 0; flag != -1 && i < batch->length; i++) {
+		part = &batch->parts[i];
+		errcode = part->retcode;
+
+		flag = strbuf_append_cbor_string(buf, batch->names[i]);
+		if (flag == -1)
+			break;
+
+		/* Each result goes on with the next part; failures fall through.
+		 * A part that failed in the DB thread has no data. */
+		if (errcode == CALLBACK_RETCODE_SUCCESS && part->data) {
+			switch (part->mtype) {
+				case DB_MSGTYPE_FETCH:
+					flag = entrylist_to_cbor(buf, (entrylist *)part->data, part->unitstr);
+					continue;
+				case DB_MSGTYPE_CURRENT:
+					flag = entry_to_cbor(buf, (entry *)part->data, part->unitstr);
+					continue;
+				case DB_MSGTYPE_STATS:
+				case DB_MSGTYPE_CONFIG:
+					flag = key_value_list_to_cbor(buf, (key_value_list *)part->data);
+					continue;
+			}
+		}
+
+		if (errcode == CALLBACK_RETCODE_SUCCESS)
+			errcode = DBHANDLER_ERROR_NO_MEMORY;
+
+		flag = strbuf_append_cbor_head(buf, CBOR_MAJOR_MAP, 3);
+		flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "length");
+		flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, 0);
+		flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errcode");
+		flag = flag == -1 ? -1 : strbuf_append_cbor_int(buf, errcode);
+		flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf, "errmsg");
+		flag = flag == -1 ? -1 : strbuf_append_cbor_string(buf,
+				errcode <= CALLBACK_RETCODE_UNKNOWN_PARAM ?
+				command_callback_strerror(errcode) : dbhandler_strerror(errcode));
+	}
+
+	return flag;
+}
+
 int config_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	rpiwd_config *config_ptr = get_current_config(); /* Read only, so no need to lock */
 	char temp_buffer[JSON_SERIALIZER_TEMP_ID_BUFFER_SIZE];
 	
 	/* Initialize list */
-	msgbuff->data = key_value_list_alloc(config_ptr->config_count);
+	msgbuff->data = key_value_list_alloc(CONFIG_KEY_COUNT);
 	key_value_list *kvlist = (key_value_list *)msgbuff->data;
 	if (!kvlist)
 		return CALLBACK_RETCODE_MEMORY_ERROR;
@@ -662,6 +3566,51 @@ int config_command_callback(http_cmd *params, rpiwd_mqmsg *msgbuff) {
 	sprintf(temp_buffer, "%d", config_ptr->num_worker_threads);
 	key_value_list_emplace(kvlist, CONFIG_NUM_WORKER_THREADS, temp_buffer);
 
+	sprintf(temp_buffer, "%d", config_ptr->min_worker_threads);
+	key_value_list_emplace(kvlist, CONFIG_MIN_WORKER_THREADS, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->max_worker_threads);
+	key_value_list_emplace(kvlist, CONFIG_MAX_WORKER_THREADS, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->keepalive_timeout);
+	key_value_list_emplace(kvlist, CONFIG_KEEPALIVE_TIMEOUT, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->keepalive_max_requests);
+	key_value_list_emplace(kvlist, CONFIG_KEEPALIVE_MAX_REQUESTS, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->reuseport);
+	key_value_list_emplace(kvlist, CONFIG_REUSEPORT, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->compression_level);
+	key_value_list_emplace(kvlist, CONFIG_COMPRESSION_LEVEL, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->compression_min_size);
+	key_value_list_emplace(kvlist, CONFIG_COMPRESSION_MIN_SIZE, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->rate_limit_requests);
+	key_value_list_emplace(kvlist, CONFIG_RATE_LIMIT_REQUESTS, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->rate_limit_burst);
+	key_value_list_emplace(kvlist, CONFIG_RATE_LIMIT_BURST, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->rate_limit_current);
+	key_value_list_emplace(kvlist, CONFIG_RATE_LIMIT_CURRENT, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->db_read_deadline);
+	key_value_list_emplace(kvlist, CONFIG_DB_READ_DEADLINE, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->db_write_deadline);
+	key_value_list_emplace(kvlist, CONFIG_DB_WRITE_DEADLINE, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->header_timeout);
+	key_value_list_emplace(kvlist, CONFIG_HEADER_TIMEOUT, temp_buffer);
+
+	sprintf(temp_buffer, "%d", config_ptr->request_timeout);
+	key_value_list_emplace(kvlist, CONFIG_REQUEST_TIMEOUT, temp_buffer);
+
+	key_value_list_emplace(kvlist, CONFIG_UNIX_SOCKET,
+			config_ptr->unix_socket ? config_ptr->unix_socket : "");
+
 	/* Mark message type + completed */
 	msgbuff->mtype = DB_MSGTYPE_CONFIG;
 	msgbuff->is_completed = 1;
@@ -18,6 +18,19 @@
 
 void rpiwd_mqmsg_init(rpiwd_mqmsg *ret) {
     ret->fcountq = ret->fselectq = NULL;
+    ret->conn = NULL;
+    ret->arena = NULL;
+    ret->data = NULL;
+    ret->cursor = NULL;
     ret->is_completed = 0;
+    ret->retcode = 0;
+    ret->deadline_usec = 0;
+    ret->wait_ms = 0;
+    ret->newer_than_id = 0;
+    ret->newer_than_time = 0;
+    ret->max_age_ms = -1;
+    ret->reading_after_usec = 0;
+    ret->format = RPIWD_FORMAT_JSON;
+    ret->length = 0;
     memcpy(ret->unitstr, get_unit_string(), sizeof(char) * RPIWD_MAX_MEASUREMENTS);
 }
@@ -0,0 +1,142 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "msgring.h"
+
+/* Init/destroy */
+int rpiwd_msgring_init(rpiwd_msgring *ring, size_t capacity, bool nonblocking) {
+	/* Capacity must be a power of two so positions can be masked */
+	if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+		return -1;
+
+	ring->cells = malloc(sizeof(rpiwd_msgring_cell) * capacity);
+	if (!ring->cells)
+		return -1;
+
+	/* Every cell starts out free for the producer at the same position */
+	for (size_t i = 0; i < capacity; i++)
+		ring->cells[i].sequence = i;
+
+	ring->mask = capacity - 1;
+	ring->enqueue_pos = ring->dequeue_pos = 0;
+
+	ring->eventfd = eventfd(0, nonblocking ? EFD_NONBLOCK : 0);
+	if (ring->eventfd == -1) {
+		free(ring->cells);
+		ring->cells = NULL;
+		return -1;
+	}
+
+	return 1;
+}
+
+void rpiwd_msgring_destroy(rpiwd_msgring *ring) {
+	close(ring->eventfd);
+	free(ring->cells);
+
+	ring->cells = NULL;
+	ring->eventfd = -1;
+}
+
+/* Non-blocking operations */
+bool rpiwd_msgring_try_push(rpiwd_msgring *ring, const rpiwd_mqmsg *msg) {
+	rpiwd_msgring_cell *cell;
+	size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED), seq;
+	intptr_t diff;
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)pos;
+
+		if (diff == 0) {
+			/* Slot is free; try to claim it */
+			if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			return false; /* Full */
+		else
+			pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+	}
+
+	/* Publish the message to consumers */
+	cell->msg = *msg;
+	__atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+bool rpiwd_msgring_try_pop(rpiwd_msgring *ring, rpiwd_mqmsg *msg) {
+	rpiwd_msgring_cell *cell;
+	size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED), seq;
+	intptr_t diff;
+
+	for (;;) {
+		cell = &ring->cells[pos & ring->mask];
+		seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+		diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+		if (diff == 0) {
+			/* Slot holds a message; try to claim it */
+			if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			return false; /* Empty */
+		else
+			pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+	}
+
+	/* Copy the message out and hand the slot back to producers (one lap ahead) */
+	*msg = cell->msg;
+	__atomic_store_n(&cell->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+void rpiwd_msgring_send(rpiwd_msgring *ring, const rpiwd_mqmsg *msg) {
+	struct timespec tms = { .tv_sec = 0, .tv_nsec = MSGRING_PUSH_RETRY_INTERVAL };
+
+	/* Same semantics as a blocking mq_send(): wait for the consumer to make room */
+	while (!rpiwd_msgring_try_push(ring, msg))
+		nanosleep(&tms, NULL);
+
+	rpiwd_msgring_notify(ring);
+}
+
+/* Consumer wakeup handling */
+void rpiwd_msgring_notify(rpiwd_msgring *ring) {
+	uint64_t one = 1;
+
+	/* The eventfd counter coalesces wakeups; a failed write means it is already set */
+	while (write(ring->eventfd, &one, sizeof(uint64_t)) == -1 && errno == EINTR);
+}
+
+int rpiwd_msgring_wait(rpiwd_msgring *ring) {
+	uint64_t count;
+	ssize_t flag;
+
+	/* Blocks on a blocking eventfd; on a non-blocking one this just resets it.
+	 * Either way, the caller must drain the ring with try_pop() afterwards. */
+	do {
+		flag = read(ring->eventfd, &count, sizeof(uint64_t));
+	} while (flag == -1 && errno == EINTR);
+
+	return flag == -1 && errno != EAGAIN ? -1 : 1;
+}
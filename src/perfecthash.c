@@ -0,0 +1,77 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perfecthash.h"
+
+/* Building */
+int perfect_hash_build(rpiwd_perfect_hash *table, const char *const *keys, size_t count) {
+	uint32_t slot, slot_count = 1;
+	size_t i;
+
+	if (count > PERFECT_HASH_MAX_KEYS)
+		return -1;
+
+	/* Twice as many slots as keys keeps the seed search short */
+	while (slot_count < count * 2)
+		slot_count <<= 1;
+
+	table->mask = slot_count - 1;
+	table->keys = keys;
+
+	for (i = 0; i < count; i++)
+		table->lengths[i] = strlen(keys[i]);
+
+	for (table->seed = 0; table->seed < PERFECT_HASH_MAX_SEEDS; table->seed++) {
+		memset(table->slots, 0, sizeof(table->slots));
+
+		for (i = 0; i < count; i++) {
+			slot = perfect_hash_string(keys[i], table->lengths[i], table->seed) & table->mask;
+			if (table->slots[slot])
+				break; /* Collision; try the next seed */
+
+			table->slots[slot] = i + 1;
+		}
+
+		if (i == count)
+			return 1;
+	}
+
+	return -1;
+}
+
+/* Lookups */
+int perfect_hash_lookup(const rpiwd_perfect_hash *table, const char *name, size_t length) {
+	int index = table->slots[perfect_hash_string(name, length, table->seed) & table->mask];
+
+	/* The slot can only hold this name; anything else is unknown */
+	if (index-- == 0 || table->lengths[index] != length ||
+		memcmp(table->keys[index], name, length) != 0)
+		return PERFECT_HASH_NO_KEY;
+
+	return index;
+}
+
+static uint32_t perfect_hash_string(const char *name, size_t length, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ (seed * 16777619u);
+
+	/* 32-bit FNV-1a; names are short, and the Pi's CPU is 32-bit */
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+
+	/* The low bits of a product only depend on the low bits of its factors,
+	 * so the slot would hardly change with the seed. Fold the high bits in. */
+	return hash ^ (hash >> 16);
+}
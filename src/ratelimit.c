@@ -0,0 +1,120 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ratelimit.h"
+
+/* Client table. Lookups are a hash and a few comparisons, so one lock shared
+ * by all workers is held only briefly. */
+static rpiwd_ratelimit_entry __table[RATELIMIT_TABLE_SIZE];
+static pthread_mutex_t __mtx_table = PTHREAD_MUTEX_INITIALIZER;
+
+/* Keys */
+void ratelimit_key_from_sockaddr(rpiwd_ratelimit_key *key, const struct sockaddr *addr) {
+	static const uint8_t v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *)addr;
+
+	memset(key, 0, sizeof(rpiwd_ratelimit_key));
+
+	if (addr->sa_family == AF_INET)
+		memcpy(key->addr, &((const struct sockaddr_in *)addr)->sin_addr, 4);
+	else if (addr->sa_family == AF_INET6) {
+		if (memcmp(addr6->sin6_addr.s6_addr, v4mapped, sizeof(v4mapped)) == 0)
+			memcpy(key->addr, addr6->sin6_addr.s6_addr + sizeof(v4mapped), 4);
+		else {
+			/* The /64 prefix; a flag byte keeps it apart from IPv4 keys */
+			memcpy(key->addr, addr6->sin6_addr.s6_addr, 8);
+			key->addr[8] = 6;
+		}
+	}
+
+	/* Anything else (e.g. a UNIX socket) shares the all-zeroes key */
+}
+
+bool ratelimit_admit(const rpiwd_ratelimit_key *key, int bucket, int per_minute,
+		int burst, uint64_t now_usec, unsigned int *retry_after) {
+	rpiwd_ratelimit_entry *entry;
+	rpiwd_token_bucket *b;
+	uint64_t capacity, refill, missing;
+	bool admitted;
+
+	if (bucket < 0 || bucket >= RATELIMIT_BUCKET_COUNT || per_minute <= 0)
+		return true;
+
+	capacity = (uint64_t)(burst > 0 ? burst : 1) * RATELIMIT_TOKEN;
+
+	pthread_mutex_lock(&__mtx_table);
+
+	entry = ratelimit_lookup(key, now_usec);
+	b = &entry->buckets[bucket];
+
+	/* Refill for the time since the bucket was last used. New buckets start
+	 * out full, so a client's first burst is never refused. */
+	if (b->updated_usec == 0)
+		b->tokens = capacity;
+	else if (now_usec > b->updated_usec) {
+		refill = (now_usec - b->updated_usec) * per_minute / 60;
+		b->tokens = refill >= capacity - b->tokens ? capacity : b->tokens + refill;
+	}
+
+	b->updated_usec = now_usec;
+
+	admitted = b->tokens >= RATELIMIT_TOKEN;
+	if (admitted)
+		b->tokens -= RATELIMIT_TOKEN;
+	else {
+		/* Round up to whole seconds, as Retry-After wants them */
+		missing = RATELIMIT_TOKEN - b->tokens;
+		*retry_after = (missing * 60 / per_minute + 999999) / 1000000;
+		if (*retry_after == 0)
+			*retry_after = 1;
+	}
+
+	pthread_mutex_unlock(&__mtx_table);
+
+	return admitted;
+}
+
+static rpiwd_ratelimit_entry *ratelimit_lookup(const rpiwd_ratelimit_key *key,
+		uint64_t now_usec) {
+	rpiwd_ratelimit_entry *entry, *victim = NULL;
+	uint32_t hash = 2166136261u; /* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < RATELIMIT_KEY_LENGTH; i++)
+		hash = (hash ^ key->addr[i]) * 16777619u;
+
+	/* Look for the client near its home slot. If it is not there, it takes
+	 * over a free slot or the one that was seen the longest time ago. */
+	for (i = 0; i < RATELIMIT_PROBE_LENGTH; i++) {
+		entry = &__table[(hash + i) & (RATELIMIT_TABLE_SIZE - 1)];
+
+		if (entry->in_use && memcmp(&entry->key, key, sizeof(rpiwd_ratelimit_key)) == 0) {
+			entry->last_seen_usec = now_usec;
+			return entry;
+		}
+
+		if (!victim || (victim->in_use &&
+				(!entry->in_use || entry->last_seen_usec < victim->last_seen_usec)))
+			victim = entry;
+	}
+
+	memset(victim, 0, sizeof(rpiwd_ratelimit_entry));
+	victim->in_use = true;
+	victim->key = *key;
+	victim->last_seen_usec = now_usec;
+
+	return victim;
+}
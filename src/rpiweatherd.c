@@ -73,6 +73,7 @@ void quit_routine(void) {
 	quit_logging();
 	quit_dbhandler();
 	quit_listener_loop();
+	quit_db_queue();
     unload_triggers();
 
 	/* Free memory */
@@ -86,6 +87,40 @@ void quit_routine(void) {
     }
 }
 
+void reload_routine(void) {
+    rpiwd_config *previous, *config;
+
+    /* The daemon keeps serving throughout; a broken file changes nothing */
+    if (reload_current_config(config_path, &previous) == -1) {
+        rpiwd_log(LOG_ERR, "errors in configuration file %s; keeping the " \
+                "current configuration.", config_path);
+        return;
+    }
+
+    config = get_current_config();
+
+    if (load_triggers() != TRIGGER_PARSE_OK)
+        rpiwd_log(LOG_ERR, "could not reload trigger file.");
+
+    /* Restart only what depends on settings that changed. The database
+     * always stays open; its location is fixed. */
+    if (strcmp(config->device_name, previous->device_name) != 0 ||
+        config->device_config != previous->device_config) {
+        if (device_init_by_name(config->device_name, config->device_config) !=
+                RETCODE_DEVICE_INIT_OK)
+            rpiwd_log(LOG_ERR, "could not initialize device \"%s\".", config->device_name);
+    }
+
+    reload_listener_loop(config->num_worker_threads,
+                         config->min_worker_threads,
+                         config->max_worker_threads,
+                         config->comm_port,
+                         config->reuseport,
+                         config->unix_socket);
+
+    rpiwd_log(LOG_INFO, "configuration reloaded (generation %u).", config->generation);
+}
+
 void version(void) {
     printf(ASCII_TITLE, RPIWEATHERD_VERSION,
             RPIWEATHERD_BUILD_DATE ? RPIWEATHERD_BUILD_DATE : "unknown");
@@ -110,9 +145,29 @@ void help(void) {
     fputc('\n', stdout);
 }
 
+void reading_routine(void) {
+    float results[RPIWD_MAX_MEASUREMENTS];
+    int retflag = RPIWD_DEVRETCODE_GENERAL_FAILURE;
+
+    /* Clients asked for this one, so it becomes the latest reading only:
+     * rows and triggers keep to the query interval. Clients give up after
+     * a while, so this does not try as long as a scheduled query. */
+    for (int qattempts = 0; qattempts < ON_DEMAND_QUERY_ATTEMPTS &&
+         retflag != RPIWD_DEVRETCODE_SUCCESS &&
+         retflag != RPIWD_DEVRETCODE_MEMORY_ERROR; qattempts++)
+        retflag = device_query_current(results);
+
+    if (retflag == RPIWD_DEVRETCODE_SUCCESS)
+        listener_publish_reading();
+    else
+        rpiwd_log(LOG_WARNING, "device %s failed to query for a client; error code %d.",
+                get_current_config()->device_name, retflag);
+}
+
 void query_loop(void) {
     int slept = 0, retflag, qattempts, ok_flag;
     float results[RPIWD_MAX_MEASUREMENTS];
+    uint64_t wake_usec, now_usec;
 
 	/* Query loop */
 	while (1) {
@@ -168,21 +223,20 @@ void query_loop(void) {
         if (ok_flag)
             trigger_exec_callback(results);
 
-		/* Sleep to wait till the next query time */
-		rpiwd_sleep(rpiwd_units_to_milliseconds(get_current_config()->query_interval));
+		/* Sleep to wait till the next query time. Clients asking for a newer
+		 * reading than the last one get it meanwhile, and the rest of the
+		 * interval is slept afterwards. */
+		wake_usec = rpiwd_monotonic_usec() +
+			rpiwd_units_to_milliseconds(get_current_config()->query_interval) * 1000ULL;
+		while (!__hupsignal && !__termsignal && (now_usec = rpiwd_monotonic_usec()) < wake_usec &&
+			   device_wait_sample_request((wake_usec - now_usec + 999) / 1000))
+			reading_routine();
 
 		/* Check if "woken up" */
 		if (__hupsignal) { /* SIGHUP = Reload all configs, devices, etc. */
 			__hupsignal = 0;
 
-			quit_dbhandler();
-            quit_listener_loop();
-            unload_triggers();
-			init_dbhandler();
-			free_current_config();
-			init_current_config(config_path);
-			init_listener_loop(get_current_config()->num_worker_threads, 
-                               get_current_config()->comm_port);
+			reload_routine();
 		}
         else if (__termsignal) { /* SIGTERM = Terminate application (quickly) */
 			quit_routine();
@@ -344,8 +398,12 @@ int main(int argc, char **argv) {
 	}
 
 	/* Finally - spin thread that listens for incoming GET requests */
-	init_listener_loop(get_current_config()->num_worker_threads, 
-					   get_current_config()->comm_port);
+	init_listener_loop(get_current_config()->num_worker_threads,
+					   get_current_config()->min_worker_threads,
+					   get_current_config()->max_worker_threads,
+					   get_current_config()->comm_port,
+					   get_current_config()->reuseport,
+					   get_current_config()->unix_socket);
 
 	/* Initiate query loop */
 	query_loop();
@@ -0,0 +1,155 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timerwheel.h"
+
+/* Init */
+void timerwheel_init(rpiwd_timerwheel *wheel, uint64_t now_ms) {
+	wheel->now = now_ms / TIMERWHEEL_TICK_MS;
+	wheel->count = 0;
+
+	for (int level = 0; level < TIMERWHEEL_LEVELS; level++)
+		for (int i = 0; i < TIMERWHEEL_SLOTS; i++)
+			wheel->slots[level][i] = NULL;
+}
+
+void timer_init(rpiwd_timer *timer, void *data) {
+	timer->expires = 0;
+	timer->slot = NULL;
+	timer->prev = timer->next = NULL;
+	timer->data = data;
+}
+
+/* Starting/stopping timers */
+void timerwheel_schedule(rpiwd_timerwheel *wheel, rpiwd_timer *timer, uint64_t expires_ms) {
+	uint64_t expires = expires_ms / TIMERWHEEL_TICK_MS;
+
+	if (timer->slot)
+		timerwheel_cancel(wheel, timer);
+
+	/* The slot of the current tick was already expired; the earliest a new
+	 * timer can go off is the next one. Rounding down would make it early. */
+	if (expires_ms % TIMERWHEEL_TICK_MS)
+		expires++;
+
+	if (expires <= wheel->now)
+		expires = wheel->now + 1;
+
+	timer->expires = expires;
+	timerwheel_insert(wheel, timer);
+	wheel->count++;
+}
+
+void timerwheel_cancel(rpiwd_timerwheel *wheel, rpiwd_timer *timer) {
+	if (!timer->slot)
+		return;
+
+	timerwheel_unlink(timer);
+	wheel->count--;
+}
+
+bool timer_is_pending(const rpiwd_timer *timer) {
+	return timer->slot != NULL;
+}
+
+size_t timerwheel_advance(rpiwd_timerwheel *wheel, uint64_t now_ms,
+		rpiwd_timer_callback callback, void *arg) {
+	uint64_t target = now_ms / TIMERWHEEL_TICK_MS;
+	rpiwd_timer **slot, *timer;
+	size_t expired = 0;
+	int level;
+
+	while (wheel->now < target) {
+		/* An empty wheel has nothing to catch up on */
+		if (wheel->count == 0) {
+			wheel->now = target;
+			break;
+		}
+
+		wheel->now++;
+
+		/* Whenever a level wraps around, the next slot of the level above
+		 * is due to be spread over it */
+		for (level = 1; level < TIMERWHEEL_LEVELS &&
+				((wheel->now >> (TIMERWHEEL_SLOT_BITS * (level - 1))) &
+				 TIMERWHEEL_SLOT_MASK) == 0; level++)
+			timerwheel_cascade(wheel, level);
+
+		/* Everything left in this slot is due. The callback may start timers
+		 * again, but never in this slot, so the loop ends. */
+		slot = &wheel->slots[0][wheel->now & TIMERWHEEL_SLOT_MASK];
+		while ((timer = *slot) != NULL) {
+			timerwheel_unlink(timer);
+			wheel->count--;
+			expired++;
+
+			callback(timer, arg);
+		}
+	}
+
+	return expired;
+}
+
+/* Internal helpers */
+static void timerwheel_insert(rpiwd_timerwheel *wheel, rpiwd_timer *timer) {
+	uint64_t delta = timer->expires - wheel->now;
+	rpiwd_timer **slot;
+	int level = 0;
+
+	if (delta > TIMERWHEEL_MAX_TICKS) {
+		timer->expires = wheel->now + TIMERWHEEL_MAX_TICKS;
+		delta = TIMERWHEEL_MAX_TICKS;
+	}
+
+	/* The lowest level whose lap still reaches the deadline */
+	while (delta >> (TIMERWHEEL_SLOT_BITS * (level + 1)))
+		level++;
+
+	slot = &wheel->slots[level][(timer->expires >> (TIMERWHEEL_SLOT_BITS * level)) &
+		TIMERWHEEL_SLOT_MASK];
+
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *slot;
+	if (*slot)
+		(*slot)->prev = timer;
+
+	*slot = timer;
+}
+
+static void timerwheel_unlink(rpiwd_timer *timer) {
+	if (timer->prev)
+		timer->prev->next = timer->next;
+	else
+		*timer->slot = timer->next;
+
+	if (timer->next)
+		timer->next->prev = timer->prev;
+
+	timer->slot = NULL;
+	timer->prev = timer->next = NULL;
+}
+
+static void timerwheel_cascade(rpiwd_timerwheel *wheel, int level) {
+	rpiwd_timer **slot = &wheel->slots[level][(wheel->now >> (TIMERWHEEL_SLOT_BITS * level)) &
+		TIMERWHEEL_SLOT_MASK], *timer;
+
+	/* Every timer in here is due within the coming lap of the level below */
+	while ((timer = *slot) != NULL) {
+		timerwheel_unlink(timer);
+		timerwheel_insert(wheel, timer);
+	}
+}
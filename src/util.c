@@ -119,6 +119,24 @@ void rpiwd_sleep(unsigned int milliseconds) {
 	nanosleep(&tms, NULL);
 }
 
+uint64_t rpiwd_monotonic_usec(void) {
+	struct timespec tms;
+
+	clock_gettime(CLOCK_MONOTONIC, &tms);
+
+	return (uint64_t)tms.tv_sec * 1000000 + tms.tv_nsec / 1000;
+}
+
+uint64_t rpiwd_hash64(const void *data, size_t length, uint64_t seed) {
+	const unsigned char *ptr = (const unsigned char *)data;
+
+	/* 64-bit FNV-1a */
+	for (size_t i = 0; i < length; i++)
+		seed = (seed ^ ptr[i]) * 1099511628211ULL;
+
+	return seed;
+}
+
 char *rpiwd_getline(const char *line, const char *newline) {
 	char *nline_pos = NULL, *buffer;
 	ptrdiff_t length;
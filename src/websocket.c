@@ -0,0 +1,329 @@
+/*
+ * rpiweatherd - A weather daemon for the Raspberry Pi that stores sensor data.
+ * Copyright (C) 2016-2017 Ronen Lapushner
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "websocket.h"
+
+/* Allocating/freeing */
+rpiwd_websocket *websocket_alloc(void) {
+	rpiwd_websocket *ws = malloc(sizeof(rpiwd_websocket));
+	if (!ws)
+		return NULL;
+
+	ws->subscribed = false;
+	websocket_filter_reset(&ws->filter);
+	ws->has_request_id = false;
+	ws->request_id = 0;
+	ws->message_opcode = 0;
+	ws->message_length = 0;
+	ws->message[0] = '\0';
+
+	return ws;
+}
+
+void websocket_free(rpiwd_websocket *ws) {
+	free(ws);
+}
+
+/* Handshake */
+void websocket_accept_key(const char *key, size_t length, char *accept) {
+	uint8_t buf[WEBSOCKET_KEY_LENGTH + sizeof(WEBSOCKET_GUID)];
+	uint8_t digest[WEBSOCKET_SHA1_LENGTH];
+
+	/* base64(SHA-1(key + GUID)); proves the server understood the request */
+	if (length > WEBSOCKET_KEY_LENGTH)
+		length = WEBSOCKET_KEY_LENGTH;
+
+	memcpy(buf, key, length);
+	memcpy(buf + length, WEBSOCKET_GUID, strlen(WEBSOCKET_GUID));
+
+	websocket_sha1(buf, length + strlen(WEBSOCKET_GUID), digest);
+	websocket_base64(digest, WEBSOCKET_SHA1_LENGTH, accept);
+}
+
+/* Framing */
+int websocket_parse_frame(char *buf, size_t length, websocket_frame *frame) {
+	const uint8_t *bytes = (const uint8_t *)buf;
+	size_t header_length = 2, payload_length;
+	uint8_t mask[4];
+
+	if (length < 2)
+		return WEBSOCKET_FRAME_INCOMPLETE;
+
+	/* No extensions were negotiated, so the reserved bits are zero. Clients
+	 * always mask their frames. */
+	if ((bytes[0] & 0x70) || !(bytes[1] & 0x80))
+		return WEBSOCKET_ERROR_PROTOCOL;
+
+	frame->fin = (bytes[0] & 0x80) != 0;
+	frame->opcode = bytes[0] & 0x0f;
+	payload_length = bytes[1] & 0x7f;
+
+	switch (frame->opcode) {
+		case WEBSOCKET_OPCODE_CONTINUATION:
+		case WEBSOCKET_OPCODE_TEXT:
+		case WEBSOCKET_OPCODE_BINARY:
+			break;
+		case WEBSOCKET_OPCODE_CLOSE:
+		case WEBSOCKET_OPCODE_PING:
+		case WEBSOCKET_OPCODE_PONG:
+			/* Control frames are short and never fragmented */
+			if (!frame->fin || payload_length > WEBSOCKET_MAX_CONTROL_PAYLOAD)
+				return WEBSOCKET_ERROR_PROTOCOL;
+			break;
+		default:
+			return WEBSOCKET_ERROR_PROTOCOL;
+	}
+
+	/* Extended payload length, in network byte order */
+	if (payload_length == 126) {
+		if (length < 4)
+			return WEBSOCKET_FRAME_INCOMPLETE;
+
+		payload_length = (size_t)bytes[2] << 8 | bytes[3];
+		header_length = 4;
+	}
+	else if (payload_length == 127) {
+		if (length < 10)
+			return WEBSOCKET_FRAME_INCOMPLETE;
+
+		/* Anything this long is refused, whatever the exact value */
+		if (bytes[2] || bytes[3] || bytes[4] || bytes[5])
+			return WEBSOCKET_ERROR_TOO_BIG;
+
+		payload_length = (size_t)bytes[6] << 24 | (size_t)bytes[7] << 16 |
+			(size_t)bytes[8] << 8 | bytes[9];
+		header_length = 10;
+	}
+
+	/* Refuse early, rather than wait for data that does not fit anyway */
+	if (payload_length > WEBSOCKET_MAX_MESSAGE_SIZE)
+		return WEBSOCKET_ERROR_TOO_BIG;
+
+	header_length += sizeof(mask);
+	if (length < header_length + payload_length)
+		return WEBSOCKET_FRAME_INCOMPLETE;
+
+	/* Unmask in place */
+	memcpy(mask, bytes + header_length - sizeof(mask), sizeof(mask));
+	for (size_t i = 0; i < payload_length; i++)
+		buf[header_length + i] ^= mask[i & 3];
+
+	frame->payload = buf + header_length;
+	frame->length = payload_length;
+	frame->frame_length = header_length + payload_length;
+
+	return WEBSOCKET_FRAME_COMPLETE;
+}
+
+int websocket_add_fragment(rpiwd_websocket *ws, const websocket_frame *frame) {
+	if (frame->opcode == WEBSOCKET_OPCODE_CONTINUATION) {
+		/* Continues nothing */
+		if (ws->message_opcode == 0)
+			return WEBSOCKET_ERROR_PROTOCOL;
+	}
+	else {
+		/* A new message may not start in the middle of another one */
+		if (ws->message_opcode != 0)
+			return WEBSOCKET_ERROR_PROTOCOL;
+
+		/* Commands are JSON text */
+		if (frame->opcode != WEBSOCKET_OPCODE_TEXT)
+			return WEBSOCKET_ERROR_UNSUPPORTED;
+
+		ws->message_opcode = frame->opcode;
+		ws->message_length = 0;
+	}
+
+	if (ws->message_length + frame->length > WEBSOCKET_MAX_MESSAGE_SIZE)
+		return WEBSOCKET_ERROR_TOO_BIG;
+
+	memcpy(ws->message + ws->message_length, frame->payload, frame->length);
+	ws->message_length += frame->length;
+
+	if (!frame->fin)
+		return WEBSOCKET_FRAME_INCOMPLETE;
+
+	ws->message[ws->message_length] = '\0';
+	ws->message_opcode = 0;
+
+	return WEBSOCKET_FRAME_COMPLETE;
+}
+
+size_t websocket_frame_header(char *buf, int opcode, size_t length) {
+	uint8_t *bytes = (uint8_t *)buf;
+
+	/* Messages are always sent in one frame */
+	bytes[0] = 0x80 | opcode;
+
+	if (length < 126) {
+		bytes[1] = length;
+		return 2;
+	}
+	else if (length <= 0xffff) {
+		bytes[1] = 126;
+		bytes[2] = length >> 8;
+		bytes[3] = length;
+		return 4;
+	}
+
+	bytes[1] = 127;
+	for (int i = 0; i < 8; i++)
+		bytes[2 + i] = (uint64_t)length >> (56 - 8 * i);
+
+	return 10;
+}
+
+uint16_t websocket_close_status(int errcode) {
+	switch (errcode) {
+		case WEBSOCKET_ERROR_TOO_BIG:
+			return WEBSOCKET_CLOSE_TOO_BIG;
+		case WEBSOCKET_ERROR_UNSUPPORTED:
+			return WEBSOCKET_CLOSE_UNSUPPORTED;
+	}
+
+	return WEBSOCKET_CLOSE_PROTOCOL_ERROR;
+}
+
+/* Filters */
+void websocket_filter_reset(websocket_filter *filter) {
+	filter->location[0] = filter->device_name[0] = '\0';
+	filter->min_temperature = filter->min_humidity = -INFINITY;
+	filter->max_temperature = filter->max_humidity = INFINITY;
+}
+
+bool websocket_filter_is_empty(const websocket_filter *filter) {
+	return !filter->location[0] && !filter->device_name[0] &&
+		isinf(filter->min_temperature) && isinf(filter->max_temperature) &&
+		isinf(filter->min_humidity) && isinf(filter->max_humidity);
+}
+
+bool websocket_filter_matches(const websocket_filter *filter, const entry *ent) {
+	if (filter->location[0] && strcmp(filter->location, ent->location) != 0)
+		return false;
+
+	if (filter->device_name[0] && strcmp(filter->device_name, ent->device_name) != 0)
+		return false;
+
+	return ent->temperature >= filter->min_temperature &&
+		ent->temperature <= filter->max_temperature &&
+		ent->humidity >= filter->min_humidity &&
+		ent->humidity <= filter->max_humidity;
+}
+
+/* Internal helpers */
+static void websocket_sha1(const uint8_t *data, size_t length, uint8_t *digest) {
+	uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	uint8_t block[64];
+	uint64_t bits = (uint64_t)length * 8;
+	size_t rest;
+
+	for (; length >= sizeof(block); data += sizeof(block), length -= sizeof(block))
+		websocket_sha1_block(state, data);
+
+	/* Pad with 0x80, zeroes and the length in bits; may take two blocks */
+	rest = length;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data, rest);
+	block[rest] = 0x80;
+
+	if (rest >= sizeof(block) - 8) {
+		websocket_sha1_block(state, block);
+		memset(block, 0, sizeof(block));
+	}
+
+	for (int i = 0; i < 8; i++)
+		block[sizeof(block) - 1 - i] = bits >> (8 * i);
+
+	websocket_sha1_block(state, block);
+
+	for (int i = 0; i < 5; i++) {
+		digest[4 * i] = state[i] >> 24;
+		digest[4 * i + 1] = state[i] >> 16;
+		digest[4 * i + 2] = state[i] >> 8;
+		digest[4 * i + 3] = state[i];
+	}
+}
+
+static void websocket_sha1_block(uint32_t *state, const uint8_t *block) {
+	uint32_t w[80], a = state[0], b = state[1], c = state[2], d = state[3],
+			 e = state[4], f, k, temp;
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+			(uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+
+	for (int i = 16; i < 80; i++)
+		w[i] = WEBSOCKET_SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	for (int i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		}
+		else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		}
+		else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		}
+		else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		temp = WEBSOCKET_SHA1_ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = WEBSOCKET_SHA1_ROL(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static size_t websocket_base64(const uint8_t *data, size_t length, char *out) {
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i, n = 0;
+	uint32_t triple;
+
+	for (i = 0; i + 2 < length; i += 3) {
+		triple = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+		out[n++] = alphabet[triple >> 18 & 0x3f];
+		out[n++] = alphabet[triple >> 12 & 0x3f];
+		out[n++] = alphabet[triple >> 6 & 0x3f];
+		out[n++] = alphabet[triple & 0x3f];
+	}
+
+	/* One or two bytes left; pad to a multiple of four characters */
+	if (i < length) {
+		triple = (uint32_t)data[i] << 16 | (i + 1 < length ? (uint32_t)data[i + 1] << 8 : 0);
+		out[n++] = alphabet[triple >> 18 & 0x3f];
+		out[n++] = alphabet[triple >> 12 & 0x3f];
+		out[n++] = i + 1 < length ? alphabet[triple >> 6 & 0x3f] : '=';
+		out[n++] = '=';
+	}
+
+	out[n] = '\0';
+	return n;
+}